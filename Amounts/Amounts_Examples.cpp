@@ -0,0 +1,302 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string_view>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// Maximum formatted length: 12 integer digits, decimal point, 8 decimals.
+constexpr size_t btc_amount_buffer_size = 21u;
+
+// Largest number of whole bitcoins representable in uint64_t satoshis.
+constexpr uint64_t satoshi_per_btc = 100000000u;
+constexpr uint64_t max_whole_btc = max_uint64 / satoshi_per_btc;
+
+
+// Scalar parser.
+//-----------------------------------------------------------------------------
+
+// Parse a decimal BTC amount such as "1.295" into satoshis.
+// Fails on empty input, characters other than digits and a single decimal
+// point, more than btc_decimal_places decimals, and uint64_t overflow.
+// No allocation is made, so fields can be passed directly from a CSV buffer.
+bool parse_btc_amount(uint64_t& out, std::string_view amount) {
+
+  const auto point = amount.find('.');
+  const auto whole = amount.substr(0, point);
+  const auto decimals = point == std::string_view::npos ?
+      std::string_view() : amount.substr(point + 1u);
+
+  // At least one digit, at most eight decimals.
+  if (whole.empty() && decimals.empty())
+    return false;
+
+  if (decimals.size() > btc_decimal_places)
+    return false;
+
+  uint64_t whole_btc = 0;
+  for (const auto character: whole) {
+    if (character < '0' || character > '9')
+      return false;
+
+    const uint64_t digit = character - '0';
+    if (whole_btc > (max_whole_btc - digit) / 10u)
+      return false;
+
+    whole_btc = whole_btc * 10u + digit;
+  }
+
+  uint64_t fraction = 0;
+  uint64_t scale = satoshi_per_btc;
+  for (const auto character: decimals) {
+    if (character < '0' || character > '9')
+      return false;
+
+    scale /= 10u;
+    fraction += (character - '0') * scale;
+  }
+
+  const auto satoshis = whole_btc * satoshi_per_btc;
+  if (satoshis > max_uint64 - fraction)
+    return false;
+
+  out = satoshis + fraction;
+  return true;
+
+}
+
+
+// Formatter.
+//-----------------------------------------------------------------------------
+
+// Format satoshis as a decimal BTC amount without trailing zeros, as with
+// encode_base10(). Writes into a caller buffer of btc_amount_buffer_size and
+// returns the number of characters written.
+size_t format_btc_amount(char* buffer, uint64_t satoshis) {
+
+  char digits[btc_amount_buffer_size];
+  auto whole_btc = satoshis / satoshi_per_btc;
+  auto fraction = satoshis % satoshi_per_btc;
+
+  // Whole part, written backwards.
+  size_t count = 0;
+  do {
+    digits[count++] = static_cast<char>('0' + whole_btc % 10u);
+    whole_btc /= 10u;
+  } while (whole_btc != 0);
+
+  size_t size = 0;
+  while (count > 0)
+    buffer[size++] = digits[--count];
+
+  if (fraction == 0)
+    return size;
+
+  // Decimals, without trailing zeros.
+  size_t places = btc_decimal_places;
+  while (fraction % 10u == 0) {
+    fraction /= 10u;
+    places--;
+  }
+
+  buffer[size++] = '.';
+  for (size_t index = places; index > 0; index--) {
+    buffer[size + index - 1u] = static_cast<char>('0' + fraction % 10u);
+    fraction /= 10u;
+  }
+
+  return size + places;
+
+}
+
+
+// Batch parser.
+//-----------------------------------------------------------------------------
+
+// Eight ASCII digits in one little-endian word, first digit in the low byte.
+// Returns false if any byte is not a digit.
+bool parse_eight_digits(uint64_t& out, uint64_t chunk) {
+
+  // Digits are 0x30-0x39: adding 0x46 overflows into the high bit for bytes
+  // above 0x39, subtracting 0x30 underflows into it for bytes below 0x30.
+  if ((((chunk + 0x4646464646464646) | (chunk - 0x3030303030303030)) &
+      0x8080808080808080) != 0)
+    return false;
+
+  // Combine digit pairs, then pairs of pairs, then the two halves.
+  chunk -= 0x3030303030303030;
+  chunk = (chunk * 10u) + (chunk >> 8u);
+  chunk = (((chunk & 0x000000ff000000ff) * (100u + (1000000ull << 32u))) +
+      (((chunk >> 16u) & 0x000000ff000000ff) * (1u + (10000ull << 32u))))
+      >> 32u;
+
+  out = chunk;
+  return true;
+
+}
+
+
+// Parse a column of amounts, writing satoshis to out and validity to valid.
+// Each field is normalised into a fixed frame of twelve whole digits and eight
+// decimals, which is then converted eight digits at a time in 64-bit words
+// (SIMD within a register), instead of one digit per iteration.
+// Returns the number of valid amounts.
+size_t parse_btc_amounts(const std::string_view* amounts, uint64_t* out,
+    bool* valid, size_t count) {
+
+  size_t parsed = 0;
+
+  for (size_t index = 0; index < count; index++) {
+    const auto amount = amounts[index];
+    const auto point = amount.find('.');
+    auto whole = amount.substr(0, point);
+    const auto decimals = point == std::string_view::npos ?
+        std::string_view() : amount.substr(point + 1u);
+
+    valid[index] = false;
+    out[index] = 0;
+    if (whole.empty() && decimals.empty())
+      continue;
+
+    // Leading zeros are accepted, as by parse_btc_amount().
+    whole.remove_prefix(std::min(whole.find_first_not_of('0'), whole.size()));
+    if (whole.size() > 12u || decimals.size() > btc_decimal_places)
+      continue;
+
+    // Frame: 4 padding + 12 whole digits + 8 decimals, right/left aligned.
+    char frame[24];
+    memset(frame, '0', sizeof(frame));
+    memcpy(frame + 16u - whole.size(), whole.data(), whole.size());
+    memcpy(frame + 16u, decimals.data(), decimals.size());
+
+    const auto words = reinterpret_cast<const uint8_t*>(frame);
+    uint64_t high, middle, low;
+    if (!parse_eight_digits(high,
+            from_little_endian_unsafe<uint64_t>(words)) ||
+        !parse_eight_digits(middle,
+            from_little_endian_unsafe<uint64_t>(words + 8u)) ||
+        !parse_eight_digits(low,
+            from_little_endian_unsafe<uint64_t>(words + 16u)))
+      continue;
+
+    // Whole part is high * 10^8 + middle, at most 12 digits.
+    const auto whole_btc = high * satoshi_per_btc + middle;
+    if (whole_btc > max_whole_btc)
+      continue;
+
+    const auto satoshis = whole_btc * satoshi_per_btc;
+    if (satoshis > max_uint64 - low)
+      continue;
+
+    out[index] = satoshis + low;
+    valid[index] = true;
+    parsed++;
+  }
+
+  return parsed;
+
+}
+
+
+void parse_and_format_amounts() {
+
+  // Amount strings as in the transaction building examples.
+  uint64_t satoshi_amount;
+  std::cout << parse_btc_amount(satoshi_amount, "1.295") << std::endl;
+  std::cout << satoshi_amount << std::endl; // Prints 129500000.
+
+  // Same result as decode_base10().
+  uint64_t decoded_amount;
+  std::string btc_amount_string = "1.295";
+  decode_base10(decoded_amount, btc_amount_string, btc_decimal_places);
+  std::cout << (satoshi_amount == decoded_amount) << std::endl;
+
+  // Precision and overflow checks.
+  std::cout << parse_btc_amount(satoshi_amount, "0.000000001") << std::endl;
+  std::cout << parse_btc_amount(satoshi_amount, "184467440737.09551616")
+            << std::endl;
+  std::cout << parse_btc_amount(satoshi_amount, "1,5") << std::endl;
+
+  // Both parsers accept leading zeros.
+  const std::string_view padded[] = { "0000000000000.5" };
+  uint64_t padded_amount;
+  bool padded_valid;
+  std::cout << (parse_btc_amount(satoshi_amount, padded[0]) &&
+      parse_btc_amounts(padded, &padded_amount, &padded_valid, 1u) == 1u &&
+      padded_amount == satoshi_amount) << std::endl;
+
+  // Formatting into a caller buffer.
+  char buffer[btc_amount_buffer_size];
+  const auto size = format_btc_amount(buffer, 129500000u);
+  std::cout << std::string_view(buffer, size) << std::endl; // Prints 1.295.
+  std::cout << (std::string(buffer, size) ==
+      encode_base10(129500000u, btc_decimal_places)) << std::endl;
+
+}
+
+
+void benchmark_amount_parsing(size_t count) {
+
+  // Column of amounts, e.g. parsed out of a payout CSV file.
+  std::vector<std::string> column;
+  column.reserve(count);
+  for (size_t index = 0; index < count; index++) {
+    const uint64_t satoshis = (index * 2654435761u) % (21000000 *
+        satoshi_per_btc);
+    column.push_back(encode_base10(satoshis, btc_decimal_places));
+  }
+
+  std::vector<std::string_view> views(column.begin(), column.end());
+  std::vector<uint64_t> decoded(count);
+  std::vector<uint64_t> parsed(count);
+  std::vector<uint64_t> batched(count);
+  std::unique_ptr<bool[]> valid(new bool[count]);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < count; index++)
+    decode_base10(decoded[index], column[index], btc_decimal_places);
+  const auto decode_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < count; index++)
+    parse_btc_amount(parsed[index], views[index]);
+  const auto parse_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  const auto valid_count = parse_btc_amounts(views.data(), batched.data(),
+      valid.get(), count);
+  const auto batch_time = std::chrono::steady_clock::now() - start;
+
+  const auto per_amount = [count](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+        .count() / static_cast<double>(count);
+  };
+
+  std::cout << "decode_base10:     " << per_amount(decode_time)
+            << " ns/amount" << std::endl;
+  std::cout << "parse_btc_amount:  " << per_amount(parse_time)
+            << " ns/amount" << std::endl;
+  std::cout << "parse_btc_amounts: " << per_amount(batch_time)
+            << " ns/amount" << std::endl;
+
+  // All three parsers agree.
+  std::cout << (valid_count == count && decoded == parsed &&
+      parsed == batched) << std::endl;
+
+}
+
+
+int main() {
+
+  parse_and_format_amounts();
+
+  benchmark_amount_parsing(1000000);
+
+  return 0;
+
+}
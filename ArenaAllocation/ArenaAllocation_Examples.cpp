@@ -0,0 +1,527 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Witness Aware" wallets.
+auto my_secret_witness_aware = base16_literal(
+    "0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+ec_private my_private_witness_aware(my_secret_witness_aware,
+    ec_private::testnet, true);
+auto pubkey_witness_aware = my_private_witness_aware.to_public().point();
+
+auto my_secret_witness_aware1 = base16_literal(
+    "2361b894dab5c45c3c448eb4ab65f847cb3000e05969f18c94b8850233a95b74");
+ec_private my_private_witness_aware1(my_secret_witness_aware1,
+    ec_private::testnet, true);
+auto pubkey_witness_aware1 = my_private_witness_aware1.to_public().point();
+
+auto my_secret_witness_aware2 = base16_literal(
+    "87493c67155f44a9a9a6abf621926a407121d6f4e1e94c75ced61208d7abe9db");
+ec_private my_private_witness_aware2(my_secret_witness_aware2,
+    ec_private::testnet, true);
+auto pubkey_witness_aware2 = my_private_witness_aware2.to_public().point();
+
+
+// Heap statistics, counted by the replaced global operator new below.
+std::atomic<size_t> heap_allocations(0);
+std::atomic<size_t> arena_allocations(0);
+
+
+// Contiguous memory region for bump allocation.
+// Deallocation of individual objects is a no-op, the region is released as a
+// whole with reset(). All objects allocated from the arena must be destroyed
+// before reset() is called.
+// Optionally, the region starts with fixed-size slots for small allocations,
+// such as the stack elements of a program. Deallocated slots are reused, so
+// pushes and pops of a program do not grow the arena.
+// Every block is preceded by a header holding its owner, so operator delete
+// finds the arena of a pointer without a search. An arena is owned by the
+// thread which constructs it. Its memory may be freed on other threads, but
+// slots are then only reused after reset().
+class arena {
+
+public:
+  static constexpr size_t alignment = alignof(std::max_align_t);
+  static constexpr size_t header_size = alignment;
+
+  // Fits a DER signature with sighash byte (73 bytes), a public key or hash.
+  static constexpr size_t slot_size =
+      (73u + alignment - 1) & ~(alignment - 1);
+  static constexpr size_t slot_stride = header_size + slot_size;
+
+  explicit arena(size_t capacity, size_t slots = 0)
+    : begin_(static_cast<uint8_t*>(std::malloc(slots * slot_stride +
+          capacity))),
+      slots_end_(begin_ + slots * slot_stride), end_(slots_end_ + capacity),
+      slot_position_(begin_), free_slots_(nullptr), position_(slots_end_),
+      high_water_(0), thread_(std::this_thread::get_id()) {
+    if (begin_ == nullptr)
+      throw std::bad_alloc();
+  }
+
+  ~arena() {
+    std::free(begin_);
+  }
+
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+
+  // Returns nullptr if the arena is exhausted.
+  void* allocate(size_t size) {
+    uint8_t* block = nullptr;
+    if (size <= slot_size) {
+      if (free_slots_ != nullptr) {
+        block = free_slots_;
+        free_slots_ = *reinterpret_cast<uint8_t**>(block + header_size);
+      } else if (slot_position_ != slots_end_) {
+        block = slot_position_;
+        slot_position_ += slot_stride;
+      }
+    }
+
+    if (block == nullptr) {
+      const auto aligned = header_size +
+          ((size + alignment - 1) & ~(alignment - 1));
+      if (aligned > static_cast<size_t>(end_ - position_))
+        return nullptr;
+
+      block = position_;
+      position_ += aligned;
+    }
+
+    return set_owner(block, this);
+  }
+
+  // Slots freed on the owning thread are reused, other allocations are
+  // released with reset(). The free list is not synchronised.
+  void deallocate(void* pointer) {
+    const auto block = static_cast<uint8_t*>(pointer) - header_size;
+    if (block >= slots_end_ || std::this_thread::get_id() != thread_)
+      return;
+
+    *static_cast<uint8_t**>(pointer) = free_slots_;
+    free_slots_ = block;
+  }
+
+  // Release all allocations at once, e.g. after each block.
+  void reset() {
+    high_water_ = std::max(high_water_, used());
+    slot_position_ = begin_;
+    free_slots_ = nullptr;
+    position_ = slots_end_;
+  }
+
+  size_t used() const {
+    return (slot_position_ - begin_) + (position_ - slots_end_);
+  }
+
+  size_t high_water() const {
+    return std::max(high_water_, used());
+  }
+
+  // Writes the owner, nullptr for a heap block, into the header of a block
+  // and returns the memory following the header.
+  static void* set_owner(void* block, arena* instance) {
+    *static_cast<arena**>(block) = instance;
+    return static_cast<uint8_t*>(block) + header_size;
+  }
+
+  // The arena from which the pointer was allocated, or nullptr.
+  static arena* owner(const void* pointer) {
+    return *reinterpret_cast<arena* const*>(
+        static_cast<const uint8_t*>(pointer) - header_size);
+  }
+
+private:
+  uint8_t* begin_;
+  uint8_t* slots_end_;
+  uint8_t* end_;
+  uint8_t* slot_position_;
+  uint8_t* free_slots_;
+  uint8_t* position_;
+  size_t high_water_;
+  const std::thread::id thread_;
+};
+
+
+// The arena used by global operator new on the current thread, if any.
+thread_local arena* current_arena = nullptr;
+
+
+// Routes all allocations of the current thread to an arena while in scope.
+// Libbitcoin chain types use the standard allocator, so this opts in every
+// transaction, input, output, script, operation and data_stack without
+// changes to their types.
+class arena_scope {
+
+public:
+  explicit arena_scope(arena& instance) : previous_(current_arena) {
+    current_arena = &instance;
+  }
+
+  ~arena_scope() {
+    current_arena = previous_;
+  }
+
+  arena_scope(const arena_scope&) = delete;
+  arena_scope& operator=(const arena_scope&) = delete;
+
+private:
+  arena* previous_;
+};
+
+
+// Replaced global allocation functions.
+//-----------------------------------------------------------------------------
+
+void* operator new(size_t size) {
+  if (current_arena != nullptr) {
+    const auto block = current_arena->allocate(size);
+    if (block != nullptr) {
+      arena_allocations.fetch_add(1, std::memory_order_relaxed);
+      return block;
+    }
+  }
+
+  // Not in arena scope or arena exhausted.
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  const auto block = std::malloc(arena::header_size + size);
+  if (block == nullptr)
+    throw std::bad_alloc();
+
+  return arena::set_owner(block, nullptr);
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+// The nothrow forms must also write the header read by operator delete.
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return operator new(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void* pointer) noexcept {
+  if (pointer == nullptr)
+    return;
+
+  const auto instance = arena::owner(pointer);
+  if (instance == nullptr)
+    std::free(static_cast<uint8_t*>(pointer) - arena::header_size);
+  else
+    instance->deallocate(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  operator delete(pointer);
+}
+
+
+// Transaction construction.
+//-----------------------------------------------------------------------------
+
+// P2WSH(2-of-3 multisig) spend, built as in the P2W examples.
+// The endorsements are passed in so that the benchmark measures construction.
+transaction build_p2wsh_spend(const hash_digest& prev_tx_hash,
+    const endorsement& sig0, const endorsement& sig1) {
+
+  // Build p2pkh output.
+  uint64_t output_amount = 129200000;
+  script output_script = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey_witness_aware));
+  output p2pkh_output(output_amount, output_script);
+
+  // P2WSH input.
+  output_point uxto_to_spend(prev_tx_hash, 0u);
+  input p2wsh_input;
+  p2wsh_input.set_previous_output(uxto_to_spend);
+  p2wsh_input.set_sequence(max_input_sequence);
+
+  // Build transaction.
+  transaction tx;
+  tx.set_version(1u);
+  tx.inputs().push_back(p2wsh_input);
+  tx.outputs().push_back(p2pkh_output);
+  tx.set_locktime(0u);
+
+  // Witness script: 2-of-3 multisig.
+  point_list points {
+      pubkey_witness_aware,
+      pubkey_witness_aware1,
+      pubkey_witness_aware2
+  };
+  script witness_script = script::to_pay_multisig_pattern(2u, points);
+
+  // Create witness.
+  data_stack witness_stack {
+      data_chunk(),
+      sig0,
+      sig1,
+      witness_script.to_data(false)
+  };
+  tx.inputs()[0].set_witness(witness(witness_stack));
+
+  return tx;
+
+}
+
+
+void arena_transaction_example() {
+
+  std::string prev_tx =
+      "98f85a8b774242979c9f0be37faba32d01c1e93fb69b4e6fa4b241b837dba293";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+
+  // Endorsements are created once, outside of the arena.
+  auto tx = build_p2wsh_spend(prev_tx_hash, endorsement(), endorsement());
+  point_list points {
+      pubkey_witness_aware,
+      pubkey_witness_aware1,
+      pubkey_witness_aware2
+  };
+  script witness_script = script::to_pay_multisig_pattern(2u, points);
+  endorsement sig0;
+  endorsement sig1;
+  uint64_t input_amount = 129500000;
+  script::create_endorsement(sig0, my_secret_witness_aware, witness_script, tx,
+      0u, sighash_algorithm::all, script_version::zero, input_amount);
+  script::create_endorsement(sig1, my_secret_witness_aware1, witness_script,
+      tx, 0u, sighash_algorithm::all, script_version::zero, input_amount);
+
+  // Heap allocations of one transaction built on the heap.
+  auto heap_before = heap_allocations.load();
+  data_chunk heap_serialised;
+  {
+    const auto heap_tx = build_p2wsh_spend(prev_tx_hash, sig0, sig1);
+    heap_serialised = heap_tx.to_data(true, true);
+  }
+  std::cout << "heap allocations:  " << heap_allocations - heap_before
+            << std::endl;
+
+  // The same transaction and all of its children built in one arena.
+  arena transaction_arena(64 * 1024);
+  data_chunk arena_serialised;
+  arena_serialised.reserve(heap_serialised.size());
+  heap_before = heap_allocations.load();
+  {
+    arena_scope scope(transaction_arena);
+    const auto arena_tx = build_p2wsh_spend(prev_tx_hash, sig0, sig1);
+
+    // Result must outlive the arena, so it is copied into heap storage which
+    // was reserved before entering the scope.
+    const auto serialised = arena_tx.to_data(true, true);
+    arena_serialised.assign(serialised.begin(), serialised.end());
+  }
+  std::cout << "heap allocations in arena scope: "
+            << heap_allocations - heap_before << std::endl;
+  std::cout << "arena bytes used:  " << transaction_arena.used() << std::endl;
+
+  // Released in one go.
+  transaction_arena.reset();
+
+  std::cout << (heap_serialised == arena_serialised) << std::endl;
+  std::cout << encode_base16(arena_serialised) << std::endl;
+
+}
+
+
+// Each worker owns one arena, which is reset after every block.
+void benchmark_block_construction(size_t transactions_per_block,
+    size_t blocks) {
+
+  // Construction does not validate endorsements, a 72-byte placeholder is
+  // sufficient to reproduce the allocation pattern of a signed spend.
+  const endorsement sig(72u, 0x30);
+
+  hash_digest prev_tx_hash = null_hash;
+  size_t checksum = 0;
+
+  // Heap: every object allocates independently.
+  auto heap_before = heap_allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for (size_t block = 0; block < blocks; block++) {
+    for (size_t index = 0; index < transactions_per_block; index++) {
+      prev_tx_hash[0] = static_cast<uint8_t>(index);
+      const auto tx = build_p2wsh_spend(prev_tx_hash, sig, sig);
+      checksum += tx.hash(true)[0];
+    }
+  }
+  const auto heap_time = std::chrono::steady_clock::now() - start;
+  const auto heap_count = heap_allocations - heap_before;
+
+  // Arena: one region per worker, reset per block.
+  arena block_arena(transactions_per_block * 8 * 1024);
+  heap_before = heap_allocations.load();
+  const auto arena_before = arena_allocations.load();
+  start = std::chrono::steady_clock::now();
+  for (size_t block = 0; block < blocks; block++) {
+    {
+      arena_scope scope(block_arena);
+      for (size_t index = 0; index < transactions_per_block; index++) {
+        prev_tx_hash[0] = static_cast<uint8_t>(index);
+        const auto tx = build_p2wsh_spend(prev_tx_hash, sig, sig);
+        checksum += tx.hash(true)[0];
+      }
+    }
+    block_arena.reset();
+  }
+  const auto arena_time = std::chrono::steady_clock::now() - start;
+  const auto arena_heap_count = heap_allocations - heap_before;
+  const auto arena_count = arena_allocations - arena_before;
+
+  const auto per_block = [blocks](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time)
+        .count() / blocks;
+  };
+
+  std::cout << "transactions per block:      " << transactions_per_block
+            << std::endl;
+  std::cout << "heap:  allocations per block " << heap_count / blocks
+            << ", " << per_block(heap_time) << " us per block" << std::endl;
+  std::cout << "arena: heap allocations per block " << arena_heap_count / blocks
+            << ", arena allocations per block " << arena_count / blocks
+            << ", " << per_block(arena_time) << " us per block" << std::endl;
+  std::cout << "arena high water mark:       " << block_arena.high_water()
+            << " bytes" << std::endl;
+  std::cout << "checksum:                    " << checksum << std::endl;
+
+}
+
+
+// Script verification.
+//-----------------------------------------------------------------------------
+
+// Each input is verified in a program arena, which is reset after the input.
+// Stack elements, witness stack copies and signature hash preimages are
+// allocated from the slots and the region of the arena.
+// Returns false if verification failed or made a heap allocation.
+bool benchmark_program_arena(size_t inputs) {
+
+  std::string prev_tx =
+      "98f85a8b774242979c9f0be37faba32d01c1e93fb69b4e6fa4b241b837dba293";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+
+  // Signed P2WSH(2-of-3 multisig) spend and its previous output.
+  auto tx = build_p2wsh_spend(prev_tx_hash, endorsement(), endorsement());
+  point_list points {
+      pubkey_witness_aware,
+      pubkey_witness_aware1,
+      pubkey_witness_aware2
+  };
+  script witness_script = script::to_pay_multisig_pattern(2u, points);
+  uint64_t input_amount = 129500000;
+  endorsement sig0;
+  endorsement sig1;
+  script::create_endorsement(sig0, my_secret_witness_aware, witness_script, tx,
+      0u, sighash_algorithm::all, script_version::zero, input_amount);
+  script::create_endorsement(sig1, my_secret_witness_aware1, witness_script,
+      tx, 0u, sighash_algorithm::all, script_version::zero, input_amount);
+  tx = build_p2wsh_spend(prev_tx_hash, sig0, sig1);
+
+  const script prevout_script(operation::list {
+      operation(opcode::push_size_0),
+      operation(to_chunk(sha256_hash(witness_script.to_data(false))))
+  });
+
+  // Signature verification context is created on first use, on the heap.
+  size_t failures = bool(script::verify(tx, 0u, rule_fork::all_rules,
+      prevout_script, input_amount));
+
+  // Heap: every stack element and copy allocates independently.
+  auto heap_before = heap_allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < inputs; index++)
+    failures += bool(script::verify(tx, 0u, rule_fork::all_rules,
+        prevout_script, input_amount));
+  const auto heap_time = std::chrono::steady_clock::now() - start;
+  const auto heap_count = heap_allocations - heap_before;
+
+  // Program arena: 64 slots for small allocations, reset after each input.
+  arena program_arena(64 * 1024, 64);
+  heap_before = heap_allocations.load();
+  const auto arena_before = arena_allocations.load();
+  start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < inputs; index++) {
+    {
+      arena_scope scope(program_arena);
+      failures += bool(script::verify(tx, 0u, rule_fork::all_rules,
+          prevout_script, input_amount));
+    }
+    program_arena.reset();
+  }
+  const auto arena_time = std::chrono::steady_clock::now() - start;
+  const auto arena_heap_count = heap_allocations - heap_before;
+  const auto arena_count = arena_allocations - arena_before;
+
+  const auto per_input = [inputs](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+        .count() / static_cast<double>(inputs);
+  };
+
+  std::cout << "heap:  allocations per input " << heap_count / inputs
+            << ", " << per_input(heap_time) << " ns per input" << std::endl;
+  std::cout << "arena: heap allocations per input " << arena_heap_count / inputs
+            << ", arena allocations per input " << arena_count / inputs
+            << ", " << per_input(arena_time) << " ns per input" << std::endl;
+  std::cout << "program arena high water mark: " << program_arena.high_water()
+            << " bytes" << std::endl;
+
+  // Prints 1: no heap allocation while verifying in the program arena.
+  const auto passed = arena_heap_count == 0 && failures == 0;
+  std::cout << passed << std::endl;
+  return passed;
+
+}
+
+
+int main() {
+
+  arena_transaction_example();
+
+  benchmark_block_construction(2000, 20);
+
+  // Fails the run if the program arena allocated on the heap.
+  if (!benchmark_program_arena(10000))
+    return 1;
+
+  return 0;
+
+}
@@ -0,0 +1,414 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Witness Aware" wallet.
+auto my_secret_witness_aware = base16_literal(
+    "0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+ec_private my_private_witness_aware(my_secret_witness_aware,
+    ec_private::testnet, true);
+auto pubkey_witness_aware = my_private_witness_aware.to_public().point();
+
+
+// Previous outputs of a block, by transaction and input index.
+// The entry of the coinbase transaction is empty.
+using block_prevouts = std::vector<output::list>;
+
+
+// Result of the verification of one block.
+struct block_result {
+  code ec;
+  size_t transaction_index;
+  uint32_t input_index;
+  size_t verified_inputs;
+  std::chrono::microseconds latency;
+};
+
+
+// Work-stealing block verifier.
+//-----------------------------------------------------------------------------
+
+// Verifies all inputs of a block with script::verify() on a fixed set of
+// threads. The inputs of the block are numbered consecutively, and each
+// thread starts with an equal slice of these numbers. A thread takes chunks
+// from the front of its own slice, and once it is empty steals the back half
+// of the largest remaining slice of another thread. Each thread holds only
+// a range of input numbers, so memory does not grow with the block size.
+// The first failing input aborts all threads at their next chunk.
+class block_verifier {
+
+public:
+  static constexpr size_t chunk_size = 16;
+
+  explicit block_verifier(size_t threads)
+    : ranges_(threads), block_(nullptr), prevouts_(nullptr), forks_(0),
+      abort_(false), verified_(0), failed_(max_size_t), active_(0),
+      generation_(0), stopping_(false) {
+    for (size_t index = 0; index < threads; index++)
+      threads_.emplace_back([this, index]() { work(index); });
+  }
+
+  ~block_verifier() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    start_.notify_all();
+    for (auto& thread: threads_)
+      thread.join();
+  }
+
+  block_verifier(const block_verifier&) = delete;
+  block_verifier& operator=(const block_verifier&) = delete;
+
+  // Verifies all inputs of all non-coinbase transactions of the block.
+  block_result verify(const block& block, const block_prevouts& prevouts,
+      uint32_t forks) {
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto& transactions = block.transactions();
+
+    // First input number of each transaction, and the total.
+    offsets_.resize(transactions.size() + 1u);
+    offsets_[0] = 0;
+    for (size_t index = 0; index < transactions.size(); index++)
+      offsets_[index + 1u] = offsets_[index] +
+          (transactions[index].is_coinbase() ? 0u :
+          transactions[index].inputs().size());
+
+    const auto total = offsets_.back();
+    const auto slice = (total + ranges_.size() - 1u) / ranges_.size();
+    for (size_t index = 0; index < ranges_.size(); index++) {
+      ranges_[index].begin = std::min(total, index * slice);
+      ranges_[index].end = std::min(total, (index + 1u) * slice);
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      block_ = &block;
+      prevouts_ = &prevouts;
+      forks_ = forks;
+      abort_ = false;
+      verified_ = 0;
+      failed_ = max_size_t;
+      error_ = error::success;
+      active_ = threads_.size();
+      generation_++;
+      start_.notify_all();
+      done_.wait(lock, [this]() { return active_ == 0; });
+    }
+
+    block_result result;
+    result.ec = error_;
+    result.verified_inputs = verified_;
+    result.transaction_index = 0;
+    result.input_index = 0;
+    if (failed_ != max_size_t)
+      locate(failed_, result.transaction_index, result.input_index);
+
+    result.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    return result;
+  }
+
+private:
+  // Range of input numbers owned by one thread, on its own cache line.
+  // The vector of ranges honours the over-alignment only with the aligned
+  // allocation of C++17, which the example is therefore compiled with.
+  struct alignas(64) input_range {
+    std::mutex mutex;
+    size_t begin;
+    size_t end;
+  };
+
+  void work(size_t self) {
+    size_t generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [this, generation]() {
+          return stopping_ || generation_ != generation;
+        });
+        if (stopping_)
+          return;
+
+        generation = generation_;
+      }
+
+      size_t begin, end;
+      while (!abort_.load(std::memory_order_relaxed) &&
+          take(self, begin, end))
+        verify_inputs(begin, end);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--active_ == 0)
+        done_.notify_one();
+    }
+  }
+
+  // Takes a chunk of the own range, stealing from others when it is empty.
+  bool take(size_t self, size_t& begin, size_t& end) {
+    auto& own = ranges_[self];
+    {
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (own.begin < own.end) {
+        begin = own.begin;
+        end = std::min(own.end, own.begin + chunk_size);
+        own.begin = end;
+        return true;
+      }
+    }
+
+    // Steal the back half of the largest remaining range. A single
+    // remaining input is stolen whole. If the victim has emptied since the
+    // scan, the scan is repeated without holding any range mutex.
+    while (true) {
+      size_t victim = self;
+      size_t largest = 0;
+      for (size_t index = 0; index < ranges_.size(); index++) {
+        std::lock_guard<std::mutex> lock(ranges_[index].mutex);
+        const auto remaining = ranges_[index].end - ranges_[index].begin;
+        if (remaining > largest) {
+          largest = remaining;
+          victim = index;
+        }
+      }
+
+      if (largest == 0)
+        return false;
+
+      size_t stolen_begin, stolen_end;
+      {
+        std::lock_guard<std::mutex> lock(ranges_[victim].mutex);
+        auto& range = ranges_[victim];
+        if (range.begin >= range.end)
+          continue;
+
+        stolen_begin = range.begin + (range.end - range.begin) / 2u;
+        stolen_end = range.end;
+        range.end = stolen_begin;
+      }
+
+      begin = stolen_begin;
+      end = std::min(stolen_end, stolen_begin + chunk_size);
+      std::lock_guard<std::mutex> lock(own.mutex);
+      own.begin = end;
+      own.end = stolen_end;
+      return true;
+    }
+  }
+
+  void verify_inputs(size_t begin, size_t end) {
+    const auto& transactions = block_->transactions();
+    size_t tx_index;
+    uint32_t input_index;
+    locate(begin, tx_index, input_index);
+
+    for (auto number = begin; number < end; number++) {
+      while (input_index == transactions[tx_index].inputs().size() ||
+          transactions[tx_index].is_coinbase()) {
+        tx_index++;
+        input_index = 0;
+      }
+
+      const auto& prevout = (*prevouts_)[tx_index][input_index];
+      const auto ec = script::verify(transactions[tx_index], input_index,
+          forks_, prevout.script(), prevout.value());
+
+      if (ec) {
+        fail(number, ec);
+        return;
+      }
+
+      verified_.fetch_add(1, std::memory_order_relaxed);
+      input_index++;
+    }
+  }
+
+  // Keeps the failure with the lowest input number, and aborts.
+  void fail(size_t number, const code& ec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (number < failed_) {
+      failed_ = number;
+      error_ = ec;
+    }
+    abort_.store(true, std::memory_order_relaxed);
+  }
+
+  // Transaction and input index of an input number.
+  void locate(size_t number, size_t& tx_index, uint32_t& input_index) const {
+    const auto it = std::upper_bound(offsets_.begin(), offsets_.end(),
+        number);
+    tx_index = std::distance(offsets_.begin(), it) - 1u;
+    input_index = static_cast<uint32_t>(number - offsets_[tx_index]);
+  }
+
+  std::vector<input_range> ranges_;
+  std::vector<size_t> offsets_;
+  const block* block_;
+  const block_prevouts* prevouts_;
+  uint32_t forks_;
+
+  std::atomic<bool> abort_;
+  std::atomic<size_t> verified_;
+  size_t failed_;
+  code error_;
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  size_t active_;
+  size_t generation_;
+  bool stopping_;
+};
+
+
+// Synthetic blocks.
+//-----------------------------------------------------------------------------
+
+// Block of P2WPKH spends with a coinbase transaction, and their prevouts.
+block create_block(size_t input_count, size_t inputs_per_tx,
+    block_prevouts& prevouts) {
+
+  const auto key_hash = bitcoin_short_hash(pubkey_witness_aware);
+  operation::list p2wpkh_operations;
+  p2wpkh_operations.push_back(operation(opcode::push_size_0));
+  p2wpkh_operations.push_back(operation(to_chunk(key_hash)));
+  const script p2wpkh_script(p2wpkh_operations);
+  const script script_code(script::to_pay_key_hash_pattern(key_hash));
+  const uint64_t prev_amount = 99500000u;
+
+  // Coinbase.
+  transaction::list transactions;
+  input coinbase_input;
+  coinbase_input.set_previous_output(output_point(null_hash,
+      point::null_index));
+  coinbase_input.set_script(script(data_chunk { 0x01, 0x00 }, false));
+  coinbase_input.set_sequence(max_input_sequence);
+  transaction coinbase;
+  coinbase.set_version(1u);
+  coinbase.inputs().push_back(coinbase_input);
+  coinbase.outputs().push_back(output(1250000000u, script_code));
+  transactions.push_back(coinbase);
+  prevouts.assign(1u, output::list());
+
+  hash_digest prev_tx_hash = null_hash;
+  for (size_t number = 0; number < input_count; number += inputs_per_tx) {
+    const auto count = std::min(inputs_per_tx, input_count - number);
+    transaction tx;
+    tx.set_version(1u);
+    output::list tx_prevouts;
+    for (size_t index = 0; index < count; index++) {
+      prev_tx_hash[0] = static_cast<uint8_t>(number + index);
+      prev_tx_hash[1] = static_cast<uint8_t>((number + index) >> 8u);
+      input spend;
+      spend.set_previous_output(output_point(prev_tx_hash, 0u));
+      spend.set_sequence(max_input_sequence);
+      tx.inputs().push_back(spend);
+      tx_prevouts.push_back(output(prev_amount, p2wpkh_script));
+    }
+
+    tx.outputs().push_back(output(count * prev_amount - 10000u,
+        script_code));
+    tx.set_locktime(0u);
+
+    for (uint32_t index = 0; index < count; index++) {
+      endorsement sig;
+      script::create_endorsement(sig, my_secret_witness_aware, script_code,
+          tx, index, sighash_algorithm::all, script_version::zero,
+          prev_amount);
+      data_stack witness_stack { sig, to_chunk(pubkey_witness_aware) };
+      tx.inputs()[index].set_witness(witness(witness_stack));
+    }
+
+    transactions.push_back(tx);
+    prevouts.push_back(tx_prevouts);
+  }
+
+  header block_header;
+  block_header.set_version(0x20000000);
+  return block(block_header, transactions);
+
+}
+
+
+void verify_block_example() {
+
+  block_prevouts prevouts;
+  auto test_block = create_block(1000u, 2u, prevouts);
+
+  block_verifier verifier(4u);
+  auto result = verifier.verify(test_block, prevouts, rule_fork::all_rules);
+
+  // Prints success, 1000 inputs.
+  std::cout << result.ec.message() << ", " << result.verified_inputs
+            << " inputs, " << result.latency.count() << " us" << std::endl;
+
+  // Invalid signature in transaction 300: all threads abort.
+  auto& transactions = test_block.transactions();
+  auto stack = transactions[300].inputs()[1].witness().stack();
+  stack[0][10] ^= 0x01;
+  transactions[300].inputs()[1].set_witness(witness(stack));
+
+  result = verifier.verify(test_block, prevouts, rule_fork::all_rules);
+  std::cout << result.ec.message() << " in transaction "
+            << result.transaction_index << ", input " << result.input_index
+            << std::endl;
+  std::cout << result.verified_inputs << " of 1000 inputs verified"
+            << std::endl;
+
+}
+
+
+void benchmark_block_verification(size_t input_count, size_t blocks) {
+
+  block_prevouts prevouts;
+  const auto test_block = create_block(input_count, 2u, prevouts);
+  std::cout << "inputs per block: " << input_count << std::endl;
+
+  const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t threads = 1; threads <= hardware; threads *= 2) {
+    block_verifier verifier(threads);
+    std::chrono::microseconds total(0);
+    std::chrono::microseconds worst(0);
+    auto valid = true;
+    for (size_t index = 0; index < blocks; index++) {
+      const auto result = verifier.verify(test_block, prevouts,
+          rule_fork::all_rules);
+      valid &= !result.ec && result.verified_inputs == input_count;
+      total += result.latency;
+      worst = std::max(worst, result.latency);
+    }
+
+    std::cout << "  " << threads << " thread(s): "
+              << total.count() / blocks / 1000 << " ms per block, worst "
+              << worst.count() / 1000 << " ms, valid: " << valid
+              << std::endl;
+  }
+
+}
+
+
+int main() {
+
+  verify_block_example();
+
+  benchmark_block_verification(2000, 5);
+  benchmark_block_verification(5000, 5);
+  benchmark_block_verification(10000, 5);
+
+  return 0;
+
+}
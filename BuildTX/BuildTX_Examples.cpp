@@ -1,6 +1,11 @@
 #include <bitcoin/bitcoin.hpp>
 #include <string.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <streambuf>
+#include <sys/uio.h>
+#include <unistd.h>
 
 using namespace bc;
 using namespace wallet;
@@ -117,6 +122,529 @@ void example_1() {
 
 }
 
+// Serialise a transaction into a caller-provided buffer.
+// Returns the number of bytes written, or zero if the buffer is too small.
+size_t serialize_to_buffer(const transaction& tx, uint8_t* buffer,
+    size_t buffer_size, bool witness) {
+
+  // Exact serialised size is known before a single byte is written.
+  const auto size = tx.serialized_size(true, witness);
+  if (size > buffer_size)
+    return 0;
+
+  // The serializer writes straight into the buffer, no data_chunk is created.
+  auto sink = make_unsafe_serializer(buffer);
+  tx.to_data(sink, true, witness);
+  return size;
+
+}
+
+
+// Stream buffer which flushes a fixed-size staging area to a file descriptor.
+class fd_streambuf : public std::streambuf {
+
+public:
+  explicit fd_streambuf(int fd) : fd_(fd), failed_(false) {
+    setp(staging_, staging_ + sizeof(staging_));
+  }
+
+  bool failed() const {
+    return failed_;
+  }
+
+protected:
+  int_type overflow(int_type value) override {
+    if (!flush_staging())
+      return traits_type::eof();
+
+    if (!traits_type::eq_int_type(value, traits_type::eof()))
+      sputc(traits_type::to_char_type(value));
+
+    return traits_type::not_eof(value);
+  }
+
+  int sync() override {
+    return flush_staging() ? 0 : -1;
+  }
+
+private:
+  bool flush_staging() {
+    auto first = pbase();
+    while (first < pptr()) {
+      const auto written = ::write(fd_, first, pptr() - first);
+      if (written <= 0) {
+        failed_ = true;
+        return false;
+      }
+      first += written;
+    }
+    setp(staging_, staging_ + sizeof(staging_));
+    return true;
+  }
+
+  int fd_;
+  bool failed_;
+  char staging_[4096];
+};
+
+
+// Serialise a transaction to a file descriptor (file, pipe or socket).
+// Only the 4KB staging area of the stream buffer is used.
+bool serialize_to_fd(const transaction& tx, int fd, bool witness) {
+
+  fd_streambuf buffer(fd);
+  std::ostream stream(&buffer);
+  ostream_writer sink(stream);
+  tx.to_data(sink, true, witness);
+  stream.flush();
+  return !buffer.failed() && stream.good();
+
+}
+
+
+// Stream buffer which fills a chain of caller-provided iovec segments.
+class iovec_streambuf : public std::streambuf {
+
+public:
+  iovec_streambuf(const iovec* segments, size_t count)
+    : segments_(segments), count_(count), current_(0), completed_(0) {
+    next_segment();
+  }
+
+  // Total number of bytes written across all segments.
+  size_t size() const {
+    return completed_ + (pptr() - pbase());
+  }
+
+protected:
+  int_type overflow(int_type value) override {
+    completed_ += pptr() - pbase();
+    current_++;
+    if (!next_segment() || traits_type::eq_int_type(value, traits_type::eof()))
+      return traits_type::eof();
+
+    sputc(traits_type::to_char_type(value));
+    return value;
+  }
+
+private:
+  bool next_segment() {
+
+    // Skip empty segments.
+    while (current_ < count_ && segments_[current_].iov_len == 0)
+      current_++;
+
+    if (current_ == count_) {
+      setp(nullptr, nullptr);
+      return false;
+    }
+
+    auto base = static_cast<char*>(segments_[current_].iov_base);
+    setp(base, base + segments_[current_].iov_len);
+    return true;
+  }
+
+  const iovec* segments_;
+  size_t count_;
+  size_t current_;
+  size_t completed_;
+};
+
+
+// Serialise a transaction into a chain of iovec segments.
+// Returns the number of bytes written, or zero if the chain is too small.
+size_t serialize_to_iovec(const transaction& tx, const iovec* segments,
+    size_t count, bool witness) {
+
+  size_t capacity = 0;
+  for (size_t index = 0; index < count; index++)
+    capacity += segments[index].iov_len;
+
+  const auto size = tx.serialized_size(true, witness);
+  if (size > capacity)
+    return 0;
+
+  iovec_streambuf buffer(segments, count);
+  std::ostream stream(&buffer);
+  ostream_writer sink(stream);
+  tx.to_data(sink, true, witness);
+  return buffer.size() == size ? size : 0;
+
+}
+
+
+void example_2() {
+
+  //******* part 1 *******
+
+  //P2WPKH spend with witness, so both serialisation forms differ.
+  auto my_secret = base16_literal("0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+  ec_private my_private(my_secret, ec_private::testnet, true);
+  ec_compressed pubkey = my_private.to_public().point();
+
+  std::string prev_tx_string = "26c9768cdbb00332ff1052f27e71eb7e82b578bf02fb6d7eecfd0b43412e9d10";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash, prev_tx_string);
+  input input_0;
+  input_0.set_previous_output(output_point(prev_tx_hash, 0u));
+  input_0.set_sequence(max_input_sequence);
+
+  std::string btc_amount_string = "0.993";
+  uint64_t satoshi_amount;
+  decode_base10(satoshi_amount, btc_amount_string, btc_decimal_places);
+  output output_0(satoshi_amount,
+      script::to_pay_key_hash_pattern(bitcoin_short_hash(pubkey)));
+
+  transaction tx;
+  tx.set_version(1u);
+  tx.inputs().push_back(input_0);
+  tx.outputs().push_back(output_0);
+
+  std::string prev_btc_amount_string = "0.995";
+  uint64_t prev_amount;
+  decode_base10(prev_amount, prev_btc_amount_string, btc_decimal_places);
+  endorsement sig_0;
+  script script_code = script::to_pay_key_hash_pattern(bitcoin_short_hash(pubkey));
+  script::create_endorsement(sig_0, my_secret, script_code, tx, 0u,
+      sighash_algorithm::all, script_version::zero, prev_amount);
+
+  data_stack witness_stack;
+  witness_stack.push_back(sig_0);
+  witness_stack.push_back(to_chunk(pubkey));
+  tx.inputs()[0].set_witness(witness(witness_stack));
+
+  //******* part 2 *******
+
+  //Caller-provided buffer, e.g. reused by a relay or storage thread.
+  uint8_t buffer[1024];
+
+  //Non-witness form (txid preimage).
+  auto size = serialize_to_buffer(tx, buffer, sizeof(buffer), false);
+  std::cout << (data_chunk(buffer, buffer + size) == tx.to_data()) << std::endl;
+
+  //Witness form (wtxid preimage / wire format).
+  size = serialize_to_buffer(tx, buffer, sizeof(buffer), true);
+  std::cout << (data_chunk(buffer, buffer + size) == tx.to_data(true, true))
+            << std::endl;
+
+  //******* part 3 *******
+
+  //File descriptor, here a pipe, written through a 4KB staging area.
+  int pipe_fds[2];
+  if (::pipe(pipe_fds) == 0) {
+    std::cout << serialize_to_fd(tx, pipe_fds[1], true) << std::endl;
+    ::close(pipe_fds[1]);
+
+    data_chunk piped(tx.serialized_size(true, true));
+    auto read = ::read(pipe_fds[0], piped.data(), piped.size());
+    std::cout << (read == static_cast<ssize_t>(piped.size()) &&
+        piped == tx.to_data(true, true)) << std::endl;
+    ::close(pipe_fds[0]);
+  }
+
+  //******* part 4 *******
+
+  //iovec chain, e.g. a message header segment followed by payload segments.
+  uint8_t segment_0[10];
+  uint8_t segment_1[64];
+  uint8_t segment_2[512];
+  iovec segments[] = {
+      { segment_0, sizeof(segment_0) },
+      { segment_1, sizeof(segment_1) },
+      { segment_2, sizeof(segment_2) }
+  };
+  size = serialize_to_iovec(tx, segments, 3u, true);
+
+  //Gather the segments to compare with to_data().
+  data_chunk gathered;
+  for (const auto& segment: segments) {
+    auto first = static_cast<uint8_t*>(segment.iov_base);
+    auto count = std::min(segment.iov_len, size - gathered.size());
+    gathered.insert(gathered.end(), first, first + count);
+  }
+  std::cout << (gathered == tx.to_data(true, true)) << std::endl;
+
+}
+
+
+// Transaction under construction, with serialised sizes kept up to date.
+// Base size (non-witness serialisation) and witness size are adjusted on
+// every change, so weight() and virtual_size() are answered in constant time
+// without serialising the transaction.
+class transaction_builder {
+
+public:
+  explicit transaction_builder(uint32_t version = 1u, uint32_t locktime = 0u)
+    : base_size_(empty_transaction_size), witness_size_(0),
+      witness_inputs_(0) {
+    tx_.set_version(version);
+    tx_.set_locktime(locktime);
+  }
+
+  // Returns the index of the new input.
+  size_t add_input(const output_point& previous_output, uint32_t sequence) {
+    auto& inputs = tx_.inputs();
+    base_size_ += count_delta(inputs.size());
+
+    input next;
+    next.set_previous_output(previous_output);
+    next.set_sequence(sequence);
+    inputs.push_back(next);
+
+    base_size_ += input_size(inputs.back());
+    add_witness(inputs.back().witness());
+    return inputs.size() - 1u;
+  }
+
+  // Returns the index of the new output.
+  size_t add_output(const output& value) {
+    auto& outputs = tx_.outputs();
+    base_size_ += count_delta(outputs.size());
+    outputs.push_back(value);
+    base_size_ += value.serialized_size();
+    return outputs.size() - 1u;
+  }
+
+  // Remove the last input, e.g. a rejected coin selection candidate.
+  void pop_input() {
+    auto& inputs = tx_.inputs();
+    base_size_ -= input_size(inputs.back());
+    remove_witness(inputs.back().witness());
+    inputs.pop_back();
+    base_size_ -= count_delta(inputs.size());
+  }
+
+  // Remove the last output, e.g. a change output below the dust limit.
+  void pop_output() {
+    auto& outputs = tx_.outputs();
+    base_size_ -= outputs.back().serialized_size();
+    outputs.pop_back();
+    base_size_ -= count_delta(outputs.size());
+  }
+
+  void set_script(size_t index, const script& value) {
+    auto& input = tx_.inputs()[index];
+    base_size_ -= input.script().serialized_size(true);
+    input.set_script(value);
+    base_size_ += input.script().serialized_size(true);
+  }
+
+  void set_witness(size_t index, const witness& value) {
+    auto& input = tx_.inputs()[index];
+    remove_witness(input.witness());
+    input.set_witness(value);
+    add_witness(input.witness());
+  }
+
+  // Equal to tx.serialized_size(true, false).
+  size_t base_size() const {
+    return base_size_;
+  }
+
+  // Equal to tx.serialized_size(true, true).
+  size_t total_size() const {
+    // Marker, flag and one witness per input, once any witness is present.
+    return witness_inputs_ == 0 ? base_size_ :
+        base_size_ + marker_flag_size + witness_size_;
+  }
+
+  // BIP141: base size * 3 + total size.
+  size_t weight() const {
+    return base_size_ * 3u + total_size();
+  }
+
+  size_t virtual_size() const {
+    return (weight() + 3u) / 4u;
+  }
+
+  const transaction& tx() const {
+    return tx_;
+  }
+
+private:
+  // Version and locktime, plus single byte input and output counts.
+  static constexpr size_t empty_transaction_size = 4u + 4u + 1u + 1u;
+  static constexpr size_t marker_flag_size = 2u;
+
+  // Growth of a count prefix when the count is incremented from count.
+  static size_t count_delta(size_t count) {
+    return variable_uint_size(count + 1u) - variable_uint_size(count);
+  }
+
+  // Previous output point, script with size prefix and sequence.
+  static size_t input_size(const input& value) {
+    return hash_size + 4u + value.script().serialized_size(true) + 4u;
+  }
+
+  // An empty witness is still serialised as a zero item count.
+  void add_witness(const witness& value) {
+    witness_size_ += value.serialized_size(true);
+    if (!value.stack().empty())
+      witness_inputs_++;
+  }
+
+  void remove_witness(const witness& value) {
+    witness_size_ -= value.serialized_size(true);
+    if (!value.stack().empty())
+      witness_inputs_--;
+  }
+
+  transaction tx_;
+  size_t base_size_;
+  size_t witness_size_;
+  size_t witness_inputs_;
+};
+
+
+// Check builder sizes against a full serialisation of the transaction.
+bool sizes_match(const transaction_builder& builder) {
+  const auto& tx = builder.tx();
+  const auto base_size = tx.serialized_size(true, false);
+  const auto total_size = tx.serialized_size(true, true);
+  return builder.base_size() == base_size &&
+      builder.total_size() == total_size &&
+      builder.weight() == base_size * 3u + total_size &&
+      builder.total_size() == tx.to_data(true, true).size();
+}
+
+
+// Placeholder P2WPKH witness for fee estimation before signing: a 72 byte
+// endorsement is the largest DER signature with its sighash byte.
+witness p2wpkh_placeholder() {
+  data_stack witness_stack;
+  witness_stack.push_back(data_chunk(72u, 0x00));
+  witness_stack.push_back(data_chunk(ec_compressed_size, 0x00));
+  return witness(witness_stack);
+}
+
+
+void example_3() {
+
+  //******* part 1 *******
+
+  //Legacy P2PKH and P2WPKH keys of examples 1 and 2.
+  auto my_secret0 = base16_literal("3eec08386d08321cd7143859e9bf4d6f65a71d24f37536d76b4224fdea48009f");
+  ec_private my_private0(my_secret0, ec_private::testnet, true);
+  ec_compressed pubkey0 = my_private0.to_public().point();
+
+  auto my_secret1 = base16_literal("0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+  ec_private my_private1(my_secret1, ec_private::testnet, true);
+  ec_compressed pubkey1 = my_private1.to_public().point();
+
+  std::string prev_tx_string_0 = "ca05e6c14fe816c93b91dd4c8f00e60e4a205da85741f26326d6f21f9a5ac5e9";
+  hash_digest prev_tx_hash_0;
+  decode_hash(prev_tx_hash_0, prev_tx_string_0);
+  std::string prev_tx_string_1 = "26c9768cdbb00332ff1052f27e71eb7e82b578bf02fb6d7eecfd0b43412e9d10";
+  hash_digest prev_tx_hash_1;
+  decode_hash(prev_tx_hash_1, prev_tx_string_1);
+
+  //******* part 2 *******
+
+  //Sizes are maintained as the transaction is built.
+  transaction_builder builder;
+  builder.add_input(output_point(prev_tx_hash_0, 0u), max_input_sequence);
+  builder.add_input(output_point(prev_tx_hash_1, 0u), max_input_sequence);
+  builder.add_output(output(129500000u,
+      script::to_pay_key_hash_pattern(bitcoin_short_hash(pubkey1))));
+  std::cout << sizes_match(builder) << std::endl;
+
+  //Estimate with a placeholder witness, before signing.
+  builder.set_witness(1u, p2wpkh_placeholder());
+  std::cout << builder.weight() << " " << builder.virtual_size()
+            << std::endl;
+  std::cout << sizes_match(builder) << std::endl;
+
+  //******* part 3 *******
+
+  //Sign the P2PKH input.
+  endorsement sig_0;
+  script prev_script_0 = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey0));
+  script::create_endorsement(sig_0, my_secret0, prev_script_0, builder.tx(),
+      0u, sighash_algorithm::all);
+  operation::list sig_script_0;
+  sig_script_0.push_back(operation(sig_0));
+  sig_script_0.push_back(operation(to_chunk(pubkey0)));
+  builder.set_script(0u, script(sig_script_0));
+
+  //Sign the P2WPKH input.
+  std::string prev_btc_amount_string = "0.995";
+  uint64_t prev_amount;
+  decode_base10(prev_amount, prev_btc_amount_string, btc_decimal_places);
+  endorsement sig_1;
+  script script_code = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey1));
+  script::create_endorsement(sig_1, my_secret1, script_code, builder.tx(), 1u,
+      sighash_algorithm::all, script_version::zero, prev_amount);
+  data_stack witness_stack;
+  witness_stack.push_back(sig_1);
+  witness_stack.push_back(to_chunk(pubkey1));
+  builder.set_witness(1u, witness(witness_stack));
+
+  //Signed weight is at most the estimate.
+  std::cout << builder.weight() << " " << builder.virtual_size()
+            << std::endl;
+  std::cout << sizes_match(builder) << std::endl;
+
+}
+
+
+void benchmark_incremental_weight(size_t candidates) {
+
+  //Payment and change outputs, as for a fee estimate in coin selection.
+  transaction_builder builder;
+  builder.add_output(output(50000000u, script::to_pay_key_hash_pattern(
+      null_short_hash)));
+  builder.add_output(output(0u, script::to_pay_key_hash_pattern(
+      null_short_hash)));
+  const auto placeholder = p2wpkh_placeholder();
+  hash_digest prev_tx_hash = null_hash;
+
+  //Add each candidate input, query its weight and keep it.
+  size_t serialized_weight = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < candidates; index++) {
+    prev_tx_hash[0] = static_cast<uint8_t>(index);
+    const auto input_index = builder.add_input(
+        output_point(prev_tx_hash, index), max_input_sequence);
+    builder.set_witness(input_index, placeholder);
+    const auto& tx = builder.tx();
+    serialized_weight += tx.to_data(true, false).size() * 3u +
+        tx.to_data(true, true).size();
+  }
+  const auto serialized_time = std::chrono::steady_clock::now() - start;
+
+  while (builder.tx().inputs().size() > 0)
+    builder.pop_input();
+
+  size_t incremental_weight = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < candidates; index++) {
+    prev_tx_hash[0] = static_cast<uint8_t>(index);
+    const auto input_index = builder.add_input(
+        output_point(prev_tx_hash, index), max_input_sequence);
+    builder.set_witness(input_index, placeholder);
+    incremental_weight += builder.weight();
+  }
+  const auto incremental_time = std::chrono::steady_clock::now() - start;
+
+  const auto per_candidate = [candidates](
+      std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+        .count() / static_cast<double>(candidates);
+  };
+
+  std::cout << "serialised weight:  " << per_candidate(serialized_time)
+            << " ns/candidate" << std::endl;
+  std::cout << "incremental weight: " << per_candidate(incremental_time)
+            << " ns/candidate" << std::endl;
+
+  //Both produced the same weights.
+  std::cout << (serialized_weight == incremental_weight) << std::endl;
+  std::cout << sizes_match(builder) << std::endl;
+
+}
+
 
 int main() {
 
@@ -124,6 +652,16 @@ int main() {
   example_1();
   std::cout << "\n";
 
+  std::cout << "Example 2: " << "\n";
+  example_2();
+  std::cout << "\n";
+
+  std::cout << "Example 3: " << "\n";
+  example_3();
+  std::cout << "\n";
+
+  benchmark_incremental_weight(2000);
+
   return 0;
 
 }
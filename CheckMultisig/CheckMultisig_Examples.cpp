@@ -0,0 +1,473 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+
+// Multisig keys.
+//-----------------------------------------------------------------------------
+
+// Keys of a multisig script, decompressed once for all signature checks.
+// Keys are compared in compressed form, so that compressed and uncompressed
+// script keys are matched as the interpreter matches them.
+class multisig_keys {
+
+public:
+  explicit multisig_keys(const script& multisig_script)
+    : signatures_(0) {
+
+    const auto& operations = multisig_script.operations();
+    if (!script::is_pay_multisig_pattern(operations))
+      return;
+
+    signatures_ = operation::opcode_to_positive(operations.front().code());
+    for (size_t index = 1; index < operations.size() - 2u; index++) {
+      const auto& point = operations[index].data();
+      key entry { false, {}, {} };
+
+      if (point.size() == ec_compressed_size) {
+        std::copy(point.begin(), point.end(), entry.compressed.begin());
+        entry.valid = decompress(entry.uncompressed, entry.compressed);
+      } else if (point.size() == ec_uncompressed_size) {
+        std::copy(point.begin(), point.end(), entry.uncompressed.begin());
+        entry.valid = compress(entry.compressed, entry.uncompressed);
+      }
+
+      keys_.push_back(entry);
+    }
+  }
+
+  bool valid() const {
+    return signatures_ != 0;
+  }
+
+  size_t signatures() const {
+    return signatures_;
+  }
+
+  size_t size() const {
+    return keys_.size();
+  }
+
+  const ec_uncompressed& point(size_t index) const {
+    return keys_[index].uncompressed;
+  }
+
+  bool is_valid_point(size_t index) const {
+    return keys_[index].valid;
+  }
+
+  // Position of the first matching key at or after start, or size().
+  size_t find(const ec_compressed& point, size_t start) const {
+    for (auto index = start; index < keys_.size(); index++)
+      if (keys_[index].valid && keys_[index].compressed == point)
+        return index;
+
+    return keys_.size();
+  }
+
+private:
+  struct key {
+    bool valid;
+    ec_compressed compressed;
+    ec_uncompressed uncompressed;
+  };
+
+  size_t signatures_;
+  std::vector<key> keys_;
+};
+
+
+// Signature hashes of one input, computed once per sighash type.
+class sighash_cache {
+
+public:
+  sighash_cache(const transaction& tx, uint32_t input_index,
+      const script& script_code, script_version version, uint64_t value)
+    : tx_(tx), input_index_(input_index), script_code_(script_code),
+      version_(version), value_(value) {
+  }
+
+  const hash_digest& get(uint8_t sighash_type) {
+    for (const auto& entry: hashes_)
+      if (entry.first == sighash_type)
+        return entry.second;
+
+    hashes_.emplace_back(sighash_type, script::generate_signature_hash(tx_,
+        input_index_, script_code_, sighash_type, version_, value_));
+    return hashes_.back().second;
+  }
+
+private:
+  const transaction& tx_;
+  const uint32_t input_index_;
+  const script& script_code_;
+  const script_version version_;
+  const uint64_t value_;
+  std::vector<std::pair<uint8_t, hash_digest>> hashes_;
+};
+
+
+// Signature checks.
+//-----------------------------------------------------------------------------
+
+// Parses a DER endorsement as the checkmultisig opcode does.
+bool parse_multisig_endorsement(uint8_t& sighash_type,
+    der_signature& distinguished, ec_signature& signature,
+    const endorsement& endorsement_bytes) {
+
+  auto endorsement_copy = endorsement_bytes;
+  return parse_endorsement(sighash_type, distinguished,
+      std::move(endorsement_copy)) &&
+      parse_signature(signature, distinguished, true);
+
+}
+
+
+// The checkmultisig loop of the interpreter: signatures are tried against
+// the keys in order, and the signature hash is computed and the key is
+// parsed for every attempt. Counts signature verifications in operations.
+bool check_multisig_in_order(size_t& operations,
+    const std::vector<endorsement>& endorsements, const script& script_code,
+    const transaction& tx, uint32_t input_index, script_version version,
+    uint64_t value) {
+
+  const auto& script_operations = script_code.operations();
+  if (!script::is_pay_multisig_pattern(script_operations))
+    return false;
+
+  const auto keys = script_operations.size() - 3u;
+  size_t key_index = 0;
+
+  for (const auto& endorsement_bytes: endorsements) {
+    uint8_t sighash_type;
+    der_signature distinguished;
+    ec_signature signature;
+    if (!parse_multisig_endorsement(sighash_type, distinguished, signature,
+        endorsement_bytes))
+      return false;
+
+    auto matched = false;
+    while (!matched && key_index < keys) {
+      const auto& point = script_operations[1u + key_index++].data();
+      const auto sighash = script::generate_signature_hash(tx, input_index,
+          script_code, sighash_type, version, value);
+      operations++;
+      matched = verify_signature(point, sighash, signature);
+    }
+
+    if (!matched)
+      return false;
+  }
+
+  return true;
+
+}
+
+
+// The same loop with keys decompressed once and signature hashes cached.
+bool check_multisig_precomputed(size_t& operations,
+    const std::vector<endorsement>& endorsements, const multisig_keys& keys,
+    sighash_cache& sighashes) {
+
+  size_t key_index = 0;
+
+  for (const auto& endorsement_bytes: endorsements) {
+    uint8_t sighash_type;
+    der_signature distinguished;
+    ec_signature signature;
+    if (!parse_multisig_endorsement(sighash_type, distinguished, signature,
+        endorsement_bytes))
+      return false;
+
+    const auto& sighash = sighashes.get(sighash_type);
+    auto matched = false;
+    while (!matched && key_index < keys.size()) {
+      const auto index = key_index++;
+      if (!keys.is_valid_point(index))
+        continue;
+
+      operations++;
+      matched = verify_signature(keys.point(index), sighash, signature);
+    }
+
+    if (!matched)
+      return false;
+  }
+
+  return true;
+
+}
+
+
+// Compact (r, s) form of a strict DER signature, as used for recovery.
+bool to_compact(ec_signature& out, const der_signature& distinguished) {
+
+  // 0x30 [size] 0x02 [r size] [r] 0x02 [s size] [s]
+  if (distinguished.size() < 8u || distinguished[2] != 0x02)
+    return false;
+
+  const size_t r_size = distinguished[3];
+  const auto r_begin = distinguished.begin() + 4;
+  if (4u + r_size + 2u > distinguished.size() ||
+      distinguished[4u + r_size] != 0x02)
+    return false;
+
+  const size_t s_size = distinguished[5u + r_size];
+  const auto s_begin = r_begin + r_size + 2;
+  if (6u + r_size + s_size != distinguished.size())
+    return false;
+
+  // Values are big-endian and may have a leading zero byte.
+  const auto copy_value = [](uint8_t* out_value,
+      der_signature::const_iterator begin, size_t size) {
+    while (size > ec_secret_size && *begin == 0x00) {
+      begin++;
+      size--;
+    }
+
+    if (size > ec_secret_size)
+      return false;
+
+    std::fill(out_value, out_value + ec_secret_size - size, 0x00);
+    std::copy(begin, begin + size, out_value + ec_secret_size - size);
+    return true;
+  };
+
+  return copy_value(out.data(), r_begin, r_size) &&
+      copy_value(out.data() + ec_secret_size, s_begin, s_size);
+
+}
+
+
+// Matches each signature to its key by public key recovery. A signature
+// recovers to at most one key per recovery id, which is then looked up
+// among the remaining keys, instead of verifying it against each of them.
+// Counts key recoveries in operations.
+bool check_multisig_recovery(size_t& operations,
+    const std::vector<endorsement>& endorsements, const multisig_keys& keys,
+    sighash_cache& sighashes) {
+
+  size_t key_index = 0;
+
+  for (const auto& endorsement_bytes: endorsements) {
+    uint8_t sighash_type;
+    der_signature distinguished;
+    ec_signature signature;
+    recoverable_signature recoverable;
+    if (!parse_multisig_endorsement(sighash_type, distinguished, signature,
+        endorsement_bytes) ||
+        !to_compact(recoverable.signature, distinguished))
+      return false;
+
+    const auto& sighash = sighashes.get(sighash_type);
+    auto matched = false;
+
+    // Ids 2 and 3 are only possible if r exceeds the group order.
+    for (uint8_t id = 0; !matched && id < 4u; id++) {
+      ec_compressed point;
+      recoverable.recovery_id = id;
+      if (!recover_public(point, recoverable, sighash))
+        continue;
+
+      operations++;
+      const auto index = keys.find(point, key_index);
+      if (index < keys.size()) {
+        key_index = index + 1u;
+        matched = true;
+      }
+    }
+
+    if (!matched)
+      return false;
+  }
+
+  return true;
+
+}
+
+
+// Multisig spends.
+//-----------------------------------------------------------------------------
+
+// P2WSH(m-of-n multisig) spend with its witness script and endorsements.
+struct multisig_spend {
+  transaction tx;
+  script witness_script;
+  std::vector<endorsement> endorsements;
+  uint64_t value;
+};
+
+
+// Signed by the last m keys, which is the worst case for the in-order loop.
+multisig_spend create_multisig_spend(size_t signatures, size_t keys) {
+
+  std::vector<ec_secret> secrets;
+  point_list points;
+  for (size_t index = 0; index < keys; index++) {
+    ec_compressed point;
+    secrets.push_back(sha256_hash(data_chunk{
+        static_cast<uint8_t>(index) }));
+    secret_to_public(point, secrets.back());
+    points.push_back(point);
+  }
+
+  multisig_spend spend;
+  spend.value = 100000000u;
+  spend.witness_script = script::to_pay_multisig_pattern(
+      static_cast<uint8_t>(signatures), points);
+
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,
+      "44101b50393d01de1e113b17eb07e8a09fbf6334e2012575bc97da227958a7a5");
+  input p2wsh_input;
+  p2wsh_input.set_previous_output(output_point(prev_tx_hash, 0u));
+  p2wsh_input.set_sequence(max_input_sequence);
+
+  spend.tx.set_version(1u);
+  spend.tx.inputs().push_back(p2wsh_input);
+  spend.tx.outputs().push_back(output(spend.value - 100000u,
+      script::to_pay_key_hash_pattern(bitcoin_short_hash(points.front()))));
+  spend.tx.set_locktime(0u);
+
+  data_stack witness_stack { data_chunk() };
+  for (auto index = keys - signatures; index < keys; index++) {
+    endorsement sig;
+    script::create_endorsement(sig, secrets[index], spend.witness_script,
+        spend.tx, 0u, sighash_algorithm::all, script_version::zero,
+        spend.value);
+    spend.endorsements.push_back(sig);
+    witness_stack.push_back(sig);
+  }
+
+  witness_stack.push_back(spend.witness_script.to_data(false));
+  spend.tx.inputs()[0].set_witness(witness(witness_stack));
+  return spend;
+
+}
+
+
+void check_multisig_example() {
+
+  const auto spend = create_multisig_spend(2u, 3u);
+  const script prevout_script(operation::list {
+      operation(opcode::push_size_0),
+      operation(to_chunk(sha256_hash(spend.witness_script.to_data(false))))
+  });
+
+  // Prints success
+  const auto& input = spend.tx.inputs()[0];
+  std::cout << script::verify(spend.tx, 0u, rule_fork::all_rules,
+      input.script(), input.witness(), prevout_script, spend.value).message()
+            << std::endl;
+
+  const multisig_keys keys(spend.witness_script);
+  size_t in_order = 0;
+  size_t precomputed = 0;
+  size_t recovered = 0;
+
+  // Prints 1 1 1.
+  sighash_cache sighashes(spend.tx, 0u, spend.witness_script,
+      script_version::zero, spend.value);
+  std::cout << check_multisig_in_order(in_order, spend.endorsements,
+      spend.witness_script, spend.tx, 0u, script_version::zero, spend.value)
+            << " " << check_multisig_precomputed(precomputed,
+      spend.endorsements, keys, sighashes) << " " <<
+      check_multisig_recovery(recovered, spend.endorsements, keys, sighashes)
+            << std::endl;
+
+  // Prints 3 3 and at most 4: keys 1 and 2 signed, key 0 is tried first.
+  std::cout << in_order << " " << precomputed << " " << recovered
+            << std::endl;
+
+  // Signatures in the wrong order fail with all three checks.
+  const std::vector<endorsement> reversed {
+      spend.endorsements[1],
+      spend.endorsements[0]
+  };
+
+  // Prints 0 0 0.
+  std::cout << check_multisig_in_order(in_order, reversed,
+      spend.witness_script, spend.tx, 0u, script_version::zero, spend.value)
+            << " " << check_multisig_precomputed(precomputed, reversed, keys,
+      sighashes) << " " << check_multisig_recovery(recovered, reversed, keys,
+      sighashes) << std::endl;
+
+}
+
+
+void benchmark_check_multisig(size_t iterations) {
+
+  const std::pair<size_t, size_t> configurations[] = {
+      { 2u, 3u }, { 3u, 5u }, { 15u, 15u }
+  };
+
+  for (const auto& configuration: configurations) {
+    const auto spend = create_multisig_spend(configuration.first,
+        configuration.second);
+    size_t in_order = 0;
+    size_t precomputed = 0;
+    size_t recovered = 0;
+    size_t failures = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t count = 0; count < iterations; count++)
+      failures += !check_multisig_in_order(in_order, spend.endorsements,
+          spend.witness_script, spend.tx, 0u, script_version::zero,
+          spend.value);
+    const auto in_order_time = std::chrono::steady_clock::now() - start;
+
+    // Keys are decompressed and hashes computed once per input.
+    start = std::chrono::steady_clock::now();
+    for (size_t count = 0; count < iterations; count++) {
+      const multisig_keys keys(spend.witness_script);
+      sighash_cache sighashes(spend.tx, 0u, spend.witness_script,
+          script_version::zero, spend.value);
+      failures += !check_multisig_precomputed(precomputed,
+          spend.endorsements, keys, sighashes);
+    }
+    const auto precomputed_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t count = 0; count < iterations; count++) {
+      const multisig_keys keys(spend.witness_script);
+      sighash_cache sighashes(spend.tx, 0u, spend.witness_script,
+          script_version::zero, spend.value);
+      failures += !check_multisig_recovery(recovered, spend.endorsements,
+          keys, sighashes);
+    }
+    const auto recovery_time = std::chrono::steady_clock::now() - start;
+
+    const auto per_check = [iterations](
+        std::chrono::steady_clock::duration time) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(time)
+          .count() / static_cast<double>(iterations);
+    };
+
+    std::cout << configuration.first << "-of-" << configuration.second
+              << ": in order " << per_check(in_order_time) << " us ("
+              << in_order / iterations << " verifications), precomputed "
+              << per_check(precomputed_time) << " us ("
+              << precomputed / iterations << " verifications), recovery "
+              << per_check(recovery_time) << " us ("
+              << recovered / iterations << " recoveries), failures "
+              << failures << std::endl;
+  }
+
+}
+
+
+int main() {
+
+  check_multisig_example();
+
+  benchmark_check_multisig(1000);
+
+  return 0;
+
+}
@@ -0,0 +1,781 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Witness Aware" wallet, used for payment and change outputs.
+auto my_secret_witness_aware = base16_literal(
+    "0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+ec_private my_private_witness_aware(my_secret_witness_aware,
+    ec_private::testnet, true);
+auto pubkey_witness_aware = my_private_witness_aware.to_public().point();
+
+
+// Spend sizes.
+//-----------------------------------------------------------------------------
+
+// Output types of the wallet, stored as one byte per UTXO.
+enum class utxo_type : uint8_t {
+  p2pkh,
+  p2sh_p2wpkh,
+  p2wpkh
+};
+
+constexpr size_t utxo_type_count = 3u;
+
+// Serialised size of an input spending each type, with a 72-byte
+// endorsement and a compressed public key. Legacy inputs have an empty
+// witness, which is a single byte once any input of the transaction has a
+// witness.
+struct input_size {
+  size_t base;        // Point, script with size prefix and sequence.
+  size_t witness;     // Witness with item count.
+};
+
+constexpr input_size input_sizes[utxo_type_count] = {
+  { 36u + 1u + 107u + 4u, 1u },                // [sig] [key]
+  { 36u + 1u + 23u + 4u, 1u + 73u + 34u },     // [0 [hash]]
+  { 36u + 1u + 4u, 1u + 73u + 34u }            // empty script
+};
+
+constexpr size_t marker_flag_size = 2u;
+
+// Weight of an input of the type in a transaction with witnesses.
+constexpr size_t input_weight(utxo_type type) {
+  return input_sizes[static_cast<size_t>(type)].base * 4u +
+      input_sizes[static_cast<size_t>(type)].witness;
+}
+
+// Fee for a weight at a rate in satoshis per virtual byte, rounded up.
+uint64_t fee_for_weight(size_t weight, uint64_t fee_rate) {
+  return (weight * fee_rate + 3u) / 4u;
+}
+
+
+// Weight of a transaction under construction, maintained as inputs and
+// outputs are added, so that the weight of a selection is known without
+// building its transaction.
+class weight_estimate {
+
+public:
+  weight_estimate(size_t outputs_size, size_t output_count)
+    : outputs_size_(outputs_size), output_count_(output_count),
+      input_count_(0), witness_inputs_(0), inputs_size_(0),
+      witness_size_(0) {
+  }
+
+  void add_input(utxo_type type) {
+    const auto& size = input_sizes[static_cast<size_t>(type)];
+    input_count_++;
+    inputs_size_ += size.base;
+    witness_size_ += size.witness;
+    if (type != utxo_type::p2pkh)
+      witness_inputs_++;
+  }
+
+  void remove_input(utxo_type type) {
+    const auto& size = input_sizes[static_cast<size_t>(type)];
+    input_count_--;
+    inputs_size_ -= size.base;
+    witness_size_ -= size.witness;
+    if (type != utxo_type::p2pkh)
+      witness_inputs_--;
+  }
+
+  void add_output(size_t size) {
+    output_count_++;
+    outputs_size_ += size;
+  }
+
+  void remove_output(size_t size) {
+    output_count_--;
+    outputs_size_ -= size;
+  }
+
+  // BIP141 weight, as of the serialised transaction.
+  size_t weight() const {
+    const auto base_size = 4u + variable_uint_size(input_count_) +
+        inputs_size_ + variable_uint_size(output_count_) + outputs_size_ +
+        4u;
+    const auto witness_size = witness_inputs_ == 0 ? 0 :
+        marker_flag_size + witness_size_;
+    return base_size * 4u + witness_size;
+  }
+
+private:
+  size_t outputs_size_;
+  size_t output_count_;
+  size_t input_count_;
+  size_t witness_inputs_;
+  size_t inputs_size_;
+  size_t witness_size_;
+};
+
+
+// UTXO store.
+//-----------------------------------------------------------------------------
+
+// Struct-of-arrays UTXO set. Selection reads only the values and types,
+// which are contiguous arrays of 8 and 1 bytes per UTXO, instead of strided
+// 50-byte records. Output points are only read for the selected UTXOs.
+class utxo_store {
+
+public:
+  void reserve(size_t count) {
+    hashes_.reserve(count);
+    indexes_.reserve(count);
+    values_.reserve(count);
+    types_.reserve(count);
+  }
+
+  void add(const output_point& point, uint64_t value, utxo_type type) {
+    hashes_.push_back(point.hash());
+    indexes_.push_back(point.index());
+    values_.push_back(value);
+    types_.push_back(type);
+  }
+
+  // Remove a spent UTXO by moving the last UTXO into its position.
+  void remove(size_t position) {
+    hashes_[position] = hashes_.back();
+    indexes_[position] = indexes_.back();
+    values_[position] = values_.back();
+    types_[position] = types_.back();
+    hashes_.pop_back();
+    indexes_.pop_back();
+    values_.pop_back();
+    types_.pop_back();
+  }
+
+  size_t size() const {
+    return values_.size();
+  }
+
+  output_point point(size_t position) const {
+    return output_point(hashes_[position], indexes_[position]);
+  }
+
+  uint64_t value(size_t position) const {
+    return values_[position];
+  }
+
+  utxo_type type(size_t position) const {
+    return types_[position];
+  }
+
+  const uint64_t* values() const {
+    return values_.data();
+  }
+
+  const utxo_type* types() const {
+    return types_.data();
+  }
+
+private:
+  std::vector<hash_digest> hashes_;
+  std::vector<uint32_t> indexes_;
+  std::vector<uint64_t> values_;
+  std::vector<utxo_type> types_;
+};
+
+
+// Coin selection.
+//-----------------------------------------------------------------------------
+
+// Payment to be funded.
+struct selection_target {
+  uint64_t amount;          // Sum of the payment outputs.
+  size_t outputs_size;      // Serialised size of the payment outputs.
+  size_t output_count;
+  size_t change_size;       // Serialised size of the change output.
+  uint64_t min_change;      // Smaller change is added to the fee.
+  uint64_t fee_rate;        // Satoshis per virtual byte.
+  size_t max_candidates;    // Candidates considered by each algorithm.
+};
+
+// Selected UTXOs and the resulting transaction.
+struct selection {
+  std::vector<uint32_t> positions;
+  uint64_t value;
+  uint64_t fee;
+  uint64_t change;          // Zero without a change output.
+  size_t weight;
+};
+
+// Buffers reused across selections, so that selecting does not allocate.
+struct selection_scratch {
+  std::vector<int64_t> effective;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> chosen;
+  std::vector<uint8_t> included;
+  std::vector<uint8_t> best;
+  std::mt19937_64 random;
+};
+
+
+// Effective value of each UTXO: its value less the fee of spending it.
+// The fee is looked up by type, so the loop reads the two arrays of the
+// store sequentially and has no branches. Candidates are the UTXOs with a
+// positive effective value.
+void prepare_candidates(selection_scratch& scratch, const utxo_store& store,
+    uint64_t fee_rate) {
+
+  int64_t input_fees[utxo_type_count];
+  for (size_t type = 0; type < utxo_type_count; type++)
+    input_fees[type] = fee_for_weight(
+        input_weight(static_cast<utxo_type>(type)), fee_rate);
+
+  const auto count = store.size();
+  const auto values = store.values();
+  const auto types = store.types();
+  scratch.effective.resize(count);
+  const auto effective = scratch.effective.data();
+
+  for (size_t position = 0; position < count; position++)
+    effective[position] = static_cast<int64_t>(values[position]) -
+        input_fees[static_cast<size_t>(types[position])];
+
+  scratch.candidates.clear();
+  for (size_t position = 0; position < count; position++)
+    if (effective[position] > 0)
+      scratch.candidates.push_back(static_cast<uint32_t>(position));
+
+}
+
+
+// Keep the count candidates with the largest effective values, sorted by
+// decreasing effective value. Partitioning is linear in the candidates, so
+// only the kept candidates are sorted.
+void keep_largest(selection_scratch& scratch, size_t count) {
+
+  const auto& effective = scratch.effective;
+  const auto greater = [&effective](uint32_t left, uint32_t right) {
+    return effective[left] > effective[right];
+  };
+
+  auto& candidates = scratch.candidates;
+  if (candidates.size() > count) {
+    std::nth_element(candidates.begin(), candidates.begin() + count,
+        candidates.end(), greater);
+    candidates.resize(count);
+  }
+
+  std::sort(candidates.begin(), candidates.end(), greater);
+
+}
+
+
+// Weight of the transaction without inputs, with marker and flag.
+size_t not_input_weight(const selection_target& target) {
+  return weight_estimate(target.outputs_size, target.output_count).weight() +
+      marker_flag_size;
+}
+
+
+// Compute the fee and change of the selected positions. A change output is
+// added if the remaining value covers its fee and min_change.
+// Returns false if the selection does not fund the payment.
+bool finish_selection(selection& out, const utxo_store& store,
+    const selection_target& target) {
+
+  weight_estimate estimate(target.outputs_size, target.output_count);
+  uint64_t value = 0;
+  for (const auto position: out.positions) {
+    estimate.add_input(store.type(position));
+    value += store.value(position);
+  }
+
+  auto fee = fee_for_weight(estimate.weight(), target.fee_rate);
+  if (value < target.amount + fee)
+    return false;
+
+  estimate.add_output(target.change_size);
+  const auto change_fee = fee_for_weight(estimate.weight(), target.fee_rate);
+  out.change = 0;
+
+  if (value >= target.amount + change_fee + target.min_change) {
+    fee = change_fee;
+    out.change = value - target.amount - fee;
+  } else {
+    estimate.remove_output(target.change_size);
+  }
+
+  out.value = value;
+  out.fee = fee;
+  out.weight = estimate.weight();
+  return true;
+
+}
+
+
+// Largest-first: add candidates by decreasing effective value until the
+// payment and the fee of the transaction without inputs are covered.
+bool select_largest_first(selection& out, const utxo_store& store,
+    const selection_target& target, selection_scratch& scratch) {
+
+  prepare_candidates(scratch, store, target.fee_rate);
+  keep_largest(scratch, target.max_candidates);
+
+  const auto needed = static_cast<int64_t>(target.amount +
+      fee_for_weight(not_input_weight(target), target.fee_rate));
+  int64_t total = 0;
+  out.positions.clear();
+
+  for (const auto position: scratch.candidates) {
+    out.positions.push_back(position);
+    total += scratch.effective[position];
+    if (total >= needed)
+      return finish_selection(out, store, target);
+  }
+
+  return false;
+
+}
+
+
+// Branch and bound: depth-first search for a selection whose effective
+// value exceeds the target by less than the cost of creating and later
+// spending a change output, so that no change output is needed. Candidates
+// are searched by decreasing effective value, and a branch is cut once its
+// value plus all remaining candidates falls short, or it exceeds the window.
+bool select_branch_and_bound(selection& out, const utxo_store& store,
+    const selection_target& target, selection_scratch& scratch,
+    size_t max_tries = 100000) {
+
+  prepare_candidates(scratch, store, target.fee_rate);
+
+  const auto needed = static_cast<int64_t>(target.amount +
+      fee_for_weight(not_input_weight(target), target.fee_rate));
+  const auto cost_of_change = static_cast<int64_t>(fee_for_weight(
+      target.change_size * 4u + input_weight(utxo_type::p2wpkh),
+      target.fee_rate));
+  const auto upper = needed + cost_of_change;
+
+  // Larger candidates can never be part of a selection within the window.
+  const auto& effective = scratch.effective;
+  auto& candidates = scratch.candidates;
+  candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+      [&effective, upper](uint32_t position) {
+        return effective[position] > upper;
+      }), candidates.end());
+  keep_largest(scratch, target.max_candidates);
+
+  int64_t remaining = 0;
+  for (const auto position: candidates)
+    remaining += effective[position];
+
+  auto& chosen = scratch.chosen;
+  chosen.clear();
+  std::vector<uint32_t>& best = out.positions;
+  best.clear();
+  auto best_excess = upper - needed + 1;
+  int64_t value = 0;
+  size_t depth = 0;
+
+  for (size_t tries = 0; tries < max_tries; tries++) {
+    auto backtrack = false;
+
+    if (value + remaining < needed || value > upper) {
+      backtrack = true;
+    } else if (value >= needed) {
+      if (value - needed < best_excess) {
+        best_excess = value - needed;
+        best.clear();
+        for (const auto index: chosen)
+          best.push_back(candidates[index]);
+      }
+
+      // An exact match cannot be improved.
+      if (best_excess == 0)
+        break;
+
+      backtrack = true;
+    }
+
+    if (backtrack) {
+      if (chosen.empty())
+        break;
+
+      // Candidates after the last inclusion are undecided again.
+      while (depth > chosen.back() + 1u)
+        remaining += effective[candidates[--depth]];
+
+      // Continue with the branch omitting the last inclusion.
+      const auto last = chosen.back();
+      chosen.pop_back();
+      value -= effective[candidates[last]];
+      depth = last + 1u;
+      continue;
+    }
+
+    // Branch including the next candidate.
+    const auto position = candidates[depth];
+    remaining -= effective[position];
+    value += effective[position];
+    chosen.push_back(static_cast<uint32_t>(depth));
+    depth++;
+  }
+
+  return !best.empty() && finish_selection(out, store, target);
+
+}
+
+
+// Randomised search for the subset of sorted candidates with the smallest
+// total of at least target, as in the knapsack solver of Bitcoin Core.
+// Candidates are included at random in a first pass and in order in a
+// second. Returns the total of the best subset, which is in scratch.best.
+int64_t approximate_best_subset(selection_scratch& scratch,
+    const std::vector<uint32_t>& candidates, int64_t total, int64_t target,
+    size_t iterations = 1000) {
+
+  const auto& effective = scratch.effective;
+  const auto count = candidates.size();
+  auto& included = scratch.included;
+  auto& best = scratch.best;
+  best.assign(count, 1u);
+  auto best_value = total;
+
+  for (size_t iteration = 0; iteration < iterations &&
+      best_value != target; iteration++) {
+    included.assign(count, 0u);
+    int64_t value = 0;
+    auto reached = false;
+
+    for (size_t pass = 0; pass < 2u && !reached; pass++) {
+      uint64_t bits = 0;
+      for (size_t index = 0; index < count; index++) {
+        if (pass == 0 && index % 64u == 0)
+          bits = scratch.random();
+
+        const auto include = pass == 0 ? ((bits >> (index % 64u)) & 1u) :
+            !included[index];
+        if (!include)
+          continue;
+
+        value += effective[candidates[index]];
+        included[index] = 1u;
+        if (value >= target) {
+          reached = true;
+          if (value < best_value) {
+            best_value = value;
+            best = included;
+          }
+
+          value -= effective[candidates[index]];
+          included[index] = 0u;
+        }
+      }
+    }
+  }
+
+  return best_value;
+
+}
+
+
+// Knapsack: a candidate which exactly matches the target is used alone.
+// Otherwise a subset of the candidates smaller than the target plus
+// min_change is searched for, which is replaced by the smallest larger
+// candidate if that is closer to the target.
+bool select_knapsack(selection& out, const utxo_store& store,
+    const selection_target& target, selection_scratch& scratch) {
+
+  prepare_candidates(scratch, store, target.fee_rate);
+
+  const auto needed = static_cast<int64_t>(target.amount +
+      fee_for_weight(not_input_weight(target), target.fee_rate));
+  const auto with_change = needed + static_cast<int64_t>(target.min_change);
+  const auto& effective = scratch.effective;
+  auto& candidates = scratch.candidates;
+  auto lowest_larger = store.size();
+  out.positions.clear();
+
+  // Partition into smaller candidates and the lowest larger candidate.
+  size_t smaller = 0;
+  for (const auto position: candidates) {
+    const auto value = effective[position];
+    if (value == needed) {
+      out.positions.push_back(position);
+      return finish_selection(out, store, target);
+    }
+
+    if (value < with_change)
+      candidates[smaller++] = position;
+    else if (lowest_larger == store.size() ||
+        value < effective[lowest_larger])
+      lowest_larger = position;
+  }
+
+  candidates.resize(smaller);
+  keep_largest(scratch, target.max_candidates);
+
+  int64_t total = 0;
+  for (const auto position: candidates)
+    total += effective[position];
+
+  if (total == needed) {
+    out.positions = candidates;
+    return finish_selection(out, store, target);
+  }
+
+  const auto use_lowest_larger = [&]() {
+    if (lowest_larger == store.size())
+      return false;
+
+    out.positions.assign(1u, static_cast<uint32_t>(lowest_larger));
+    return finish_selection(out, store, target);
+  };
+
+  if (total < needed)
+    return use_lowest_larger();
+
+  // Aim for a change output first, unless there is an exact match.
+  auto best_value = approximate_best_subset(scratch, candidates, total,
+      needed);
+  if (best_value != needed && total >= with_change)
+    best_value = approximate_best_subset(scratch, candidates, total,
+        with_change);
+
+  if (lowest_larger != store.size() &&
+      ((best_value != needed && best_value < with_change) ||
+      effective[lowest_larger] <= best_value))
+    return use_lowest_larger();
+
+  for (size_t index = 0; index < candidates.size(); index++)
+    if (scratch.best[index])
+      out.positions.push_back(candidates[index]);
+
+  return finish_selection(out, store, target);
+
+}
+
+
+// Branch and bound for a selection without change, otherwise knapsack.
+bool select_coins(selection& out, const utxo_store& store,
+    const selection_target& target, selection_scratch& scratch) {
+  return select_branch_and_bound(out, store, target, scratch) ||
+      select_knapsack(out, store, target, scratch);
+}
+
+
+// Transaction construction.
+//-----------------------------------------------------------------------------
+
+// Unsigned transaction spending the selected UTXOs, with a change output
+// if the selection has change.
+transaction build_transaction(const utxo_store& store,
+    const selection& selected, const output::list& payments,
+    const script& change_script) {
+
+  transaction tx;
+  tx.set_version(1u);
+
+  for (const auto position: selected.positions) {
+    input next;
+    next.set_previous_output(store.point(position));
+    next.set_sequence(max_input_sequence);
+    tx.inputs().push_back(next);
+  }
+
+  for (const auto& payment: payments)
+    tx.outputs().push_back(payment);
+
+  if (selected.change > 0)
+    tx.outputs().push_back(output(selected.change, change_script));
+
+  return tx;
+
+}
+
+
+// Input scripts and witnesses of the sizes assumed by input_sizes, in
+// place of the endorsements, to compare the estimate with the serialised
+// transaction.
+void set_placeholders(transaction& tx, const utxo_store& store,
+    const selection& selected) {
+
+  data_stack witness_stack;
+  witness_stack.push_back(data_chunk(72u, 0x00));
+  witness_stack.push_back(data_chunk(ec_compressed_size, 0x00));
+  const witness placeholder_witness(witness_stack);
+
+  operation::list p2pkh_script;
+  p2pkh_script.push_back(operation(data_chunk(72u, 0x00)));
+  p2pkh_script.push_back(operation(data_chunk(ec_compressed_size, 0x00)));
+
+  operation::list p2sh_p2wpkh_script;
+  p2sh_p2wpkh_script.push_back(operation(data_chunk(22u, 0x00)));
+
+  for (size_t index = 0; index < selected.positions.size(); index++) {
+    auto& input = tx.inputs()[index];
+    switch (store.type(selected.positions[index])) {
+      case utxo_type::p2pkh:
+        input.set_script(script(p2pkh_script));
+        break;
+      case utxo_type::p2sh_p2wpkh:
+        input.set_script(script(p2sh_p2wpkh_script));
+        input.set_witness(placeholder_witness);
+        break;
+      case utxo_type::p2wpkh:
+        input.set_witness(placeholder_witness);
+        break;
+    }
+  }
+
+}
+
+
+void coin_selection_example() {
+
+  // Wallet UTXOs of previous transactions.
+  std::string prev_tx_string =
+      "ca05e6c14fe816c93b91dd4c8f00e60e4a205da85741f26326d6f21f9a5ac5e9";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash, prev_tx_string);
+
+  utxo_store store;
+  store.add(output_point(prev_tx_hash, 0u), 129500000u, utxo_type::p2pkh);
+  store.add(output_point(prev_tx_hash, 1u), 2000000u, utxo_type::p2wpkh);
+  store.add(output_point(prev_tx_hash, 2u), 3500000u, utxo_type::p2wpkh);
+  store.add(output_point(prev_tx_hash, 3u), 1200000u,
+      utxo_type::p2sh_p2wpkh);
+  store.add(output_point(prev_tx_hash, 4u), 800000u, utxo_type::p2wpkh);
+  store.add(output_point(prev_tx_hash, 5u), 5000u, utxo_type::p2pkh);
+
+  // Payment of 0.05 BTC to a P2WPKH output, change to P2WPKH.
+  const auto key_hash = bitcoin_short_hash(pubkey_witness_aware);
+  operation::list p2wpkh_operations;
+  p2wpkh_operations.push_back(operation(opcode::push_size_0));
+  p2wpkh_operations.push_back(operation(to_chunk(key_hash)));
+  const script p2wpkh_script(p2wpkh_operations);
+
+  const output::list payments { output(5000000u, p2wpkh_script) };
+  const auto output_size = payments.front().serialized_size();
+  const selection_target target {
+      5000000u, output_size, 1u, output_size, 10000u, 10u, 1000u };
+
+  selection_scratch scratch;
+  selection selected;
+
+  const auto print = [&](const std::string& name, bool success) {
+    std::cout << name << success << " inputs: "
+              << selected.positions.size() << " fee: " << selected.fee
+              << " change: " << selected.change << std::endl;
+
+    // Estimated weight equals the weight of the serialised transaction.
+    auto tx = build_transaction(store, selected, payments, p2wpkh_script);
+    set_placeholders(tx, store, selected);
+    std::cout << (selected.weight == tx.serialized_size(true, false) * 3u +
+        tx.serialized_size(true, true)) << std::endl;
+  };
+
+  print("largest first:    ",
+      select_largest_first(selected, store, target, scratch));
+  print("branch and bound: ",
+      select_branch_and_bound(selected, store, target, scratch));
+  print("knapsack:         ",
+      select_knapsack(selected, store, target, scratch));
+
+  // The transaction is signed as in the transaction building examples.
+  const auto tx = build_transaction(store, selected, payments,
+      p2wpkh_script);
+  std::cout << encode_base16(tx.to_data()) << std::endl;
+
+}
+
+
+// Benchmark.
+//-----------------------------------------------------------------------------
+
+// UTXO values between 1000 satoshis and 1 BTC, uniform in magnitude.
+void fill_store(utxo_store& store, size_t count, std::mt19937_64& random) {
+
+  std::uniform_real_distribution<double> magnitude(0.0, 5.0);
+  hash_digest prev_tx_hash = null_hash;
+  store.reserve(count);
+
+  for (size_t index = 0; index < count; index++) {
+    const auto bits = random();
+    memcpy(prev_tx_hash.data(), &bits, sizeof(bits));
+    const auto value = static_cast<uint64_t>(1000.0 *
+        std::pow(10.0, magnitude(random)));
+    store.add(output_point(prev_tx_hash, index % 4u), value,
+        static_cast<utxo_type>(bits % utxo_type_count));
+  }
+
+}
+
+
+void benchmark_coin_selection(size_t selections) {
+
+  std::mt19937_64 random(42u);
+  std::uniform_int_distribution<uint64_t> amounts(100000u, 20000000u);
+  const auto p2wpkh_output_size = 8u + 1u + 22u;
+  selection_scratch scratch;
+  selection selected;
+
+  const auto per_selection = [selections](
+      std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time)
+        .count() / static_cast<double>(selections);
+  };
+
+  for (size_t count = 1000; count <= 1000000; count *= 10u) {
+    utxo_store store;
+    fill_store(store, count, random);
+
+    std::vector<selection_target> targets;
+    for (size_t index = 0; index < selections; index++)
+      targets.push_back({ amounts(random), p2wpkh_output_size, 1u,
+          p2wpkh_output_size, 10000u, 10u, 1000u });
+
+    size_t funded[3] = { 0, 0, 0 };
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& target: targets)
+      funded[0] += select_largest_first(selected, store, target, scratch);
+    const auto largest_first_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (const auto& target: targets)
+      funded[1] += select_branch_and_bound(selected, store, target,
+          scratch);
+    const auto branch_and_bound_time =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (const auto& target: targets)
+      funded[2] += select_knapsack(selected, store, target, scratch);
+    const auto knapsack_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << count << " UTXOs" << std::endl;
+    std::cout << "  largest first:    " << per_selection(largest_first_time)
+              << " us, funded: " << funded[0] << std::endl;
+    std::cout << "  branch and bound: "
+              << per_selection(branch_and_bound_time)
+              << " us, funded: " << funded[1] << std::endl;
+    std::cout << "  knapsack:         " << per_selection(knapsack_time)
+              << " us, funded: " << funded[2] << std::endl;
+  }
+
+}
+
+
+int main() {
+
+  coin_selection_example();
+
+  benchmark_coin_selection(100);
+
+  return 0;
+
+}
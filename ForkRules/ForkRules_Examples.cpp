@@ -1,5 +1,6 @@
 #include <bitcoin/bitcoin.hpp>
 #include <string.h>
+#include <chrono>
 #include <iostream>
 
 using namespace bc;
@@ -244,6 +245,358 @@ void create_and_verify_p2wpkh(const transaction& example_transaction) {
 
 }
 
+
+// Compile-time fork rules.
+//-----------------------------------------------------------------------------
+
+// Rule sets with specialised verification.
+constexpr uint32_t pre_segwit_rules = rule_fork::all_rules ^
+    rule_fork::bip141_rule ^ rule_fork::bip143_rule;
+constexpr uint32_t pre_bip16_rules = pre_segwit_rules ^ rule_fork::bip16_rule;
+
+// Fork rules known at compile time: every rule check is a constant, so the
+// compiler removes the branches of inactive rules.
+template <uint32_t Forks>
+struct static_rules {
+  static constexpr uint32_t forks() { return Forks; }
+  static constexpr bool enabled(uint32_t rule) { return (Forks & rule) != 0; }
+};
+
+// Fork rules known at run time.
+struct dynamic_rules {
+  explicit dynamic_rules(uint32_t forks) : forks_(forks) {}
+  uint32_t forks() const { return forks_; }
+  bool enabled(uint32_t rule) const { return (forks_ & rule) != 0; }
+
+private:
+  uint32_t forks_;
+};
+
+
+// Runs all operations of a program, as debug_program() of the script machine
+// examples without printing.
+code run_program(program& current_program) {
+
+  if (!current_program.is_valid())
+    return error::invalid_script;
+
+  for (const auto& op: current_program) {
+    if (op.is_oversized())
+      return error::invalid_push_data_size;
+
+    if (op.is_disabled())
+      return error::op_disabled;
+
+    if (!current_program.increment_operation_count(op))
+      return error::invalid_operation_count;
+
+    if (current_program.if_(op)) {
+      if (current_program.is_stack_overflow())
+        return error::invalid_stack_size;
+
+      const auto ec = current_program.evaluate(op);
+      if (ec)
+        return ec;
+    }
+  }
+
+  return current_program.closed() ? error::success :
+      error::invalid_stack_scope;
+
+}
+
+
+// Version 0 witness program, native or embedded in P2SH.
+template <typename Rules>
+code run_witness_program(const Rules& rules, const transaction& tx,
+    uint32_t input_index, const script& program_script, uint64_t value) {
+
+  const auto& input_witness = tx.inputs()[input_index].witness();
+  const auto version = program_script.version();
+
+  // Unknown versions are not evaluated.
+  if (version != script_version::zero)
+    return error::success;
+
+  script witness_script;
+  data_stack stack;
+  if (!input_witness.extract_embedded_script(witness_script, stack,
+      program_script))
+    return error::invalid_witness;
+
+  program witness_program(witness_script, tx, input_index, rules.forks(),
+      std::move(stack), value, version);
+
+  const auto ec = run_program(witness_program);
+  if (ec)
+    return ec;
+
+  // Witness programs require a clean stack (BIP141).
+  return witness_program.stack_result(true) ? error::success :
+      error::stack_false;
+
+}
+
+
+// Verifies one input, with the fork rule checks of run_p2sh_p2wpkh() of the
+// script machine examples expressed through the Rules type.
+template <typename Rules>
+code verify_script(const Rules& rules, const transaction& tx,
+    uint32_t input_index, const script& prevout_script, uint64_t value) {
+
+  const auto& input_script = tx.inputs()[input_index].script();
+  const auto& input_witness = tx.inputs()[input_index].witness();
+  code ec;
+
+  // 1) Evaluate input script.
+  program input_program(input_script, tx, input_index, rules.forks());
+  if ((ec = run_program(input_program)))
+    return ec;
+
+  // 2) Evaluate output script.
+  program output_program(prevout_script, input_program);
+  if ((ec = run_program(output_program)))
+    return ec;
+
+  if (!output_program.stack_result(false))
+    return error::stack_false;
+
+  auto witnessed = false;
+
+  // 3) Native witness program (BIP141).
+  if (rules.enabled(rule_fork::bip141_rule) &&
+      script::is_witness_program_pattern(prevout_script.operations())) {
+
+    // The input script must be empty.
+    if (!input_script.empty())
+      return error::dirty_witness;
+
+    witnessed = true;
+    if ((ec = run_witness_program(rules, tx, input_index, prevout_script,
+        value)))
+      return ec;
+  }
+
+  // 4) P2SH (BIP16).
+  if (rules.enabled(rule_fork::bip16_rule) &&
+      prevout_script.output_pattern() == script_pattern::pay_script_hash) {
+
+    if (!script::is_relaxed_push(input_script.operations()))
+      return error::invalid_script_embed;
+
+    script embedded_script(input_program.pop(), false);
+    program embedded_program(embedded_script, std::move(input_program),
+        true);
+
+    if ((ec = run_program(embedded_program)))
+      return ec;
+
+    if (!embedded_program.stack_result(false))
+      return error::stack_false;
+
+    // 5) Witness program embedded in P2SH (BIP141).
+    if (rules.enabled(rule_fork::bip141_rule) &&
+        script::is_witness_program_pattern(embedded_script.operations())) {
+
+      // The input script must be a push of the embedded script.
+      if (input_script.size() != 1u)
+        return error::dirty_witness;
+
+      witnessed = true;
+      if ((ec = run_witness_program(rules, tx, input_index, embedded_script,
+          value)))
+        return ec;
+    }
+  }
+
+  // The witness must be empty if no witness program was run, which holds
+  // with or without bip141.
+  if (!witnessed && !input_witness.empty())
+    return error::unexpected_witness;
+
+  return error::success;
+
+}
+
+
+// Selects a specialisation once per call. Other rule sets are verified with
+// run time rule checks.
+code verify_specialised(const transaction& tx, uint32_t input_index,
+    uint32_t forks, const script& prevout_script, uint64_t value) {
+
+  switch (forks) {
+    case rule_fork::all_rules:
+      return verify_script(static_rules<rule_fork::all_rules>(), tx,
+          input_index, prevout_script, value);
+    case pre_segwit_rules:
+      return verify_script(static_rules<pre_segwit_rules>(), tx,
+          input_index, prevout_script, value);
+    case pre_bip16_rules:
+      return verify_script(static_rules<pre_bip16_rules>(), tx,
+          input_index, prevout_script, value);
+    default:
+      return verify_script(dynamic_rules(forks), tx, input_index,
+          prevout_script, value);
+  }
+
+}
+
+
+// Signed spend of one input, with its previous output.
+struct example_spend {
+  transaction tx;
+  script prevout_script;
+  uint64_t value;
+};
+
+
+std::vector<example_spend> create_example_spends(
+    const transaction& example_transaction) {
+
+  std::vector<example_spend> spends;
+  const uint64_t value = 100000000u;
+  const auto key_hash = bitcoin_short_hash(pubkey_witness_aware);
+  const script p2wpkh_script(operation::list {
+      operation(opcode::push_size_0),
+      operation(to_chunk(key_hash))
+  });
+  const script script_code(script::to_pay_key_hash_pattern(key_hash));
+
+  // P2SH(2-of-2 multisig).
+  {
+    example_spend spend { example_transaction, script(), value };
+    point_list points { pubkey0, pubkey1 };
+    const script multisig_script = script::to_pay_multisig_pattern(2u,
+        points);
+    spend.prevout_script = script::to_pay_script_hash_pattern(
+        bitcoin_short_hash(multisig_script.to_data(false)));
+
+    endorsement sig0;
+    endorsement sig1;
+    script::create_endorsement(sig0, my_secret0, multisig_script, spend.tx,
+        0u, sighash_algorithm::all);
+    script::create_endorsement(sig1, my_secret1, multisig_script, spend.tx,
+        0u, sighash_algorithm::all);
+    spend.tx.inputs()[0].set_script(script(operation::list {
+        operation(opcode::push_size_0),
+        operation(sig0),
+        operation(sig1),
+        operation(multisig_script.to_data(false))
+    }));
+    spends.push_back(spend);
+  }
+
+  // P2WPKH.
+  {
+    example_spend spend { example_transaction, p2wpkh_script, value };
+    endorsement sig;
+    script::create_endorsement(sig, my_secret_witness_aware, script_code,
+        spend.tx, 0u, sighash_algorithm::all, script_version::zero, value);
+    spend.tx.inputs()[0].set_witness(witness(data_stack {
+        sig,
+        to_chunk(pubkey_witness_aware)
+    }));
+    spends.push_back(spend);
+  }
+
+  // P2SH(P2WPKH).
+  {
+    example_spend spend { example_transaction, script(), value };
+    spend.prevout_script = script::to_pay_script_hash_pattern(
+        bitcoin_short_hash(p2wpkh_script.to_data(false)));
+    spend.tx.inputs()[0].set_script(script(operation::list {
+        operation(p2wpkh_script.to_data(false))
+    }));
+
+    endorsement sig;
+    script::create_endorsement(sig, my_secret_witness_aware, script_code,
+        spend.tx, 0u, sighash_algorithm::all, script_version::zero, value);
+    spend.tx.inputs()[0].set_witness(witness(data_stack {
+        sig,
+        to_chunk(pubkey_witness_aware)
+    }));
+    spends.push_back(spend);
+  }
+
+  return spends;
+
+}
+
+
+void verify_with_compile_time_rules(const transaction& example_transaction) {
+
+  const auto spends = create_example_spends(example_transaction);
+  const uint32_t fork_sets[] = {
+      rule_fork::all_rules,
+      pre_segwit_rules,
+      pre_bip16_rules,
+      rule_fork::all_rules ^ rule_fork::bip66_rule
+  };
+
+  // Same results as script::verify() for each rule set.
+  auto matches = true;
+  for (const auto& spend: spends) {
+    for (const auto forks: fork_sets) {
+      const auto& input = spend.tx.inputs()[0];
+      const auto expected = script::verify(spend.tx, 0u, forks,
+          input.script(), input.witness(), spend.prevout_script, spend.value);
+      const auto ec = verify_specialised(spend.tx, 0u, forks,
+          spend.prevout_script, spend.value);
+      matches &= bool(ec) == bool(expected);
+    }
+  }
+
+  std::cout << matches << std::endl;
+
+  // Prints success
+  const auto& p2sh_p2wpkh = spends[2];
+  std::cout << verify_specialised(p2sh_p2wpkh.tx, 0u, rule_fork::all_rules,
+      p2sh_p2wpkh.prevout_script, p2sh_p2wpkh.value).message() << std::endl;
+
+}
+
+
+void benchmark_compile_time_rules(const transaction& example_transaction,
+    size_t iterations) {
+
+  const auto spends = create_example_spends(example_transaction);
+  const char* names[] = { "p2sh multisig: ", "p2wpkh:        ",
+      "p2sh-p2wpkh:   " };
+
+  for (size_t index = 0; index < spends.size(); index++) {
+    const auto& spend = spends[index];
+    const auto forks = rule_fork::all_rules;
+    size_t failures = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t count = 0; count < iterations; count++)
+      failures += bool(verify_script(dynamic_rules(forks), spend.tx, 0u,
+          spend.prevout_script, spend.value));
+    const auto dynamic_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t count = 0; count < iterations; count++)
+      failures += bool(verify_specialised(spend.tx, 0u, forks,
+          spend.prevout_script, spend.value));
+    const auto static_time = std::chrono::steady_clock::now() - start;
+
+    // Nanoseconds per verified input. Both loops run the same interpreter,
+    // which receives the fork rules at run time, so only the rule checks
+    // between the verification steps differ.
+    const auto per_input = [&](std::chrono::steady_clock::duration time) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+          .count() / static_cast<double>(iterations);
+    };
+
+    std::cout << names[index] << per_input(dynamic_time)
+              << " ns/input run time rules, " << per_input(static_time)
+              << " ns/input compile-time rules, failures: " << failures
+              << std::endl;
+  }
+
+}
+
+
 int main() {
 
   auto tx = create_example_transaction();
@@ -252,6 +605,10 @@ int main() {
 
   create_and_verify_p2wpkh(tx);
 
+  verify_with_compile_time_rules(tx);
+
+  benchmark_compile_time_rules(tx, 10000);
+
   return 0;
 
 }
@@ -0,0 +1,1214 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Normal" wallet.
+auto my_secret1 = base16_literal(
+    "d977e2ce0f744dc3432cde9813a99360a3f79f7c8035ef82310d54c57332b2cc");
+ec_private my_private1(my_secret1, ec_private::testnet, true);
+auto pubkey1 = my_private1.to_public().point();
+
+// "Witness Aware" wallets.
+auto my_secret_witness_aware = base16_literal(
+    "0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+ec_private my_private_witness_aware(my_secret_witness_aware,
+    ec_private::testnet, true);
+auto pubkey_witness_aware = my_private_witness_aware.to_public().point();
+
+auto my_secret_witness_aware1 = base16_literal(
+    "2361b894dab5c45c3c448eb4ab65f847cb3000e05969f18c94b8850233a95b74");
+ec_private my_private_witness_aware1(my_secret_witness_aware1,
+    ec_private::testnet, true);
+auto pubkey_witness_aware1 = my_private_witness_aware1.to_public().point();
+
+auto my_secret_witness_aware2 = base16_literal(
+    "87493c67155f44a9a9a6abf621926a407121d6f4e1e94c75ced61208d7abe9db");
+ec_private my_private_witness_aware2(my_secret_witness_aware2,
+    ec_private::testnet, true);
+auto pubkey_witness_aware2 = my_private_witness_aware2.to_public().point();
+
+// Sighash type bits.
+constexpr uint8_t sighash_mask = 0x1f;
+
+
+// BIP143 signature hash context.
+//-----------------------------------------------------------------------------
+
+// Precomputes the transaction-wide BIP143 commitments once per transaction:
+//    hashPrevouts = sha256d(all input outpoints)
+//    hashSequence = sha256d(all input sequences)
+//    hashOutputs  = sha256d(all outputs)
+// Each input signature hash then only serialises the fields of that input.
+// The context refers to the transaction, which must not be modified while
+// the context is in use. It is immutable after construction and may be
+// shared between threads.
+class sighash_context {
+
+public:
+  explicit sighash_context(const transaction& tx)
+    : tx_(tx) {
+
+    const auto& inputs = tx.inputs();
+    const auto& outputs = tx.outputs();
+
+    data_chunk points(inputs.size() * (hash_size + sizeof(uint32_t)));
+    auto point_sink = make_unsafe_serializer(points.begin());
+    for (const auto& input: inputs)
+      input.previous_output().to_data(point_sink);
+    prevouts_hash_ = bitcoin_hash(points);
+
+    data_chunk sequences(inputs.size() * sizeof(uint32_t));
+    auto sequence_sink = make_unsafe_serializer(sequences.begin());
+    for (const auto& input: inputs)
+      sequence_sink.write_4_bytes_little_endian(input.sequence());
+    sequences_hash_ = bitcoin_hash(sequences);
+
+    size_t outputs_size = 0;
+    for (const auto& output: outputs)
+      outputs_size += output.serialized_size();
+
+    data_chunk serialised_outputs(outputs_size);
+    auto output_sink = make_unsafe_serializer(serialised_outputs.begin());
+    for (const auto& output: outputs)
+      output.to_data(output_sink);
+    outputs_hash_ = bitcoin_hash(serialised_outputs);
+  }
+
+  const transaction& tx() const {
+    return tx_;
+  }
+
+  // BIP143 signature hash of one input, O(1) in the number of inputs and
+  // outputs (except for the single output hashed by SIGHASH_SINGLE).
+  hash_digest signature_hash(uint32_t input_index, const script& script_code,
+      uint64_t value, uint8_t sighash_type) const {
+
+    const auto anyone = (sighash_type & sighash_algorithm::anyone_can_pay) != 0;
+    const auto type = sighash_type & sighash_mask;
+    const auto single = type == sighash_algorithm::single;
+    const auto none = type == sighash_algorithm::none;
+    const auto& input = tx_.inputs()[input_index];
+
+    // Single output commitment for SIGHASH_SINGLE.
+    auto outputs_hash = null_hash;
+    if (!single && !none)
+      outputs_hash = outputs_hash_;
+    else if (single && input_index < tx_.outputs().size())
+      outputs_hash = bitcoin_hash(tx_.outputs()[input_index].to_data());
+
+    // Fixed fields plus the script code, on the stack for standard scripts.
+    const auto size = 4u + 32u + 32u + 36u + script_code.serialized_size(true)
+        + 8u + 4u + 32u + 4u + 4u;
+    uint8_t stack_buffer[1024];
+    data_chunk heap_buffer;
+    auto preimage = stack_buffer;
+    if (size > sizeof(stack_buffer)) {
+      heap_buffer.resize(size);
+      preimage = heap_buffer.data();
+    }
+
+    auto sink = make_unsafe_serializer(preimage);
+    sink.write_4_bytes_little_endian(tx_.version());
+    sink.write_hash(anyone ? null_hash : prevouts_hash_);
+    sink.write_hash(anyone || single || none ? null_hash : sequences_hash_);
+    input.previous_output().to_data(sink);
+    script_code.to_data(sink, true);
+    sink.write_8_bytes_little_endian(value);
+    sink.write_4_bytes_little_endian(input.sequence());
+    sink.write_hash(outputs_hash);
+    sink.write_4_bytes_little_endian(tx_.locktime());
+    sink.write_4_bytes_little_endian(sighash_type);
+
+    return bitcoin_hash(data_slice(preimage, preimage + size));
+  }
+
+private:
+  const transaction& tx_;
+  hash_digest prevouts_hash_;
+  hash_digest sequences_hash_;
+  hash_digest outputs_hash_;
+};
+
+
+// Legacy signature hash context.
+//-----------------------------------------------------------------------------
+
+// Signature hash of SIGHASH_SINGLE without a matching output (consensus bug).
+const hash_digest legacy_one_hash {{
+    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+}};
+
+// Serialised size of an input with an empty script: outpoint, 0x00, sequence.
+constexpr size_t empty_input_size = 36u + 1u + 4u;
+
+// Serialised size of a null output: value 0xffffffffffffffff, empty script.
+constexpr size_t null_output_size = 8u + 1u;
+
+// Caches the serialised parts of the legacy signature hash preimage which do
+// not depend on the signed input:
+//    inputs with empty scripts (sequences as is, and zeroed for NONE/SINGLE)
+//    all outputs (ALL), null outputs preceding the signed index (SINGLE)
+// A preimage is then assembled from these parts by copying, rather than by
+// building and reserialising a modified copy of the transaction per input.
+// Immutable after construction, so it may be shared between threads, each
+// passing its own scratch buffer.
+class legacy_sighash_context {
+
+public:
+  explicit legacy_sighash_context(const transaction& tx)
+    : tx_(tx) {
+
+    const auto& inputs = tx.inputs();
+    const auto& outputs = tx.outputs();
+
+    // Inputs with empty scripts, with original and with zeroed sequences.
+    inputs_.resize(inputs.size() * empty_input_size);
+    zeroed_inputs_.resize(inputs.size() * empty_input_size);
+    auto sink = make_unsafe_serializer(inputs_.begin());
+    auto zeroed_sink = make_unsafe_serializer(zeroed_inputs_.begin());
+    for (const auto& input: inputs) {
+      input.previous_output().to_data(sink);
+      sink.write_byte(0x00);
+      sink.write_4_bytes_little_endian(input.sequence());
+      input.previous_output().to_data(zeroed_sink);
+      zeroed_sink.write_byte(0x00);
+      zeroed_sink.write_4_bytes_little_endian(0u);
+    }
+
+    // All outputs, including their count.
+    size_t outputs_size = variable_size(outputs.size());
+    for (const auto& output: outputs)
+      outputs_size += output.serialized_size();
+
+    outputs_.resize(outputs_size);
+    auto output_sink = make_unsafe_serializer(outputs_.begin());
+    output_sink.write_size_little_endian(outputs.size());
+    for (const auto& output: outputs)
+      output.to_data(output_sink);
+
+    // Null outputs, of which SINGLE uses those preceding the signed index.
+    null_outputs_.resize(outputs.size() * null_output_size);
+    auto null_sink = make_unsafe_serializer(null_outputs_.begin());
+    for (size_t index = 0; index < outputs.size(); index++) {
+      null_sink.write_8_bytes_little_endian(max_uint64);
+      null_sink.write_byte(0x00);
+    }
+  }
+
+  // Legacy signature hash of one input. The preimage is assembled in the
+  // scratch buffer, which keeps its capacity across calls.
+  hash_digest signature_hash(uint32_t input_index, const script& script_code,
+      uint8_t sighash_type, data_chunk& scratch) const {
+
+    const auto anyone = (sighash_type & sighash_algorithm::anyone_can_pay) != 0;
+    const auto type = sighash_type & sighash_mask;
+    const auto single = type == sighash_algorithm::single;
+    const auto none = type == sighash_algorithm::none;
+    const auto& inputs = tx_.inputs();
+    const auto& outputs = tx_.outputs();
+
+    if (input_index >= inputs.size() ||
+        (single && input_index >= outputs.size()))
+      return legacy_one_hash;
+
+    // Code separators are removed from the script code.
+    script stripped;
+    auto code = &script_code;
+    if (has_code_separator(script_code)) {
+      stripped = strip_code_separators(script_code);
+      code = &stripped;
+    }
+
+    const auto& input = inputs[input_index];
+    const auto& others = (single || none) ? zeroed_inputs_ : inputs_;
+    const auto input_count = anyone ? size_t(1) : inputs.size();
+
+    // Outputs section: all outputs, none, or null outputs and one output.
+    const auto outputs_size = none ? 1u : !single ? outputs_.size() :
+        variable_size(input_index + 1u) + input_index * null_output_size +
+        outputs[input_index].serialized_size();
+
+    const auto size = 4u + variable_size(input_count) +
+        (input_count - 1u) * empty_input_size + 36u +
+        code->serialized_size(true) + 4u + outputs_size + 4u + 4u;
+    scratch.resize(size);
+
+    auto sink = make_unsafe_serializer(scratch.begin());
+    sink.write_4_bytes_little_endian(tx_.version());
+    sink.write_size_little_endian(input_count);
+
+    // Inputs preceding the signed input.
+    const auto before = anyone ? 0u : input_index * empty_input_size;
+    sink.write_bytes(others.data(), before);
+
+    // Signed input, with script code and its own sequence.
+    input.previous_output().to_data(sink);
+    code->to_data(sink, true);
+    sink.write_4_bytes_little_endian(input.sequence());
+
+    // Inputs following the signed input.
+    const auto after = anyone ? others.size() : before + empty_input_size;
+    sink.write_bytes(others.data() + after, others.size() - after);
+
+    if (none) {
+      sink.write_byte(0x00);
+    } else if (!single) {
+      sink.write_bytes(outputs_);
+    } else {
+      sink.write_size_little_endian(input_index + 1u);
+      sink.write_bytes(null_outputs_.data(), input_index * null_output_size);
+      outputs[input_index].to_data(sink);
+    }
+
+    sink.write_4_bytes_little_endian(tx_.locktime());
+    sink.write_4_bytes_little_endian(sighash_type);
+    return bitcoin_hash(scratch);
+  }
+
+private:
+  static size_t variable_size(uint64_t value) {
+    return value < 0xfd ? 1u : value <= 0xffff ? 3u :
+        value <= 0xffffffff ? 5u : 9u;
+  }
+
+  static bool has_code_separator(const script& script_code) {
+    for (const auto& op: script_code.operations())
+      if (op.code() == opcode::codeseparator)
+        return true;
+
+    return false;
+  }
+
+  static script strip_code_separators(const script& script_code) {
+    operation::list operations;
+    for (const auto& op: script_code.operations())
+      if (op.code() != opcode::codeseparator)
+        operations.push_back(op);
+
+    return script(operations);
+  }
+
+  const transaction& tx_;
+  data_chunk inputs_;
+  data_chunk zeroed_inputs_;
+  data_chunk outputs_;
+  data_chunk null_outputs_;
+};
+
+
+
+// Thread pool.
+//-----------------------------------------------------------------------------
+
+// Fixed set of worker threads, kept alive across transactions.
+// run() hands out indexes [0, count) to the workers through an atomic counter
+// and returns when all have been processed, so no task objects are queued.
+class thread_pool {
+
+public:
+  explicit thread_pool(size_t threads)
+    : work_(nullptr), count_(0), next_(0), active_(0), generation_(0),
+      stopping_(false) {
+    for (size_t index = 0; index < threads; index++)
+      threads_.emplace_back([this]() { work(); });
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    start_.notify_all();
+    for (auto& thread: threads_)
+      thread.join();
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  size_t size() const {
+    return threads_.size();
+  }
+
+  // Calls handler(index) for each index, blocks until all have returned.
+  void run(size_t count, const std::function<void(size_t)>& handler) {
+    if (count == 0)
+      return;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_ = &handler;
+    count_ = count;
+    next_ = 0;
+    active_ = threads_.size();
+    generation_++;
+    start_.notify_all();
+    done_.wait(lock, [this]() { return active_ == 0; });
+    work_ = nullptr;
+  }
+
+private:
+  void work() {
+    size_t generation = 0;
+    while (true) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock, [this, generation]() {
+        return stopping_ || generation_ != generation;
+      });
+      if (stopping_)
+        return;
+
+      generation = generation_;
+      const auto handler = work_;
+      const auto count = count_;
+      lock.unlock();
+
+      for (auto index = next_++; index < count; index = next_++)
+        (*handler)(index);
+
+      lock.lock();
+      if (--active_ == 0)
+        done_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  const std::function<void(size_t)>* work_;
+  size_t count_;
+  std::atomic<size_t> next_;
+  size_t active_;
+  size_t generation_;
+  bool stopping_;
+};
+
+
+// Parallel signer.
+//-----------------------------------------------------------------------------
+
+// Previous output of an input: amount and locking script.
+struct prevout {
+  uint64_t value;
+  script locking_script;
+};
+
+using prevout_map = std::map<output_point, prevout>;
+
+// Returns the secret for a locking script, e.g. by its public key hash.
+using key_provider = std::function<bool(ec_secret&, const script&)>;
+
+// Unlocking data of one input, installed once all inputs are signed.
+struct signed_input {
+  code result;
+  script input_script;
+  data_stack witness_stack;
+};
+
+
+// Sign a digest as script::create_endorsement() does.
+bool create_endorsement(endorsement& out, const ec_secret& secret,
+    const hash_digest& sighash, uint8_t sighash_type) {
+
+  ec_signature signature;
+  out.reserve(max_endorsement_size);
+  if (!sign(signature, secret, sighash) || !encode_signature(out, signature))
+    return false;
+
+  out.push_back(sighash_type);
+  return true;
+}
+
+
+// Public key hash of a P2PKH or P2WPKH locking script.
+bool extract_key_hash(short_hash& out, const script& locking_script) {
+
+  const auto& operations = locking_script.operations();
+  const auto p2pkh = script::is_pay_key_hash_pattern(operations);
+  const auto p2wpkh = script::is_witness_program_pattern(operations) &&
+      operations[0].code() == opcode::push_size_0 &&
+      operations[1].data().size() == short_hash_size;
+
+  if (!p2pkh && !p2wpkh)
+    return false;
+
+  out = to_array<short_hash_size>(operations[p2pkh ? 2 : 1].data());
+  return true;
+}
+
+
+// Signs one input against the shared contexts. Only reads the transaction.
+signed_input sign_input(uint32_t input_index, const prevout& previous,
+    const sighash_context& witness_context,
+    const legacy_sighash_context& legacy_context, const key_provider& keys,
+    uint8_t sighash_type) {
+
+  signed_input result;
+  const auto& locking_script = previous.locking_script;
+  const auto is_witness = script::is_witness_program_pattern(
+      locking_script.operations());
+
+  short_hash key_hash;
+  if (!extract_key_hash(key_hash, locking_script)) {
+    result.result = error::invalid_script;
+    return result;
+  }
+
+  ec_secret secret;
+  ec_compressed point;
+  if (!keys(secret, locking_script) || !secret_to_public(point, secret) ||
+      bitcoin_short_hash(point) != key_hash) {
+    result.result = error::not_found;
+    return result;
+  }
+
+  // Each worker reuses its own preimage buffer for legacy inputs.
+  thread_local data_chunk scratch;
+  const script p2pkh_script_code(script::to_pay_key_hash_pattern(key_hash));
+  const auto sighash = is_witness ?
+      witness_context.signature_hash(input_index, p2pkh_script_code,
+          previous.value, sighash_type) :
+      legacy_context.signature_hash(input_index, locking_script,
+          sighash_type, scratch);
+
+  endorsement sig;
+  if (!create_endorsement(sig, secret, sighash, sighash_type)) {
+    result.result = error::operation_failed;
+    return result;
+  }
+
+  if (is_witness) {
+    // P2WPKH: [signature] [public key] in the witness, empty input script.
+    result.witness_stack.push_back(sig);
+    result.witness_stack.push_back(to_chunk(point));
+  } else {
+    // P2PKH: [signature] [public key] in the input script.
+    operation::list sig_script;
+    sig_script.push_back(operation(sig));
+    sig_script.push_back(operation(to_chunk(point)));
+    result.input_script = script(sig_script);
+  }
+
+  result.result = error::success;
+  return result;
+}
+
+
+// Signs all P2PKH and P2WPKH inputs of the transaction on the pool.
+// Signature hashes are computed from contexts shared by all workers, and
+// results are collected per input index. Scripts and witnesses are installed
+// only after all inputs are signed, so the transaction is not modified while
+// the contexts refer to it. Signing is deterministic (RFC6979), so the result
+// does not depend on the number of threads or their scheduling.
+// Returns the error of the lowest failing input, without modifying the tx.
+code sign_transaction(transaction& tx, const prevout_map& prevouts,
+    const key_provider& keys, thread_pool& pool,
+    uint8_t sighash_type=sighash_algorithm::all) {
+
+  auto& inputs = tx.inputs();
+
+  // Resolve previous outputs before starting any work.
+  std::vector<const prevout*> previous(inputs.size());
+  for (size_t index = 0; index < inputs.size(); index++) {
+    const auto it = prevouts.find(inputs[index].previous_output());
+    if (it == prevouts.end())
+      return error::missing_previous_output;
+
+    previous[index] = &it->second;
+  }
+
+  const sighash_context witness_context(tx);
+  const legacy_sighash_context legacy_context(tx);
+  std::vector<signed_input> results(inputs.size());
+
+  pool.run(inputs.size(), [&](size_t index) {
+    results[index] = sign_input(static_cast<uint32_t>(index),
+        *previous[index], witness_context, legacy_context, keys,
+        sighash_type);
+  });
+
+  for (const auto& result: results)
+    if (result.result)
+      return result.result;
+
+  // Install unlocking scripts and witnesses in input order.
+  for (size_t index = 0; index < inputs.size(); index++) {
+    inputs[index].set_script(std::move(results[index].input_script));
+    inputs[index].set_witness(witness(std::move(results[index].witness_stack)));
+  }
+
+  return error::success;
+}
+
+
+// Reference: one input after another with script::create_endorsement().
+code sign_transaction_sequential(transaction& tx, const prevout_map& prevouts,
+    const key_provider& keys, uint8_t sighash_type=sighash_algorithm::all) {
+
+  for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+    const auto it = prevouts.find(tx.inputs()[index].previous_output());
+    if (it == prevouts.end())
+      return error::missing_previous_output;
+
+    const auto& previous = it->second;
+    const auto is_witness = script::is_witness_program_pattern(
+        previous.locking_script.operations());
+
+    short_hash key_hash;
+    ec_secret secret;
+    ec_compressed point;
+    if (!extract_key_hash(key_hash, previous.locking_script))
+      return error::invalid_script;
+
+    if (!keys(secret, previous.locking_script) ||
+        !secret_to_public(point, secret))
+      return error::not_found;
+
+    endorsement sig;
+    if (is_witness) {
+      const script script_code(script::to_pay_key_hash_pattern(key_hash));
+      script::create_endorsement(sig, secret, script_code, tx, index,
+          sighash_type, script_version::zero, previous.value);
+      data_stack witness_stack { sig, to_chunk(point) };
+      tx.inputs()[index].set_witness(witness(witness_stack));
+    } else {
+      script::create_endorsement(sig, secret, previous.locking_script, tx,
+          index, sighash_type);
+      operation::list sig_script;
+      sig_script.push_back(operation(sig));
+      sig_script.push_back(operation(to_chunk(point)));
+      tx.inputs()[index].set_script(script(sig_script));
+    }
+  }
+
+  return error::success;
+}
+
+
+// Sweep of P2PKH and P2WPKH outputs, owned by four different keys.
+//-----------------------------------------------------------------------------
+
+// Keys of the wallet, by public key hash.
+std::map<short_hash, ec_secret> wallet_keys() {
+
+  std::map<short_hash, ec_secret> keys;
+  keys[bitcoin_short_hash(pubkey1)] = my_secret1;
+  keys[bitcoin_short_hash(pubkey_witness_aware)] = my_secret_witness_aware;
+  keys[bitcoin_short_hash(pubkey_witness_aware1)] = my_secret_witness_aware1;
+  keys[bitcoin_short_hash(pubkey_witness_aware2)] = my_secret_witness_aware2;
+  return keys;
+
+}
+
+
+transaction create_sweep(size_t input_count, prevout_map& prevouts) {
+
+  // Function creates a tx sweeping input_count outputs into one output.
+  // Even inputs spend P2PKH, odd inputs spend P2WPKH outputs.
+  //---------------------------------------------------------------------------
+
+  std::string prev_tx =
+      "7ea970031b28fcc1cef517dfa7d812cb61c409aec37a0463e951a05700d61b73";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+
+  const ec_compressed owners[] = {
+      pubkey1,
+      pubkey_witness_aware,
+      pubkey_witness_aware1,
+      pubkey_witness_aware2
+  };
+
+  std::string prev_btc_amount = "0.995";
+  uint64_t prev_amount;
+  decode_base10(prev_amount, prev_btc_amount, btc_decimal_places);
+
+  transaction tx;
+  tx.set_version(1u);
+  for (size_t index = 0; index < input_count; index++) {
+    const output_point point(prev_tx_hash, static_cast<uint32_t>(index));
+    const auto key_hash = bitcoin_short_hash(owners[index % 4u]);
+
+    operation::list p2wpkh_operations;
+    p2wpkh_operations.push_back(operation(opcode::push_size_0));
+    p2wpkh_operations.push_back(operation(to_chunk(key_hash)));
+
+    prevouts[point] = prevout{ prev_amount, index % 2u == 0 ?
+        script(script::to_pay_key_hash_pattern(key_hash)) :
+        script(p2wpkh_operations) };
+
+    input sweep_input;
+    sweep_input.set_previous_output(point);
+    sweep_input.set_sequence(max_input_sequence);
+    tx.inputs().push_back(sweep_input);
+  }
+
+  auto output_script = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey1));
+  tx.outputs().push_back(output((prev_amount - 1000u) * input_count,
+      output_script));
+  tx.set_locktime(0u);
+
+  return tx;
+
+}
+
+
+void parallel_signing_example() {
+
+  prevout_map prevouts;
+  const auto unsigned_tx = create_sweep(8u, prevouts);
+
+  const auto keys = wallet_keys();
+  const key_provider provider = [&keys](ec_secret& out,
+      const script& locking_script) {
+    short_hash key_hash;
+    if (!extract_key_hash(key_hash, locking_script))
+      return false;
+
+    const auto it = keys.find(key_hash);
+    if (it == keys.end())
+      return false;
+
+    out = it->second;
+    return true;
+  };
+
+  // Sign in parallel.
+  thread_pool pool(4u);
+  auto tx = unsigned_tx;
+  auto ec = sign_transaction(tx, prevouts, provider, pool);
+  std::cout << ec.message() << std::endl;
+
+  // Byte-identical to sequential signing with the library.
+  auto sequential_tx = unsigned_tx;
+  sign_transaction_sequential(sequential_tx, prevouts, provider);
+  std::cout << (tx.to_data(true, true) == sequential_tx.to_data(true, true))
+            << std::endl;
+
+  // Every input verifies.
+  for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+    const auto& previous = prevouts[tx.inputs()[index].previous_output()];
+    ec = script::verify(tx, index, rule_fork::all_rules,
+        previous.locking_script, previous.value);
+    std::cout << ec.message() << std::endl;
+  }
+
+  std::cout << encode_base16(tx.to_data(true, true)) << std::endl;
+
+  // Missing key: the transaction is left unsigned.
+  const key_provider no_keys = [](ec_secret&, const script&) {
+    return false;
+  };
+  auto failed_tx = unsigned_tx;
+  ec = sign_transaction(failed_tx, prevouts, no_keys, pool);
+  std::cout << ec.message() << std::endl;
+  std::cout << (failed_tx == unsigned_tx) << std::endl;
+
+}
+
+
+void benchmark_parallel_signing(size_t input_count) {
+
+  prevout_map prevouts;
+  const auto unsigned_tx = create_sweep(input_count, prevouts);
+  const auto keys = wallet_keys();
+  const key_provider provider = [&keys](ec_secret& out,
+      const script& locking_script) {
+    short_hash key_hash;
+    if (!extract_key_hash(key_hash, locking_script))
+      return false;
+
+    const auto it = keys.find(key_hash);
+    if (it == keys.end())
+      return false;
+
+    out = it->second;
+    return true;
+  };
+
+  const auto milliseconds = [](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time)
+        .count();
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  auto sequential_tx = unsigned_tx;
+  sign_transaction_sequential(sequential_tx, prevouts, provider);
+  const auto sequential_time = std::chrono::steady_clock::now() - start;
+  const auto expected = sequential_tx.to_data(true, true);
+
+  std::cout << "inputs: " << input_count << std::endl;
+  std::cout << "  sequential:        " << milliseconds(sequential_time)
+            << " ms" << std::endl;
+
+  const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t threads = 1; threads <= hardware; threads *= 2) {
+    thread_pool pool(threads);
+    auto tx = unsigned_tx;
+    start = std::chrono::steady_clock::now();
+    sign_transaction(tx, prevouts, provider, pool);
+    const auto parallel_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << "  " << threads << " thread(s): "
+              << milliseconds(parallel_time) << " ms, identical: "
+              << (tx.to_data(true, true) == expected) << std::endl;
+  }
+
+}
+
+
+// Batched multisig.
+//-----------------------------------------------------------------------------
+
+// P2WSH or P2SH-P2WSH multisig input of a batch. Inputs of a batch may
+// belong to different transactions.
+struct multisig_input {
+  transaction* tx;
+  uint32_t input_index;
+  script witness_script;
+};
+
+
+// Witness program of a witness script: 0 [32-byte sha256(witness script)]
+script to_p2wsh_program(const script& witness_script) {
+
+  operation::list operations;
+  operations.push_back(operation(opcode::push_size_0));
+  operations.push_back(operation(to_chunk(sha256_hash(
+      witness_script.to_data(false)))));
+  return script(operations);
+}
+
+
+// One BIP143 context per distinct transaction of a batch.
+std::vector<size_t> create_batch_contexts(
+    std::vector<sighash_context>& contexts,
+    const std::vector<multisig_input>& batch) {
+
+  std::map<const transaction*, size_t> positions;
+  std::vector<size_t> context_of(batch.size());
+  contexts.reserve(batch.size());
+
+  for (size_t index = 0; index < batch.size(); index++) {
+    const auto found = positions.find(batch[index].tx);
+    if (found != positions.end()) {
+      context_of[index] = found->second;
+      continue;
+    }
+
+    positions[batch[index].tx] = contexts.size();
+    context_of[index] = contexts.size();
+    contexts.emplace_back(*batch[index].tx);
+  }
+
+  return context_of;
+}
+
+
+// Signs all inputs of the batch with each of the signers, which must be
+// ordered as their keys in the witness scripts. The digest of each input is
+// computed once and shared by its signers, and all signatures of the batch
+// are created on the pool. Witnesses, and the input scripts of P2SH-P2WSH
+// inputs, are installed once all signatures exist.
+// Returns the error of the lowest failing input, without modifying the batch.
+code sign_multisig_batch(std::vector<multisig_input>& batch,
+    const prevout_map& prevouts, const std::vector<ec_secret>& signers,
+    thread_pool& pool, uint8_t sighash_type=sighash_algorithm::all) {
+
+  std::vector<const prevout*> previous(batch.size());
+  for (size_t index = 0; index < batch.size(); index++) {
+    const auto& item = batch[index];
+    const auto it = prevouts.find(
+        item.tx->inputs()[item.input_index].previous_output());
+    if (it == prevouts.end())
+      return error::missing_previous_output;
+
+    previous[index] = &it->second;
+  }
+
+  std::vector<sighash_context> contexts;
+  const auto context_of = create_batch_contexts(contexts, batch);
+
+  // One digest per input.
+  std::vector<hash_digest> digests(batch.size());
+  pool.run(batch.size(), [&](size_t index) {
+    const auto& item = batch[index];
+    digests[index] = contexts[context_of[index]].signature_hash(
+        item.input_index, item.witness_script, previous[index]->value,
+        sighash_type);
+  });
+
+  // One task per signature.
+  const auto signer_count = signers.size();
+  std::vector<endorsement> signatures(batch.size() * signer_count);
+  std::vector<uint8_t> signed_ok(signatures.size());
+  pool.run(signatures.size(), [&](size_t index) {
+    signed_ok[index] = create_endorsement(signatures[index],
+        signers[index % signer_count], digests[index / signer_count],
+        sighash_type);
+  });
+
+  for (size_t index = 0; index < batch.size(); index++)
+    for (size_t signer = 0; signer < signer_count; signer++)
+      if (!signed_ok[index * signer_count + signer])
+        return error::operation_failed;
+
+  // Install: [empty] [signature 1] ... [signature m] [witness script]
+  for (size_t index = 0; index < batch.size(); index++) {
+    const auto& item = batch[index];
+    auto& input = item.tx->inputs()[item.input_index];
+    const auto nested = previous[index]->locking_script.output_pattern() ==
+        script_pattern::pay_script_hash;
+
+    data_stack witness_stack { data_chunk() };
+    for (size_t signer = 0; signer < signer_count; signer++)
+      witness_stack.push_back(std::move(
+          signatures[index * signer_count + signer]));
+
+    witness_stack.push_back(item.witness_script.to_data(false));
+    input.set_witness(witness(std::move(witness_stack)));
+
+    // P2SH-P2WSH: the input script pushes the witness program.
+    if (nested) {
+      operation::list sig_script;
+      sig_script.push_back(operation(to_p2wsh_program(
+          item.witness_script).to_data(false)));
+      input.set_script(script(sig_script));
+    }
+  }
+
+  return error::success;
+}
+
+
+// Reference: script::create_endorsement() per signature, which computes the
+// signature hash of the input again for each signer.
+code sign_multisig_sequential(std::vector<multisig_input>& batch,
+    const prevout_map& prevouts, const std::vector<ec_secret>& signers,
+    uint8_t sighash_type=sighash_algorithm::all) {
+
+  for (auto& item: batch) {
+    auto& input = item.tx->inputs()[item.input_index];
+    const auto it = prevouts.find(input.previous_output());
+    if (it == prevouts.end())
+      return error::missing_previous_output;
+
+    data_stack witness_stack { data_chunk() };
+    for (const auto& secret: signers) {
+      endorsement sig;
+      if (!script::create_endorsement(sig, secret, item.witness_script,
+          *item.tx, item.input_index, sighash_type, script_version::zero,
+          it->second.value))
+        return error::operation_failed;
+
+      witness_stack.push_back(sig);
+    }
+
+    witness_stack.push_back(item.witness_script.to_data(false));
+    input.set_witness(witness(witness_stack));
+
+    if (it->second.locking_script.output_pattern() ==
+        script_pattern::pay_script_hash) {
+      operation::list sig_script;
+      sig_script.push_back(operation(to_p2wsh_program(
+          item.witness_script).to_data(false)));
+      input.set_script(script(sig_script));
+    }
+  }
+
+  return error::success;
+}
+
+
+// Verifies a P2WSH or P2SH-P2WSH multisig input against a shared context,
+// with one digest per sighash type. Inputs of other forms, inputs under
+// rules which do not define them, and inputs which fail, are verified by
+// script::verify() for its result.
+code verify_multisig_input(const sighash_context& context,
+    uint32_t input_index, const prevout& previous, uint32_t forks) {
+
+  const auto& tx = context.tx();
+  const auto& input = tx.inputs()[input_index];
+  const auto& stack = input.witness().stack();
+  const auto& locking_script = previous.locking_script;
+  const auto fallback = [&]() {
+    return script::verify(tx, input_index, forks, locking_script,
+        previous.value);
+  };
+
+  // The BIP143 digest applies only under the witness rules, and nested
+  // spends also require the P2SH rule.
+  const auto witness_rules = (forks & rule_fork::bip141_rule) != 0 &&
+      (forks & rule_fork::bip143_rule) != 0;
+  const auto p2sh_rules = (forks & rule_fork::bip16_rule) != 0;
+
+  if (!witness_rules || stack.size() < 2u || !stack.front().empty())
+    return fallback();
+
+  // The witness program, native or pushed by the input script.
+  const script witness_script(stack.back(), false);
+  const auto program = to_p2wsh_program(witness_script);
+  const auto nested = locking_script.output_pattern() ==
+      script_pattern::pay_script_hash;
+  const auto& input_operations = input.script().operations();
+
+  if (nested) {
+    if (!p2sh_rules)
+      return fallback();
+
+    const auto program_data = program.to_data(false);
+    const script p2sh_script(script::to_pay_script_hash_pattern(
+        bitcoin_short_hash(program_data)));
+    if (input_operations.size() != 1u ||
+        input_operations[0].data() != program_data ||
+        locking_script != p2sh_script)
+      return fallback();
+  } else if (!input_operations.empty() || locking_script != program) {
+    return fallback();
+  }
+
+  // m [key 1] ... [key n] n checkmultisig
+  const auto& operations = witness_script.operations();
+  if (!script::is_pay_multisig_pattern(operations) ||
+      stack.size() != 2u + operation::opcode_to_positive(
+          operations.front().code()))
+    return fallback();
+
+  auto has_digest = false;
+  uint8_t digest_type = 0;
+  hash_digest digest;
+  size_t key_index = 1;
+  const auto key_end = operations.size() - 2u;
+
+  for (size_t index = 1; index < stack.size() - 1u; index++) {
+    uint8_t sighash_type;
+    der_signature distinguished;
+    ec_signature signature;
+    auto endorsement_copy = stack[index];
+    if (!parse_endorsement(sighash_type, distinguished,
+        std::move(endorsement_copy)) ||
+        !parse_signature(signature, distinguished, true))
+      return fallback();
+
+    if (!has_digest || sighash_type != digest_type) {
+      digest = context.signature_hash(input_index, witness_script,
+          previous.value, sighash_type);
+      digest_type = sighash_type;
+      has_digest = true;
+    }
+
+    auto matched = false;
+    while (!matched && key_index < key_end)
+      matched = verify_signature(operations[key_index++].data(), digest,
+          signature);
+
+    if (!matched)
+      return fallback();
+  }
+
+  return error::success;
+}
+
+
+// Verifies all inputs of the batch on the pool, one task per input.
+void verify_multisig_batch(std::vector<code>& out,
+    const std::vector<multisig_input>& batch, const prevout_map& prevouts,
+    thread_pool& pool, uint32_t forks=rule_fork::all_rules) {
+
+  std::vector<sighash_context> contexts;
+  const auto context_of = create_batch_contexts(contexts, batch);
+  out.assign(batch.size(), error::success);
+
+  pool.run(batch.size(), [&](size_t index) {
+    const auto& item = batch[index];
+    const auto it = prevouts.find(
+        item.tx->inputs()[item.input_index].previous_output());
+    out[index] = it == prevouts.end() ? error::missing_previous_output :
+        verify_multisig_input(contexts[context_of[index]], item.input_index,
+            it->second, forks);
+  });
+}
+
+
+// 2-of-3 multisig spends of a custody wallet, one input per transaction.
+// Even spends are P2WSH, odd spends are P2SH-P2WSH.
+std::vector<multisig_input> create_custody_spends(size_t count,
+    std::vector<transaction>& transactions, prevout_map& prevouts) {
+
+  point_list points {
+      pubkey_witness_aware,
+      pubkey_witness_aware1,
+      pubkey_witness_aware2
+  };
+  const script witness_script(script::to_pay_multisig_pattern(2u, points));
+  const auto program = to_p2wsh_program(witness_script);
+  const script nested_program(script::to_pay_script_hash_pattern(
+      bitcoin_short_hash(program.to_data(false))));
+  const auto output_script = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey1));
+
+  std::string prev_tx =
+      "98f85a8b774242979c9f0be37faba32d01c1e93fb69b4e6fa4b241b837dba293";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+  const uint64_t prev_amount = 129500000u;
+
+  // Pointers into transactions must remain valid.
+  transactions.clear();
+  transactions.reserve(count);
+  std::vector<multisig_input> batch;
+
+  for (size_t index = 0; index < count; index++) {
+    const output_point point(prev_tx_hash, static_cast<uint32_t>(index));
+    prevouts[point] = prevout{ prev_amount,
+        index % 2u == 0 ? program : nested_program };
+
+    input multisig_spend;
+    multisig_spend.set_previous_output(point);
+    multisig_spend.set_sequence(max_input_sequence);
+
+    transaction tx;
+    tx.set_version(1u);
+    tx.inputs().push_back(multisig_spend);
+    tx.outputs().push_back(output(prev_amount - 1000u, output_script));
+    tx.set_locktime(0u);
+    transactions.push_back(tx);
+
+    batch.push_back({ &transactions.back(), 0u, witness_script });
+  }
+
+  return batch;
+
+}
+
+
+void batched_multisig_example() {
+
+  prevout_map prevouts;
+  std::vector<transaction> transactions;
+  auto batch = create_custody_spends(4u, transactions, prevouts);
+  const std::vector<ec_secret> signers {
+      my_secret_witness_aware,
+      my_secret_witness_aware1
+  };
+
+  // Prints success
+  thread_pool pool(4u);
+  std::cout << sign_multisig_batch(batch, prevouts, signers, pool).message()
+            << std::endl;
+
+  // Byte-identical to script::create_endorsement() per signature.
+  std::vector<transaction> sequential_transactions;
+  auto sequential_batch = create_custody_spends(4u, sequential_transactions,
+      prevouts);
+  sign_multisig_sequential(sequential_batch, prevouts, signers);
+  std::cout << (transactions == sequential_transactions) << std::endl;
+
+  // Prints success for each input.
+  std::vector<code> results;
+  verify_multisig_batch(results, batch, prevouts, pool);
+  for (const auto& ec: results)
+    std::cout << ec.message() << std::endl;
+
+  // Signatures in the wrong key order fail, as with script::verify().
+  auto stack = transactions[1].inputs()[0].witness().stack();
+  std::swap(stack[1], stack[2]);
+  transactions[1].inputs()[0].set_witness(witness(stack));
+  verify_multisig_batch(results, batch, prevouts, pool);
+  std::cout << results[1].message() << std::endl;
+
+}
+
+
+void benchmark_batched_multisig(size_t count) {
+
+  prevout_map prevouts;
+  const std::vector<ec_secret> signers {
+      my_secret_witness_aware,
+      my_secret_witness_aware1
+  };
+
+  const auto milliseconds = [](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time)
+        .count();
+  };
+
+  // Per signature and per input with the library.
+  std::vector<transaction> expected;
+  auto sequential_batch = create_custody_spends(count, expected, prevouts);
+  auto start = std::chrono::steady_clock::now();
+  sign_multisig_sequential(sequential_batch, prevouts, signers);
+  const auto sign_time = std::chrono::steady_clock::now() - start;
+
+  size_t failures = 0;
+  start = std::chrono::steady_clock::now();
+  for (const auto& tx: expected) {
+    const auto& previous = prevouts[tx.inputs()[0].previous_output()];
+    failures += bool(script::verify(tx, 0u, rule_fork::all_rules,
+        previous.locking_script, previous.value));
+  }
+  const auto verify_time = std::chrono::steady_clock::now() - start;
+
+  std::cout << "spends: " << count << std::endl;
+  std::cout << "  create_endorsement: " << milliseconds(sign_time)
+            << " ms, script::verify: " << milliseconds(verify_time)
+            << " ms" << std::endl;
+
+  const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t threads = 1; threads <= hardware; threads *= 2) {
+    thread_pool pool(threads);
+    std::vector<transaction> transactions;
+    auto batch = create_custody_spends(count, transactions, prevouts);
+
+    start = std::chrono::steady_clock::now();
+    sign_multisig_batch(batch, prevouts, signers, pool);
+    const auto batch_sign_time = std::chrono::steady_clock::now() - start;
+
+    std::vector<code> results;
+    start = std::chrono::steady_clock::now();
+    verify_multisig_batch(results, batch, prevouts, pool);
+    const auto batch_verify_time = std::chrono::steady_clock::now() - start;
+
+    for (const auto& ec: results)
+      failures += bool(ec);
+
+    std::cout << "  " << threads << " thread(s): sign "
+              << milliseconds(batch_sign_time) << " ms, verify "
+              << milliseconds(batch_verify_time) << " ms, identical: "
+              << (transactions == expected) << std::endl;
+  }
+
+  std::cout << "  failures: " << failures << std::endl;
+
+}
+
+
+int main() {
+
+  parallel_signing_example();
+
+  benchmark_parallel_signing(100);
+  benchmark_parallel_signing(1000);
+
+  batched_multisig_example();
+
+  benchmark_batched_multisig(1000);
+
+  return 0;
+
+}
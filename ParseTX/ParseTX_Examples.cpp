@@ -0,0 +1,533 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Witness Aware" wallet.
+auto my_secret_witness_aware = base16_literal(
+    "0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+ec_private my_private_witness_aware(my_secret_witness_aware,
+    ec_private::testnet, true);
+auto pubkey_witness_aware = my_private_witness_aware
+    .to_public().point();
+
+
+// Read a Bitcoin variable length integer (compact size) and advance.
+bool read_compact_size(const uint8_t*& position, const uint8_t* end,
+    uint64_t& out) {
+
+  if (position == end)
+    return false;
+
+  const auto prefix = *position;
+  const size_t width = prefix < 0xfd ? 0 : prefix == 0xfd ? 2 :
+      prefix == 0xfe ? 4 : 8;
+  if (static_cast<size_t>(end - position) < 1u + width)
+    return false;
+
+  position++;
+  out = width == 0 ? prefix :
+      width == 2 ? from_little_endian_unsafe<uint16_t>(position) :
+      width == 4 ? from_little_endian_unsafe<uint32_t>(position) :
+          from_little_endian_unsafe<uint64_t>(position);
+  position += width;
+  return true;
+
+}
+
+
+// Read-only view over a serialised transaction.
+// Only offsets into the raw bytes are recorded, nothing is copied.
+class transaction_view {
+
+public:
+  struct input_offsets {
+    size_t point;          // 36 bytes: previous tx hash, previous index.
+    size_t script;         // Script bytes (without size prefix).
+    size_t script_size;
+    size_t sequence;       // 4 bytes.
+    size_t witness;        // Witness element count prefix.
+    size_t witness_count;
+  };
+
+  struct output_offsets {
+    size_t value;          // 8 bytes.
+    size_t script;         // Script bytes (without size prefix).
+    size_t script_size;
+  };
+
+  // Index the transaction at the start of [data, data + size).
+  // The index containers keep their capacity, so a reused view does not
+  // allocate once it has seen the largest transaction of a workload.
+  bool parse(const uint8_t* data, size_t size) {
+
+    data_ = data;
+    end_ = data + size;
+    position_ = data;
+    inputs_.clear();
+    outputs_.clear();
+    segregated_ = false;
+
+    if (!skip(4u))
+      return false;
+
+    uint64_t input_count;
+    if (!read_size(input_count))
+      return false;
+
+    // Witness marker (0x00) and flag (0x01).
+    if (input_count == 0) {
+      if (remaining() < 1u || *position_ != 0x01)
+        return false;
+
+      segregated_ = true;
+      position_++;
+      if (!read_size(input_count) || input_count == 0)
+        return false;
+    }
+
+    for (uint64_t index = 0; index < input_count; index++) {
+      input_offsets input;
+      uint64_t script_size;
+      input.point = offset();
+      if (!skip(36u) || !read_size(script_size))
+        return false;
+
+      input.script = offset();
+      input.script_size = script_size;
+      if (!skip(script_size))
+        return false;
+
+      input.sequence = offset();
+      if (!skip(4u))
+        return false;
+
+      input.witness = 0;
+      input.witness_count = 0;
+      inputs_.push_back(input);
+    }
+
+    uint64_t output_count;
+    if (!read_size(output_count))
+      return false;
+
+    for (uint64_t index = 0; index < output_count; index++) {
+      output_offsets output;
+      uint64_t script_size;
+      output.value = offset();
+      if (!skip(8u) || !read_size(script_size))
+        return false;
+
+      output.script = offset();
+      output.script_size = script_size;
+      if (!skip(script_size))
+        return false;
+
+      outputs_.push_back(output);
+    }
+
+    witness_ = offset();
+    if (segregated_) {
+      for (auto& input: inputs_) {
+        uint64_t count;
+        input.witness = offset();
+        if (!read_size(count))
+          return false;
+
+        input.witness_count = count;
+        for (uint64_t element = 0; element < count; element++) {
+          uint64_t element_size;
+          if (!read_size(element_size) || !skip(element_size))
+            return false;
+        }
+      }
+    }
+
+    locktime_ = offset();
+    return skip(4u);
+  }
+
+  // Properties.
+  //---------------------------------------------------------------------------
+
+  bool is_segregated() const {
+    return segregated_;
+  }
+
+  size_t serialized_size(bool witness) const {
+    const auto full = locktime_ + 4u;
+    return (witness || !segregated_) ? full :
+        full - 2u - (locktime_ - witness_);
+  }
+
+  uint32_t version() const {
+    return from_little_endian_unsafe<uint32_t>(data_);
+  }
+
+  uint32_t locktime() const {
+    return from_little_endian_unsafe<uint32_t>(data_ + locktime_);
+  }
+
+  // Inputs.
+  //---------------------------------------------------------------------------
+
+  size_t input_count() const {
+    return inputs_.size();
+  }
+
+  const uint8_t* previous_hash(size_t index) const {
+    return data_ + inputs_[index].point;
+  }
+
+  uint32_t previous_index(size_t index) const {
+    return from_little_endian_unsafe<uint32_t>(
+        data_ + inputs_[index].point + hash_size);
+  }
+
+  data_slice input_script(size_t index) const {
+    const auto first = data_ + inputs_[index].script;
+    return data_slice(first, first + inputs_[index].script_size);
+  }
+
+  uint32_t sequence(size_t index) const {
+    return from_little_endian_unsafe<uint32_t>(
+        data_ + inputs_[index].sequence);
+  }
+
+  size_t witness_count(size_t index) const {
+    return inputs_[index].witness_count;
+  }
+
+  // Witness elements are not indexed individually, a walk over the (few)
+  // preceding elements of the same input is cheaper than storing offsets.
+  data_slice witness_element(size_t index, size_t element) const {
+    auto position = data_ + inputs_[index].witness;
+    uint64_t size;
+
+    // Skip element count and preceding elements.
+    read_compact_size(position, end_, size);
+    for (size_t count = 0; count < element; count++) {
+      read_compact_size(position, end_, size);
+      position += size;
+    }
+
+    read_compact_size(position, end_, size);
+    return data_slice(position, position + size);
+  }
+
+  // Outputs.
+  //---------------------------------------------------------------------------
+
+  size_t output_count() const {
+    return outputs_.size();
+  }
+
+  uint64_t value(size_t index) const {
+    return from_little_endian_unsafe<uint64_t>(data_ + outputs_[index].value);
+  }
+
+  data_slice output_script(size_t index) const {
+    const auto first = data_ + outputs_[index].script;
+    return data_slice(first, first + outputs_[index].script_size);
+  }
+
+  // Hashes.
+  //---------------------------------------------------------------------------
+
+  // For segregated transactions the txid preimage excludes the marker, flag
+  // and witnesses, so its three fragments are gathered into scratch space.
+  hash_digest hash(bool witness=false) const {
+    if (witness || !segregated_)
+      return bitcoin_hash(data_slice(data_, data_ + serialized_size(witness)));
+
+    scratch_.resize(serialized_size(false));
+    auto out = std::copy(data_, data_ + 4u, scratch_.begin());
+    out = std::copy(data_ + 6u, data_ + witness_, out);
+    std::copy(data_ + locktime_, data_ + locktime_ + 4u, out);
+    return bitcoin_hash(scratch_);
+  }
+
+  // Interoperability.
+  //---------------------------------------------------------------------------
+
+  // The prevout script of a spending input, e.g. for script::verify().
+  script output_script_object(size_t index) const {
+    return script(to_chunk(output_script(index)), false);
+  }
+
+  // Materialise the full transaction object, required by script::verify()
+  // for signature hashing. Only done once a view has passed cheap checks.
+  transaction to_transaction() const {
+    transaction tx;
+    auto source = make_safe_deserializer(data_, data_ + serialized_size(true));
+    tx.from_data(source, true, true);
+    return tx;
+  }
+
+private:
+  size_t offset() const {
+    return position_ - data_;
+  }
+
+  size_t remaining() const {
+    return end_ - position_;
+  }
+
+  bool skip(uint64_t size) {
+    if (size > remaining())
+      return false;
+
+    position_ += size;
+    return true;
+  }
+
+  bool read_size(uint64_t& out) {
+    return read_compact_size(position_, end_, out);
+  }
+
+  const uint8_t* data_ = nullptr;
+  const uint8_t* end_ = nullptr;
+  const uint8_t* position_ = nullptr;
+  bool segregated_ = false;
+  size_t witness_ = 0;
+  size_t locktime_ = 0;
+  std::vector<input_offsets> inputs_;
+  std::vector<output_offsets> outputs_;
+  mutable data_chunk scratch_;
+};
+
+
+transaction create_example_transaction() {
+
+  // Function creates a signed P2WPKH spend for the view examples.
+  //---------------------------------------------------------------------------
+
+  // Destination output.
+  std::string btc_amount = "0.993";
+  uint64_t output_amount;
+  decode_base10(output_amount, btc_amount, btc_decimal_places);
+  auto p2pkh_script = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey_witness_aware));
+  output p2pkh_output(output_amount, p2pkh_script);
+
+  // P2WPKH input.
+  std::string prev_tx =
+      "26c9768cdbb00332ff1052f27e71eb7e82b578bf02fb6d7eecfd0b43412e9d10";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+  output_point uxto_to_spend(prev_tx_hash, 0u);
+  input p2wpkh_input;
+  p2wpkh_input.set_previous_output(uxto_to_spend);
+  p2wpkh_input.set_sequence(max_input_sequence);
+
+  // Build transaction.
+  transaction tx;
+  tx.set_version(1u);
+  tx.inputs().push_back(p2wpkh_input);
+  tx.outputs().push_back(p2pkh_output);
+
+  // Witness.
+  std::string prev_btc_amount = "0.995";
+  uint64_t prev_amount;
+  decode_base10(prev_amount, prev_btc_amount, btc_decimal_places);
+  endorsement sig;
+  script::create_endorsement(sig, my_secret_witness_aware, p2pkh_script, tx,
+      0u, sighash_algorithm::all, script_version::zero, prev_amount);
+  data_stack witness_stack {
+      sig,
+      to_chunk(pubkey_witness_aware)
+  };
+  tx.inputs()[0].set_witness(witness(witness_stack));
+
+  return tx;
+
+}
+
+
+void parse_transaction_view(const transaction& example_transaction) {
+
+  // Raw bytes as received from a peer or read from disk.
+  const auto raw = example_transaction.to_data(true, true);
+
+  transaction_view view;
+  if (!view.parse(raw.data(), raw.size())) {
+    std::cout << "invalid transaction" << std::endl;
+    return;
+  }
+
+  // Identifiers match those of the deserialised transaction.
+  std::cout << (view.hash() == example_transaction.hash()) << std::endl;
+  std::cout << (view.hash(true) == example_transaction.hash(true))
+            << std::endl;
+
+  // Fields are read straight from the raw bytes.
+  std::cout << encode_base16(view.input_script(0)) << std::endl;
+  std::cout << encode_base16(view.witness_element(0, 0)) << std::endl;
+  std::cout << encode_base16(view.witness_element(0, 1)) << std::endl;
+  std::cout << view.value(0) << std::endl;
+  std::cout << encode_base16(view.output_script(0)) << std::endl;
+
+  // Script verification requires the transaction object, which is only
+  // materialised once the view is needed for it.
+  std::string prev_btc_amount = "0.995";
+  uint64_t prev_amount;
+  decode_base10(prev_amount, prev_btc_amount, btc_decimal_places);
+  operation::list p2wpkh_operations {
+      operation(opcode::push_size_0),
+      operation(to_chunk(bitcoin_short_hash(pubkey_witness_aware)))
+  };
+  script prevout_script(p2wpkh_operations);
+
+  const auto tx = view.to_transaction();
+  auto ec = script::verify(tx, 0u, rule_fork::all_rules,
+      tx.inputs()[0].script(), tx.inputs()[0].witness(), prevout_script,
+      prev_amount);
+
+  // Prints success
+  std::cout << ec.message() << std::endl;
+
+}
+
+
+// Parse a block dump in the format of Bitcoin Core blk*.dat files:
+// [4-byte network magic] [4-byte block size] [block], repeated.
+void benchmark_block_dump(const std::string& path) {
+
+  const auto fd = ::open(path.c_str(), O_RDONLY);
+  struct stat status;
+  if (fd < 0 || ::fstat(fd, &status) != 0) {
+    std::cout << "cannot open " << path << std::endl;
+    return;
+  }
+
+  // The dump is mapped, not read: parsing touches the page cache directly.
+  const size_t file_size = status.st_size;
+  const auto mapped = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd,
+      0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    std::cout << "cannot map " << path << std::endl;
+    return;
+  }
+
+  const auto data = static_cast<const uint8_t*>(mapped);
+  transaction_view view;
+  size_t blocks = 0;
+  size_t transactions = 0;
+  size_t inputs = 0;
+  size_t outputs = 0;
+  size_t failures = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  size_t position = 0;
+  while (position + 8u <= file_size) {
+    const auto block_size = from_little_endian_unsafe<uint32_t>(
+        data + position + 4u);
+    position += 8u;
+
+    // Skip zero padding at the end of preallocated blk files.
+    if (block_size == 0 || position + block_size > file_size)
+      break;
+
+    // 80-byte header, then the transaction count.
+    const auto block_end = data + position + block_size;
+    auto cursor = data + position + 80u;
+    uint64_t count;
+    if (cursor > block_end || !read_compact_size(cursor, block_end, count))
+      break;
+
+    for (uint64_t index = 0; index < count && cursor < block_end; index++) {
+      if (!view.parse(cursor, block_end - cursor)) {
+        failures++;
+        break;
+      }
+
+      inputs += view.input_count();
+      outputs += view.output_count();
+      cursor += view.serialized_size(true);
+      transactions++;
+    }
+
+    position += block_size;
+    blocks++;
+  }
+
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+  ::munmap(mapped, file_size);
+
+  std::cout << "bytes:        " << file_size << std::endl;
+  std::cout << "blocks:       " << blocks << std::endl;
+  std::cout << "transactions: " << transactions << std::endl;
+  std::cout << "inputs:       " << inputs << std::endl;
+  std::cout << "outputs:      " << outputs << std::endl;
+  std::cout << "failures:     " << failures << std::endl;
+  std::cout << "milliseconds: " << elapsed << std::endl;
+  if (elapsed > 0)
+    std::cout << "MB/s:         " << (file_size / 1000) / elapsed
+              << std::endl;
+
+}
+
+
+// Compare view indexing with transaction deserialisation on one transaction.
+void benchmark_view_against_deserialisation(
+    const transaction& example_transaction) {
+
+  const auto raw = example_transaction.to_data(true, true);
+  const size_t iterations = 1000000;
+  transaction_view view;
+  size_t checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < iterations; index++) {
+    view.parse(raw.data(), raw.size());
+    checksum += view.output_count();
+  }
+  const auto view_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < iterations; index++) {
+    transaction tx;
+    tx.from_data(raw, true, true);
+    checksum += tx.outputs().size();
+  }
+  const auto object_time = std::chrono::steady_clock::now() - start;
+
+  std::cout << "transaction_view:        "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                view_time).count() / iterations << " ns/tx" << std::endl;
+  std::cout << "transaction::from_data:  "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                object_time).count() / iterations << " ns/tx" << std::endl;
+  std::cout << (checksum == 2 * iterations) << std::endl;
+
+}
+
+
+int main(int argc, char* argv[]) {
+
+  auto tx = create_example_transaction();
+
+  parse_transaction_view(tx);
+
+  benchmark_view_against_deserialisation(tx);
+
+  // Optional: path to a blk*.dat style block dump (e.g. 1GB).
+  if (argc > 1)
+    benchmark_block_dump(argv[1]);
+
+  return 0;
+
+}
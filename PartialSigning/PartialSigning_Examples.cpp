@@ -0,0 +1,619 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// Sighash type bits.
+constexpr uint8_t sighash_mask = 0x1f;
+
+
+// Legacy signature hash context.
+//-----------------------------------------------------------------------------
+
+// Signature hash of SIGHASH_SINGLE without a matching output (consensus bug).
+const hash_digest legacy_one_hash {{
+    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+}};
+
+// Serialised size of an input with an empty script: outpoint, 0x00, sequence.
+constexpr size_t empty_input_size = 36u + 1u + 4u;
+
+// Serialised size of a null output: value 0xffffffffffffffff, empty script.
+constexpr size_t null_output_size = 8u + 1u;
+
+// Caches the serialised parts of the legacy signature hash preimage which do
+// not depend on the signed input:
+//    inputs with empty scripts (sequences as is, and zeroed for NONE/SINGLE)
+//    all outputs (ALL), null outputs preceding the signed index (SINGLE)
+// A preimage is then assembled from these parts by copying, rather than by
+// building and reserialising a modified copy of the transaction per input.
+// Immutable after construction, so it may be shared between threads, each
+// passing its own scratch buffer.
+class legacy_sighash_context {
+
+public:
+  explicit legacy_sighash_context(const transaction& tx)
+    : tx_(tx) {
+
+    const auto& inputs = tx.inputs();
+    const auto& outputs = tx.outputs();
+
+    // Inputs with empty scripts, with original and with zeroed sequences.
+    inputs_.resize(inputs.size() * empty_input_size);
+    zeroed_inputs_.resize(inputs.size() * empty_input_size);
+    auto sink = make_unsafe_serializer(inputs_.begin());
+    auto zeroed_sink = make_unsafe_serializer(zeroed_inputs_.begin());
+    for (const auto& input: inputs) {
+      input.previous_output().to_data(sink);
+      sink.write_byte(0x00);
+      sink.write_4_bytes_little_endian(input.sequence());
+      input.previous_output().to_data(zeroed_sink);
+      zeroed_sink.write_byte(0x00);
+      zeroed_sink.write_4_bytes_little_endian(0u);
+    }
+
+    // All outputs, including their count.
+    size_t outputs_size = variable_size(outputs.size());
+    for (const auto& output: outputs)
+      outputs_size += output.serialized_size();
+
+    outputs_.resize(outputs_size);
+    auto output_sink = make_unsafe_serializer(outputs_.begin());
+    output_sink.write_size_little_endian(outputs.size());
+    for (const auto& output: outputs)
+      output.to_data(output_sink);
+
+    // Null outputs, of which SINGLE uses those preceding the signed index.
+    null_outputs_.resize(outputs.size() * null_output_size);
+    auto null_sink = make_unsafe_serializer(null_outputs_.begin());
+    for (size_t index = 0; index < outputs.size(); index++) {
+      null_sink.write_8_bytes_little_endian(max_uint64);
+      null_sink.write_byte(0x00);
+    }
+  }
+
+  // Legacy signature hash of one input. The preimage is assembled in the
+  // scratch buffer, which keeps its capacity across calls.
+  hash_digest signature_hash(uint32_t input_index, const script& script_code,
+      uint8_t sighash_type, data_chunk& scratch) const {
+
+    const auto anyone = (sighash_type & sighash_algorithm::anyone_can_pay) != 0;
+    const auto type = sighash_type & sighash_mask;
+    const auto single = type == sighash_algorithm::single;
+    const auto none = type == sighash_algorithm::none;
+    const auto& inputs = tx_.inputs();
+    const auto& outputs = tx_.outputs();
+
+    if (input_index >= inputs.size() ||
+        (single && input_index >= outputs.size()))
+      return legacy_one_hash;
+
+    // Code separators are removed from the script code.
+    script stripped;
+    auto code = &script_code;
+    if (has_code_separator(script_code)) {
+      stripped = strip_code_separators(script_code);
+      code = &stripped;
+    }
+
+    const auto& input = inputs[input_index];
+    const auto& others = (single || none) ? zeroed_inputs_ : inputs_;
+    const auto input_count = anyone ? size_t(1) : inputs.size();
+
+    // Outputs section: all outputs, none, or null outputs and one output.
+    const auto outputs_size = none ? 1u : !single ? outputs_.size() :
+        variable_size(input_index + 1u) + input_index * null_output_size +
+        outputs[input_index].serialized_size();
+
+    const auto size = 4u + variable_size(input_count) +
+        (input_count - 1u) * empty_input_size + 36u +
+        code->serialized_size(true) + 4u + outputs_size + 4u + 4u;
+    scratch.resize(size);
+
+    auto sink = make_unsafe_serializer(scratch.begin());
+    sink.write_4_bytes_little_endian(tx_.version());
+    sink.write_size_little_endian(input_count);
+
+    // Inputs preceding the signed input.
+    const auto before = anyone ? 0u : input_index * empty_input_size;
+    sink.write_bytes(others.data(), before);
+
+    // Signed input, with script code and its own sequence.
+    input.previous_output().to_data(sink);
+    code->to_data(sink, true);
+    sink.write_4_bytes_little_endian(input.sequence());
+
+    // Inputs following the signed input.
+    const auto after = anyone ? others.size() : before + empty_input_size;
+    sink.write_bytes(others.data() + after, others.size() - after);
+
+    if (none) {
+      sink.write_byte(0x00);
+    } else if (!single) {
+      sink.write_bytes(outputs_);
+    } else {
+      sink.write_size_little_endian(input_index + 1u);
+      sink.write_bytes(null_outputs_.data(), input_index * null_output_size);
+      outputs[input_index].to_data(sink);
+    }
+
+    sink.write_4_bytes_little_endian(tx_.locktime());
+    sink.write_4_bytes_little_endian(sighash_type);
+    return bitcoin_hash(scratch);
+  }
+
+private:
+  static size_t variable_size(uint64_t value) {
+    return value < 0xfd ? 1u : value <= 0xffff ? 3u :
+        value <= 0xffffffff ? 5u : 9u;
+  }
+
+  static bool has_code_separator(const script& script_code) {
+    for (const auto& op: script_code.operations())
+      if (op.code() == opcode::codeseparator)
+        return true;
+
+    return false;
+  }
+
+  static script strip_code_separators(const script& script_code) {
+    operation::list operations;
+    for (const auto& op: script_code.operations())
+      if (op.code() != opcode::codeseparator)
+        operations.push_back(op);
+
+    return script(operations);
+  }
+
+  const transaction& tx_;
+  data_chunk inputs_;
+  data_chunk zeroed_inputs_;
+  data_chunk outputs_;
+  data_chunk null_outputs_;
+};
+
+
+
+// Partially signed transaction.
+//-----------------------------------------------------------------------------
+
+// Returns the secret for a locking script, e.g. by its public key hash.
+using key_provider = std::function<bool(ec_secret&, const script&)>;
+
+// Transaction under construction by several signers, with P2PKH inputs.
+// Each signature is recorded with its sighash type, which determines the
+// parts of the transaction it commits to:
+//
+//    | Type         | Inputs               | Sequences  | Outputs          |
+//    |--------------|----------------------|------------|------------------|
+//    | ALL          | all                  | all        | all              |
+//    | NONE         | all                  | own        | none             |
+//    | SINGLE       | all                  | own        | own index        |
+//    | ANYONECANPAY | own                  | own        | (as above)       |
+//
+// A change to the transaction only marks those signatures stale which
+// committed to the changed part. The signature hash context is rebuilt
+// lazily, once for all signatures made after a batch of changes.
+class partial_transaction {
+
+public:
+  explicit partial_transaction(uint32_t version=1u, uint32_t locktime=0u)
+    : dirty_(true), sighashes_(0) {
+    tx_.set_version(version);
+    tx_.set_locktime(locktime);
+  }
+
+  partial_transaction(const partial_transaction&) = delete;
+  partial_transaction& operator=(const partial_transaction&) = delete;
+
+  const transaction& tx() const {
+    return tx_;
+  }
+
+  // Number of signature hashes computed so far.
+  size_t sighashes() const {
+    return sighashes_;
+  }
+
+  // Adds an unsigned input spending a P2PKH output.
+  // Signatures which commit to all inputs become stale.
+  uint32_t add_input(const output_point& previous_output,
+      const script& previous_script,
+      uint32_t sequence=max_input_sequence) {
+
+    input new_input;
+    new_input.set_previous_output(previous_output);
+    new_input.set_sequence(sequence);
+    tx_.inputs().push_back(new_input);
+    previous_scripts_.push_back(previous_script);
+    records_.push_back(signature_record());
+
+    invalidate([](uint32_t, uint8_t type) {
+      return !anyone_can_pay(type);
+    });
+
+    return static_cast<uint32_t>(tx_.inputs().size() - 1u);
+  }
+
+  // Adds an output. Signatures which commit to all outputs become stale,
+  // as does a SINGLE signature of the same index, which previously committed
+  // to the absence of its output.
+  uint32_t add_output(const output& new_output) {
+
+    const auto index = static_cast<uint32_t>(tx_.outputs().size());
+    tx_.outputs().push_back(new_output);
+
+    invalidate([index](uint32_t input_index, uint8_t type) {
+      return commits_to_all_outputs(type) ||
+          (base_type(type) == sighash_algorithm::single &&
+          input_index == index);
+    });
+
+    return index;
+  }
+
+  // The own sequence is committed to by every signature, the sequences of
+  // other inputs only by ALL without ANYONECANPAY.
+  void set_sequence(uint32_t index, uint32_t sequence) {
+
+    tx_.inputs()[index].set_sequence(sequence);
+
+    invalidate([index](uint32_t input_index, uint8_t type) {
+      return input_index == index || (!anyone_can_pay(type) &&
+          commits_to_all_outputs(type));
+    });
+  }
+
+  // Version and locktime are committed to by every signature.
+  void set_locktime(uint32_t locktime) {
+    tx_.set_locktime(locktime);
+    invalidate([](uint32_t, uint8_t) { return true; });
+  }
+
+  // Signs an input, replacing any previous signature of the input.
+  bool sign(uint32_t index, const ec_secret& secret, uint8_t sighash_type) {
+
+    auto& record = records_[index];
+    if (!secret_to_public(record.point, secret))
+      return false;
+
+    const auto sighash = context().signature_hash(index,
+        previous_scripts_[index], sighash_type, scratch_);
+    sighashes_++;
+
+    ec_signature signature;
+    record.sig.clear();
+    if (!sign_digest(signature, secret, sighash) ||
+        !encode_signature(record.sig, signature))
+      return false;
+
+    record.sig.push_back(sighash_type);
+    record.sighash_type = sighash_type;
+    record.has_signature = true;
+    record.stale = false;
+    return true;
+  }
+
+  // Inputs with a stale signature, which must be signed again.
+  std::vector<uint32_t> stale_inputs() const {
+    std::vector<uint32_t> stale;
+    for (uint32_t index = 0; index < records_.size(); index++)
+      if (records_[index].has_signature && records_[index].stale)
+        stale.push_back(index);
+
+    return stale;
+  }
+
+  // Re-signs stale inputs with their original sighash type, for those
+  // inputs the provider has a key. Returns the number of inputs re-signed.
+  size_t resign(const key_provider& keys) {
+    size_t count = 0;
+    for (const auto index: stale_inputs()) {
+      ec_secret secret;
+      if (keys(secret, previous_scripts_[index]) &&
+          sign(index, secret, records_[index].sighash_type))
+        count++;
+    }
+
+    return count;
+  }
+
+  // Copies the transaction with [signature] [public key] input scripts.
+  // Fails if an input is unsigned or its signature is stale.
+  bool finalize(transaction& out) const {
+    out = tx_;
+    for (uint32_t index = 0; index < records_.size(); index++) {
+      const auto& record = records_[index];
+      if (!record.has_signature || record.stale)
+        return false;
+
+      operation::list sig_script;
+      sig_script.push_back(operation(record.sig));
+      sig_script.push_back(operation(to_chunk(record.point)));
+      out.inputs()[index].set_script(script(sig_script));
+    }
+
+    return true;
+  }
+
+private:
+  struct signature_record {
+    signature_record()
+      : has_signature(false), stale(false), sighash_type(0) {
+    }
+
+    bool has_signature;
+    bool stale;
+    uint8_t sighash_type;
+    endorsement sig;
+    ec_compressed point;
+  };
+
+  static bool anyone_can_pay(uint8_t type) {
+    return (type & sighash_algorithm::anyone_can_pay) != 0;
+  }
+
+  static uint8_t base_type(uint8_t type) {
+    return type & sighash_mask;
+  }
+
+  // Every base type other than NONE and SINGLE, such as 0x00 or 0x04, is
+  // treated as ALL by consensus.
+  static bool commits_to_all_outputs(uint8_t type) {
+    return base_type(type) != sighash_algorithm::none &&
+        base_type(type) != sighash_algorithm::single;
+  }
+
+  // sign() of the library, which is hidden by the member function.
+  static bool sign_digest(ec_signature& out, const ec_secret& secret,
+      const hash_digest& sighash) {
+    return bc::sign(out, secret, sighash);
+  }
+
+  // Marks signatures stale for which committed(index, type) is true.
+  template <typename Predicate>
+  void invalidate(Predicate committed) {
+    dirty_ = true;
+    for (uint32_t index = 0; index < records_.size(); index++) {
+      auto& record = records_[index];
+      if (record.has_signature && committed(index, record.sighash_type))
+        record.stale = true;
+    }
+  }
+
+  const legacy_sighash_context& context() {
+    if (dirty_) {
+      context_.reset(new legacy_sighash_context(tx_));
+      dirty_ = false;
+    }
+
+    return *context_;
+  }
+
+  transaction tx_;
+  std::vector<script> previous_scripts_;
+  std::vector<signature_record> records_;
+  std::unique_ptr<legacy_sighash_context> context_;
+  data_chunk scratch_;
+  bool dirty_;
+  size_t sighashes_;
+};
+
+
+// Coinjoin-style rounds.
+//-----------------------------------------------------------------------------
+
+// Participant of a round, with one input and one output.
+struct participant {
+  ec_secret secret;
+  ec_compressed point;
+  output_point previous_output;
+  uint64_t amount;
+};
+
+
+std::vector<participant> create_participants(size_t count) {
+
+  std::string prev_tx =
+      "e964ed0883933ae8f3f53139efef149b0cedb7895a040cab3b64e792acd11412";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+
+  std::vector<participant> participants(count);
+  for (uint32_t index = 0; index < count; index++) {
+    auto& member = participants[index];
+    member.secret = bitcoin_hash(to_little_endian(index));
+    secret_to_public(member.point, member.secret);
+    member.previous_output = output_point(prev_tx_hash, index);
+    member.amount = 10000000u;
+  }
+
+  return participants;
+
+}
+
+
+key_provider participant_keys(const std::vector<participant>& participants) {
+
+  auto keys = std::make_shared<std::map<short_hash, ec_secret>>();
+  for (const auto& member: participants)
+    (*keys)[bitcoin_short_hash(member.point)] = member.secret;
+
+  return [keys](ec_secret& out, const script& previous_script) {
+    const auto& operations = previous_script.operations();
+    if (!script::is_pay_key_hash_pattern(operations))
+      return false;
+
+    const auto it = keys->find(to_array<short_hash_size>(
+        operations[2].data()));
+    if (it == keys->end())
+      return false;
+
+    out = it->second;
+    return true;
+  };
+
+}
+
+
+// Participants join one after another, each adding an input and an output
+// and signing its input with the given type. Stale signatures are re-signed
+// after every join.
+void run_round(partial_transaction& round,
+    const std::vector<participant>& participants, uint8_t sighash_type) {
+
+  const auto keys = participant_keys(participants);
+  for (const auto& member: participants) {
+    const auto key_hash = bitcoin_short_hash(member.point);
+    const script previous_script(script::to_pay_key_hash_pattern(key_hash));
+
+    const auto index = round.add_input(member.previous_output,
+        previous_script);
+    round.add_output(output(member.amount - 1000u, previous_script));
+    round.resign(keys);
+    round.sign(index, member.secret, sighash_type);
+  }
+
+}
+
+
+void partial_signing_example() {
+
+  const auto participants = create_participants(4u);
+  const auto keys = participant_keys(participants);
+
+  // NONE (example_2): outputs may be added after signing.
+  partial_transaction none_round;
+  run_round(none_round, participants, sighash_algorithm::none);
+  std::cout << none_round.sighashes() << std::endl;    // Prints 10.
+
+  // Adding an output invalidates no signature.
+  none_round.add_output(output(5000u, script(
+      script::to_pay_key_hash_pattern(bitcoin_short_hash(participants[0]
+      .point)))));
+  std::cout << none_round.stale_inputs().size() << std::endl; // Prints 0.
+
+  // Changing the sequence of input 2 only invalidates its own signature.
+  none_round.set_sequence(2u, 0xfffffffe);
+  std::cout << none_round.stale_inputs().size() << std::endl; // Prints 1.
+  std::cout << none_round.resign(keys) << std::endl;          // Prints 1.
+
+  // SINGLE|ANYONECANPAY: joins invalidate no signature of other inputs.
+  partial_transaction single_round;
+  run_round(single_round, participants,
+      sighash_algorithm::single | sighash_algorithm::anyone_can_pay);
+  std::cout << single_round.sighashes() << std::endl; // Prints 4.
+
+  // ALL: every join invalidates every previous signature.
+  partial_transaction all_round;
+  run_round(all_round, participants, sighash_algorithm::all);
+  std::cout << all_round.sighashes() << std::endl;   // Prints 10.
+
+  // Finalised transactions verify, and are identical to transactions signed
+  // from scratch with script::create_endorsement().
+  for (auto round: { &none_round, &single_round, &all_round }) {
+    transaction tx;
+    std::cout << round->finalize(tx) << std::endl;
+
+    auto reference = round->tx();
+    for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+      const auto& member = participants[index];
+      const script previous_script(script::to_pay_key_hash_pattern(
+          bitcoin_short_hash(member.point)));
+      const auto sighash_type = tx.inputs()[index].script().operations()[0]
+          .data().back();
+
+      endorsement sig;
+      script::create_endorsement(sig, member.secret, previous_script,
+          round->tx(), index, sighash_type);
+      operation::list sig_script;
+      sig_script.push_back(operation(sig));
+      sig_script.push_back(operation(to_chunk(member.point)));
+      reference.inputs()[index].set_script(script(sig_script));
+
+      const auto ec = script::verify(tx, index, rule_fork::all_rules,
+          previous_script, member.amount);
+      std::cout << ec.message() << std::endl;
+    }
+
+    std::cout << (tx.to_data() == reference.to_data()) << std::endl;
+  }
+
+}
+
+
+void benchmark_partial_signing(size_t participant_count) {
+
+  const auto participants = create_participants(participant_count);
+  const auto keys = participant_keys(participants);
+  const uint8_t sighash_type =
+      sighash_algorithm::single | sighash_algorithm::anyone_can_pay;
+
+  // Without tracking: all inputs are signed again after every join.
+  auto start = std::chrono::steady_clock::now();
+  transaction tx;
+  tx.set_version(1u);
+  size_t full_sighashes = 0;
+  for (const auto& member: participants) {
+    const script previous_script(script::to_pay_key_hash_pattern(
+        bitcoin_short_hash(member.point)));
+    input new_input;
+    new_input.set_previous_output(member.previous_output);
+    new_input.set_sequence(max_input_sequence);
+    tx.inputs().push_back(new_input);
+    tx.outputs().push_back(output(member.amount - 1000u, previous_script));
+
+    for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+      ec_secret secret;
+      const script signer_script(script::to_pay_key_hash_pattern(
+          bitcoin_short_hash(participants[index].point)));
+      keys(secret, signer_script);
+
+      endorsement sig;
+      script::create_endorsement(sig, secret, signer_script, tx, index,
+          sighash_type);
+      full_sighashes++;
+    }
+  }
+  const auto full_time = std::chrono::steady_clock::now() - start;
+
+  // Tracked: only stale signatures are signed again.
+  start = std::chrono::steady_clock::now();
+  partial_transaction round;
+  run_round(round, participants, sighash_type);
+  const auto tracked_time = std::chrono::steady_clock::now() - start;
+
+  const auto milliseconds = [](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time)
+        .count();
+  };
+
+  std::cout << "participants: " << participant_count << std::endl;
+  std::cout << "  re-sign all:        " << full_sighashes << " signatures, "
+            << milliseconds(full_time) << " ms" << std::endl;
+  std::cout << "  partial_transaction: " << round.sighashes()
+            << " signatures, " << milliseconds(tracked_time) << " ms"
+            << std::endl;
+
+}
+
+
+int main() {
+
+  partial_signing_example();
+
+  benchmark_partial_signing(20);
+  benchmark_partial_signing(100);
+
+  return 0;
+
+}
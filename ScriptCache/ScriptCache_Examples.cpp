@@ -0,0 +1,531 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Witness Aware" wallets.
+auto my_secret_witness_aware = base16_literal(
+    "0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+ec_private my_private_witness_aware(my_secret_witness_aware,
+    ec_private::testnet, true);
+auto pubkey_witness_aware = my_private_witness_aware.to_public().point();
+
+auto my_secret_witness_aware1 = base16_literal(
+    "2361b894dab5c45c3c448eb4ab65f847cb3000e05969f18c94b8850233a95b74");
+ec_private my_private_witness_aware1(my_secret_witness_aware1,
+    ec_private::testnet, true);
+auto pubkey_witness_aware1 = my_private_witness_aware1.to_public().point();
+
+auto my_secret_witness_aware2 = base16_literal(
+    "87493c67155f44a9a9a6abf621926a407121d6f4e1e94c75ced61208d7abe9db");
+ec_private my_private_witness_aware2(my_secret_witness_aware2,
+    ec_private::testnet, true);
+auto pubkey_witness_aware2 = my_private_witness_aware2.to_public().point();
+
+
+// Compiled scripts.
+//-----------------------------------------------------------------------------
+
+// One operation of a script, as a position in the serialised script.
+struct instruction {
+  opcode code;
+  uint32_t offset;    // Offset of the push data, or of the next opcode.
+  uint32_t size;      // Size of the push data, zero for other opcodes.
+};
+
+
+// Reads the instructions of a serialised script without allocation.
+// Returns false if a push extends beyond the end of the script.
+bool decode_instructions(std::vector<instruction>& out,
+    const data_chunk& bytes) {
+
+  const auto push_data_1 = static_cast<uint8_t>(opcode::push_one_size);
+  const auto push_data_2 = static_cast<uint8_t>(opcode::push_two_size);
+  const auto push_data_4 = static_cast<uint8_t>(opcode::push_four_size);
+  const auto end = bytes.size();
+  size_t position = 0;
+  out.clear();
+
+  while (position < end) {
+    const auto value = bytes[position++];
+    size_t size = 0;
+
+    if (value < push_data_1) {
+      size = value;
+    } else if (value <= push_data_4) {
+      const size_t prefix = value == push_data_1 ? 1u :
+          value == push_data_2 ? 2u : 4u;
+      if (prefix > end - position)
+        return false;
+
+      for (size_t index = 0; index < prefix; index++)
+        size |= static_cast<size_t>(bytes[position + index]) << (8u * index);
+      position += prefix;
+    }
+
+    if (size > end - position)
+      return false;
+
+    out.push_back({ static_cast<opcode>(value),
+        static_cast<uint32_t>(position), static_cast<uint32_t>(size) });
+    position += size;
+  }
+
+  return true;
+
+}
+
+
+// A script decoded once, for repeated evaluation.
+// The instructions refer to the original bytes, and answer questions about
+// the script, such as its signature operations, without the operation list.
+// The parsed script is kept alongside, since program evaluates operations.
+class compiled_script {
+
+public:
+  typedef std::shared_ptr<const compiled_script> ptr;
+
+  // Returns nullptr if the script does not parse.
+  static ptr compile(const data_chunk& bytes) {
+    std::shared_ptr<compiled_script> compiled(new compiled_script(bytes));
+    if (!decode_instructions(compiled->instructions_, compiled->bytes_))
+      return nullptr;
+
+    compiled->script_.from_data(compiled->bytes_, false);
+    return compiled;
+  }
+
+  const data_chunk& bytes() const {
+    return bytes_;
+  }
+
+  const std::vector<instruction>& instructions() const {
+    return instructions_;
+  }
+
+  const script& decoded() const {
+    return script_;
+  }
+
+  data_slice push_data(const instruction& entry) const {
+    const auto begin = bytes_.data() + entry.offset;
+    return data_slice(begin, begin + entry.size);
+  }
+
+  // Signature operations, with the key count of multisig scripts.
+  size_t signature_operations() const {
+    const auto push_1 = static_cast<uint8_t>(opcode::push_positive_1);
+    const auto push_16 = static_cast<uint8_t>(opcode::push_positive_16);
+    size_t count = 0;
+    auto previous = opcode::push_size_0;
+
+    for (const auto& entry: instructions_) {
+      const auto value = static_cast<uint8_t>(previous);
+      switch (entry.code) {
+        case opcode::checksig:
+        case opcode::checksigverify:
+          count++;
+          break;
+        case opcode::checkmultisig:
+        case opcode::checkmultisigverify:
+          count += value >= push_1 && value <= push_16 ?
+              value - push_1 + 1u : max_script_public_keys;
+          break;
+        default:
+          break;
+      }
+      previous = entry.code;
+    }
+
+    return count;
+  }
+
+private:
+  explicit compiled_script(const data_chunk& bytes)
+    : bytes_(bytes) {
+  }
+
+  data_chunk bytes_;
+  std::vector<instruction> instructions_;
+  script script_;
+};
+
+
+// Script cache.
+//-----------------------------------------------------------------------------
+
+// Keys are sha256 hashes, so any eight bytes are uniformly distributed.
+struct script_hash_hasher {
+  size_t operator()(const hash_digest& key) const {
+    return static_cast<size_t>(from_little_endian_unsafe<uint64_t>(
+        key.begin()));
+  }
+};
+
+
+// Compiled scripts by sha256 of the serialised script, with least recently
+// used eviction. Safe for use by several verification threads. A cache of
+// zero capacity stores nothing and compiles every script it is asked for.
+class script_cache {
+
+public:
+  explicit script_cache(size_t capacity)
+    : capacity_(capacity), hits_(0), misses_(0) {
+  }
+
+  // The key is sha256(bytes). A P2WSH witness program is this hash of the
+  // witness script, so on a hit the script is compared instead of hashed.
+  // Returns nullptr if the bytes do not parse or do not match the key.
+  compiled_script::ptr find_or_compile(const hash_digest& key,
+      const data_chunk& bytes) {
+    return find_or_compile(key, bytes, false);
+  }
+
+  compiled_script::ptr find_or_compile(const data_chunk& bytes) {
+    return find_or_compile(sha256_hash(bytes), bytes, true);
+  }
+
+  size_t hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+  }
+
+  size_t misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+private:
+  compiled_script::ptr find_or_compile(const hash_digest& key,
+      const data_chunk& bytes, bool hashed) {
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const auto found = entries_.find(key);
+      if (found != entries_.end()) {
+        hits_++;
+        order_.splice(order_.begin(), order_, found->second.position);
+        const auto& compiled = found->second.compiled;
+        return compiled->bytes() == bytes ? compiled : nullptr;
+      }
+
+      misses_++;
+    }
+
+    // Hashed and compiled outside of the lock, another thread may insert the
+    // same script first.
+    if (!hashed && sha256_hash(bytes) != key)
+      return nullptr;
+
+    const auto compiled = compiled_script::compile(bytes);
+    if (!compiled)
+      return nullptr;
+
+    if (capacity_ == 0)
+      return compiled;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.find(key) != entries_.end())
+      return compiled;
+
+    if (entries_.size() == capacity_) {
+      entries_.erase(order_.back());
+      order_.pop_back();
+    }
+
+    order_.push_front(key);
+    entries_.emplace(key, entry{ compiled, order_.begin() });
+    return compiled;
+  }
+
+  struct entry {
+    compiled_script::ptr compiled;
+    std::list<hash_digest>::iterator position;
+  };
+
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  std::unordered_map<hash_digest, entry, script_hash_hasher> entries_;
+  std::list<hash_digest> order_;
+  size_t hits_;
+  size_t misses_;
+};
+
+
+// Cached verification.
+//-----------------------------------------------------------------------------
+
+// Runs all operations of a program, as debug_program() of the script machine
+// examples without printing.
+code run_program(program& current_program) {
+
+  if (!current_program.is_valid())
+    return error::invalid_script;
+
+  for (const auto& op: current_program) {
+    if (op.is_oversized())
+      return error::invalid_push_data_size;
+
+    if (op.is_disabled())
+      return error::op_disabled;
+
+    if (!current_program.increment_operation_count(op))
+      return error::invalid_operation_count;
+
+    if (current_program.if_(op)) {
+      if (current_program.is_stack_overflow())
+        return error::invalid_stack_size;
+
+      const auto ec = current_program.evaluate(op);
+      if (ec)
+        return ec;
+    }
+  }
+
+  return current_program.closed() ? error::success :
+      error::invalid_stack_scope;
+
+}
+
+
+// Version 0 P2WSH input, with the witness script taken from the cache.
+// Without bip141 and bip143 the input is not verified as a witness input,
+// so it is passed to script::verify().
+code verify_p2wsh(const transaction& tx, uint32_t input_index,
+    uint32_t forks, const script& prevout_script, uint64_t value,
+    script_cache& cache) {
+
+  const auto& input = tx.inputs()[input_index];
+  const auto& stack = input.witness().stack();
+
+  if (!(forks & rule_fork::bip141_rule) || !(forks & rule_fork::bip143_rule))
+    return script::verify(tx, input_index, forks, input.script(),
+        input.witness(), prevout_script, value);
+
+  if (!script::is_witness_program_pattern(prevout_script.operations()) ||
+      prevout_script.version() != script_version::zero ||
+      prevout_script[1].data().size() != hash_size)
+    return error::invalid_witness;
+
+  if (!input.script().empty())
+    return error::dirty_witness;
+
+  if (stack.empty())
+    return error::invalid_witness;
+
+  // The witness program is sha256(witness script), the cache key.
+  hash_digest key;
+  const auto& program_data = prevout_script[1].data();
+  std::copy(program_data.begin(), program_data.end(), key.begin());
+
+  const auto compiled = cache.find_or_compile(key, stack.back());
+  if (!compiled)
+    return error::invalid_witness;
+
+  data_stack witness_stack(stack.begin(), stack.end() - 1);
+  program witness_program(compiled->decoded(), tx, input_index, forks,
+      std::move(witness_stack), value, script_version::zero);
+
+  const auto ec = run_program(witness_program);
+  if (ec)
+    return ec;
+
+  return witness_program.stack_result(true) ? error::success :
+      error::stack_false;
+
+}
+
+
+// Signed spend of one input, with its previous output.
+struct p2wsh_spend {
+  transaction tx;
+  script prevout_script;
+  uint64_t value;
+};
+
+
+// Spends of outputs to one 2-of-3 multisig witness script, e.g. of a hot
+// wallet which receives many payments.
+std::vector<p2wsh_spend> create_p2wsh_spends(size_t count) {
+
+  const uint64_t value = 129500000u;
+  const script witness_script(script::to_pay_multisig_pattern(2u,
+      point_list {
+          pubkey_witness_aware,
+          pubkey_witness_aware1,
+          pubkey_witness_aware2
+      }));
+  const auto witness_script_data = witness_script.to_data(false);
+  const script prevout_script(operation::list {
+      operation(opcode::push_size_0),
+      operation(to_chunk(sha256_hash(witness_script_data)))
+  });
+  const script output_script(script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey_witness_aware)));
+
+  std::vector<p2wsh_spend> spends;
+  spends.reserve(count);
+  hash_digest prev_tx_hash = null_hash;
+
+  for (size_t index = 0; index < count; index++) {
+    prev_tx_hash[0] = static_cast<uint8_t>(index);
+    prev_tx_hash[1] = static_cast<uint8_t>(index >> 8u);
+
+    input p2wsh_input;
+    p2wsh_input.set_previous_output(output_point(prev_tx_hash, 0u));
+    p2wsh_input.set_sequence(max_input_sequence);
+
+    transaction tx;
+    tx.set_version(1u);
+    tx.inputs().push_back(p2wsh_input);
+    tx.outputs().push_back(output(value - 300000u, output_script));
+    tx.set_locktime(0u);
+
+    endorsement sig0;
+    endorsement sig1;
+    script::create_endorsement(sig0, my_secret_witness_aware, witness_script,
+        tx, 0u, sighash_algorithm::all, script_version::zero, value);
+    script::create_endorsement(sig1, my_secret_witness_aware1,
+        witness_script, tx, 0u, sighash_algorithm::all, script_version::zero,
+        value);
+    tx.inputs()[0].set_witness(witness(data_stack {
+        data_chunk(),
+        sig0,
+        sig1,
+        witness_script_data
+    }));
+
+    spends.push_back({ tx, prevout_script, value });
+  }
+
+  return spends;
+
+}
+
+
+void cached_verification_example() {
+
+  script_cache cache(1024u);
+  const auto spends = create_p2wsh_spends(3u);
+
+  // The witness script is compiled once and found twice.
+  for (const auto& spend: spends) {
+
+    // Prints success
+    std::cout << verify_p2wsh(spend.tx, 0u, rule_fork::all_rules,
+        spend.prevout_script, spend.value, cache).message() << std::endl;
+  }
+
+  std::cout << "hits: " << cache.hits() << ", misses: " << cache.misses()
+            << std::endl;
+
+  // Instructions of the cached witness script.
+  const auto compiled = cache.find_or_compile(
+      spends[0].tx.inputs()[0].witness().stack().back());
+  for (const auto& entry: compiled->instructions())
+    std::cout << opcode_to_string(entry.code, rule_fork::all_rules) << " "
+              << encode_base16(compiled->push_data(entry)) << std::endl;
+
+  // Prints 2 (two keys of the multisig script, not the default of 20).
+  std::cout << compiled->signature_operations() << std::endl;
+
+  // A witness script which does not match the witness program.
+  auto tampered = spends[1];
+  auto stack = tampered.tx.inputs()[0].witness().stack();
+  stack.back().back() = static_cast<uint8_t>(opcode::checkmultisigverify);
+  tampered.tx.inputs()[0].set_witness(witness(stack));
+
+  // Prints the invalid witness error, as does script::verify().
+  std::cout << verify_p2wsh(tampered.tx, 0u, rule_fork::all_rules,
+      tampered.prevout_script, tampered.value, cache).message() << std::endl;
+
+}
+
+
+void benchmark_script_cache(size_t count) {
+
+  const auto spends = create_p2wsh_spends(count);
+  const auto forks = rule_fork::all_rules;
+  const auto& witness_script_data =
+      spends[0].tx.inputs()[0].witness().stack().back();
+  script_cache cache(1024u);
+  size_t checksum = 0;
+
+  const auto per_item = [count](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+        .count() / static_cast<double>(count);
+  };
+
+  // Decoding: parse into an operation list each time.
+  auto start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < count; index++) {
+    script parsed(witness_script_data, false);
+    checksum += parsed.size();
+  }
+  const auto parse_time = std::chrono::steady_clock::now() - start;
+
+  // Decoding: look up by witness program.
+  const auto& program_data = spends[0].prevout_script[1].data();
+  hash_digest key;
+  std::copy(program_data.begin(), program_data.end(), key.begin());
+  start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < count; index++)
+    checksum -= cache.find_or_compile(key, witness_script_data)->
+        decoded().size();
+  const auto lookup_time = std::chrono::steady_clock::now() - start;
+
+  // Verification: script::verify() parses the witness script of every input.
+  size_t failures = 0;
+  start = std::chrono::steady_clock::now();
+  for (const auto& spend: spends) {
+    const auto& input = spend.tx.inputs()[0];
+    failures += bool(script::verify(spend.tx, 0u, forks, input.script(),
+        input.witness(), spend.prevout_script, spend.value));
+  }
+  const auto verify_time = std::chrono::steady_clock::now() - start;
+
+  // Verification: the witness script is taken from the cache.
+  start = std::chrono::steady_clock::now();
+  for (const auto& spend: spends)
+    failures += bool(verify_p2wsh(spend.tx, 0u, forks, spend.prevout_script,
+        spend.value, cache));
+  const auto cached_time = std::chrono::steady_clock::now() - start;
+
+  std::cout << "parse witness script: " << per_item(parse_time) << " ns"
+            << std::endl;
+  std::cout << "cache lookup:         " << per_item(lookup_time) << " ns"
+            << std::endl;
+  std::cout << "script::verify():     " << per_item(verify_time) << " ns"
+            << std::endl;
+  std::cout << "verify_p2wsh():       " << per_item(cached_time) << " ns"
+            << std::endl;
+  std::cout << "hits: " << cache.hits() << ", misses: " << cache.misses()
+            << ", failures: " << failures << ", checksum: " << checksum
+            << std::endl;
+
+}
+
+
+int main() {
+
+  cached_verification_example();
+
+  benchmark_script_cache(2000);
+
+  return 0;
+
+}
@@ -0,0 +1,349 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Witness Aware" wallets.
+auto my_secret_witness_aware = base16_literal(
+    "0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+ec_private my_private_witness_aware(my_secret_witness_aware,
+    ec_private::testnet, true);
+auto pubkey_witness_aware = my_private_witness_aware.to_public().point();
+
+auto my_secret_witness_aware1 = base16_literal(
+    "2361b894dab5c45c3c448eb4ab65f847cb3000e05969f18c94b8850233a95b74");
+ec_private my_private_witness_aware1(my_secret_witness_aware1,
+    ec_private::testnet, true);
+auto pubkey_witness_aware1 = my_private_witness_aware1.to_public().point();
+
+auto my_secret_witness_aware2 = base16_literal(
+    "87493c67155f44a9a9a6abf621926a407121d6f4e1e94c75ced61208d7abe9db");
+ec_private my_private_witness_aware2(my_secret_witness_aware2,
+    ec_private::testnet, true);
+auto pubkey_witness_aware2 = my_private_witness_aware2.to_public().point();
+
+
+// Serialised sizes of standard output scripts (without size prefix).
+constexpr size_t p2pkh_script_size = 25u;
+constexpr size_t p2sh_script_size = 23u;
+constexpr size_t p2wpkh_script_size = 22u;
+constexpr size_t p2wsh_script_size = 34u;
+
+// m [n compressed public keys] n checkmultisig
+template <size_t Keys>
+struct multisig_script_size {
+  static constexpr size_t value = 1u + Keys * (1u + ec_compressed_size) + 2u;
+};
+
+// Opcode bytes used by the templates.
+constexpr uint8_t op_0 = static_cast<uint8_t>(opcode::push_size_0);
+constexpr uint8_t op_push_20 = static_cast<uint8_t>(opcode::push_size_20);
+constexpr uint8_t op_push_32 = static_cast<uint8_t>(opcode::push_size_32);
+constexpr uint8_t op_push_33 = static_cast<uint8_t>(opcode::push_size_33);
+constexpr uint8_t op_dup = static_cast<uint8_t>(opcode::dup);
+constexpr uint8_t op_hash160 = static_cast<uint8_t>(opcode::hash160);
+constexpr uint8_t op_equal = static_cast<uint8_t>(opcode::equal);
+constexpr uint8_t op_equalverify = static_cast<uint8_t>(opcode::equalverify);
+constexpr uint8_t op_checksig = static_cast<uint8_t>(opcode::checksig);
+constexpr uint8_t op_checkmultisig =
+    static_cast<uint8_t>(opcode::checkmultisig);
+
+// push_positive_1 ... push_positive_16.
+constexpr uint8_t op_positive(size_t value) {
+  return static_cast<uint8_t>(opcode::push_positive_1) +
+      static_cast<uint8_t>(value - 1u);
+}
+
+
+// Script builders.
+//-----------------------------------------------------------------------------
+
+// dup hash160 [20-byte hash160(public key)] equalverify checksig
+byte_array<p2pkh_script_size> to_p2pkh_script(const short_hash& hash) {
+  byte_array<p2pkh_script_size> out;
+  out[0] = op_dup;
+  out[1] = op_hash160;
+  out[2] = op_push_20;
+  std::copy(hash.begin(), hash.end(), out.begin() + 3);
+  out[23] = op_equalverify;
+  out[24] = op_checksig;
+  return out;
+}
+
+// hash160 [20-byte hash160(redeem script)] equal
+byte_array<p2sh_script_size> to_p2sh_script(const short_hash& hash) {
+  byte_array<p2sh_script_size> out;
+  out[0] = op_hash160;
+  out[1] = op_push_20;
+  std::copy(hash.begin(), hash.end(), out.begin() + 2);
+  out[22] = op_equal;
+  return out;
+}
+
+// 0 [20-byte hash160(public key)]
+byte_array<p2wpkh_script_size> to_p2wpkh_script(const short_hash& hash) {
+  byte_array<p2wpkh_script_size> out;
+  out[0] = op_0;
+  out[1] = op_push_20;
+  std::copy(hash.begin(), hash.end(), out.begin() + 2);
+  return out;
+}
+
+// 0 [32-byte sha256(witness script)]
+byte_array<p2wsh_script_size> to_p2wsh_script(const hash_digest& hash) {
+  byte_array<p2wsh_script_size> out;
+  out[0] = op_0;
+  out[1] = op_push_32;
+  std::copy(hash.begin(), hash.end(), out.begin() + 2);
+  return out;
+}
+
+// m [public key 1] ... [public key n] n checkmultisig
+// Signature and key counts are template parameters, so the script size and
+// the offset of every key are compile-time constants.
+template <size_t Signatures, size_t Keys>
+byte_array<multisig_script_size<Keys>::value> to_multisig_script(
+    const std::array<ec_compressed, Keys>& points) {
+
+  static_assert(Signatures >= 1u && Signatures <= Keys,
+      "invalid signature count");
+  static_assert(Keys <= 16u, "use explicit pushes above 16 keys");
+
+  byte_array<multisig_script_size<Keys>::value> out;
+  auto position = out.begin();
+  *position++ = op_positive(Signatures);
+  for (const auto& point: points) {
+    *position++ = op_push_33;
+    position = std::copy(point.begin(), point.end(), position);
+  }
+  *position++ = op_positive(Keys);
+  *position = op_checkmultisig;
+  return out;
+}
+
+
+// Write a complete output (value, script size, script) into a buffer.
+// All standard templates are smaller than 0xfd bytes, so the size prefix is
+// a single byte. Returns the number of bytes written.
+template <size_t Size>
+size_t write_output(uint8_t* buffer, uint64_t value,
+    const byte_array<Size>& script_bytes) {
+
+  static_assert(Size < 0xfd, "script size requires a multi-byte prefix");
+  auto sink = make_unsafe_serializer(buffer);
+  sink.write_8_bytes_little_endian(value);
+  sink.write_byte(static_cast<uint8_t>(Size));
+  sink.write_bytes(script_bytes.data(), Size);
+  return sizeof(uint64_t) + 1u + Size;
+}
+
+
+// Interoperability with the script type where it is still required.
+template <size_t Size>
+script to_script(const byte_array<Size>& script_bytes) {
+  return script(to_chunk(script_bytes), false);
+}
+
+
+void build_standard_scripts() {
+
+  const auto key_hash = bitcoin_short_hash(pubkey_witness_aware);
+
+  // P2PKH.
+  const auto p2pkh = to_p2pkh_script(key_hash);
+  const auto p2pkh_script = script(
+      script::to_pay_key_hash_pattern(key_hash));
+  std::cout << (to_chunk(p2pkh) == p2pkh_script.to_data(false)) << std::endl;
+
+  // P2WPKH, as built by hand in the witness examples.
+  const auto p2wpkh = to_p2wpkh_script(key_hash);
+  operation::list p2wpkh_operations;
+  p2wpkh_operations.push_back(operation(opcode::push_size_0));
+  p2wpkh_operations.push_back(operation(to_chunk(key_hash)));
+  std::cout << (to_chunk(p2wpkh) ==
+      script(p2wpkh_operations).to_data(false)) << std::endl;
+
+  // 2-of-3 multisig witness script.
+  const std::array<ec_compressed, 3> points {{
+      pubkey_witness_aware,
+      pubkey_witness_aware1,
+      pubkey_witness_aware2
+  }};
+  const auto multisig = to_multisig_script<2, 3>(points);
+  const auto multisig_script = script::to_pay_multisig_pattern(2u,
+      point_list(points.begin(), points.end()));
+  std::cout << (to_chunk(multisig) ==
+      script(multisig_script).to_data(false)) << std::endl;
+
+  // P2WSH(multisig).
+  const auto p2wsh = to_p2wsh_script(sha256_hash(multisig));
+  std::cout << encode_base16(p2wsh) << std::endl;
+
+  // P2SH(P2WPKH).
+  const auto p2sh_p2wpkh = to_p2sh_script(bitcoin_short_hash(p2wpkh));
+  std::cout << encode_base16(p2sh_p2wpkh) << std::endl;
+
+  // Output written straight into a buffer, e.g. of a transaction serializer.
+  uint8_t buffer[64];
+  const auto size = write_output(buffer, 129500000u, p2wsh);
+  const output p2wsh_output(129500000u, to_script(p2wsh));
+  std::cout << (data_chunk(buffer, buffer + size) == p2wsh_output.to_data())
+            << std::endl;
+
+}
+
+
+// Times building a script with the operation::list template and with the
+// byte array builder, then compares the full scripts of every iteration
+// outside of the timed loops. Returns false if any script differs.
+template <typename ListBuilder, typename BytesBuilder>
+bool time_script_builders(size_t iterations, ListBuilder build_list,
+    BytesBuilder build_bytes, std::chrono::steady_clock::duration& list_time,
+    std::chrono::steady_clock::duration& bytes_time) {
+
+  size_t checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < iterations; index++)
+    checksum += build_list(index).back();
+  list_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (size_t index = 0; index < iterations; index++)
+    checksum -= build_bytes(index).back();
+  bytes_time = std::chrono::steady_clock::now() - start;
+
+  auto equal = checksum == 0;
+  for (size_t index = 0; index < iterations && equal; index++) {
+    const auto list_bytes = build_list(index);
+    const auto array_bytes = build_bytes(index);
+    equal = list_bytes.size() == array_bytes.size() &&
+        std::equal(list_bytes.begin(), list_bytes.end(), array_bytes.begin());
+  }
+
+  return equal;
+
+}
+
+
+void benchmark_script_builders(size_t iterations) {
+
+  const std::array<ec_compressed, 3> points {{
+      pubkey_witness_aware,
+      pubkey_witness_aware1,
+      pubkey_witness_aware2
+  }};
+  const point_list point_list_copy(points.begin(), points.end());
+
+  // A different key or script hash in every iteration. The hashes are
+  // computed once, so that the timed loops only measure the builders.
+  const auto base_key_hash = bitcoin_short_hash(pubkey_witness_aware);
+  const auto base_script_hash = sha256_hash(pubkey_witness_aware);
+  const auto key_hash_of = [&base_key_hash](size_t index) {
+    auto key_hash = base_key_hash;
+    key_hash[0] = static_cast<uint8_t>(index);
+    key_hash[1] = static_cast<uint8_t>(index >> 8);
+    return key_hash;
+  };
+  const auto script_hash_of = [&base_script_hash](size_t index) {
+    auto script_hash = base_script_hash;
+    script_hash[0] = static_cast<uint8_t>(index);
+    script_hash[1] = static_cast<uint8_t>(index >> 8);
+    return script_hash;
+  };
+
+  const auto per_second = [iterations](
+      std::chrono::steady_clock::duration time) {
+    const auto nanoseconds =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+    return nanoseconds == 0 ? 0 : iterations * 1000000000ull / nanoseconds;
+  };
+
+  const auto report = [&per_second](const std::string& name,
+      std::chrono::steady_clock::duration list_time,
+      std::chrono::steady_clock::duration bytes_time) {
+    std::cout << name << " operation::list: " << per_second(list_time)
+              << " scripts/s" << std::endl;
+    std::cout << name << " byte_array:      " << per_second(bytes_time)
+              << " scripts/s" << std::endl;
+  };
+
+  std::chrono::steady_clock::duration list_time, bytes_time;
+  auto equal = true;
+
+  // P2PKH.
+  equal &= time_script_builders(iterations,
+      [&](size_t index) {
+        return script(script::to_pay_key_hash_pattern(key_hash_of(index)))
+            .to_data(false);
+      },
+      [&](size_t index) { return to_p2pkh_script(key_hash_of(index)); },
+      list_time, bytes_time);
+  report("p2pkh   ", list_time, bytes_time);
+
+  // P2SH.
+  equal &= time_script_builders(iterations,
+      [&](size_t index) {
+        return script(script::to_pay_script_hash_pattern(key_hash_of(index)))
+            .to_data(false);
+      },
+      [&](size_t index) { return to_p2sh_script(key_hash_of(index)); },
+      list_time, bytes_time);
+  report("p2sh    ", list_time, bytes_time);
+
+  // P2WPKH: hand-rolled operation::list as in the witness examples.
+  equal &= time_script_builders(iterations,
+      [&](size_t index) {
+        operation::list p2wpkh_operations;
+        p2wpkh_operations.push_back(operation(opcode::push_size_0));
+        p2wpkh_operations.push_back(operation(to_chunk(key_hash_of(index))));
+        return script(p2wpkh_operations).to_data(false);
+      },
+      [&](size_t index) { return to_p2wpkh_script(key_hash_of(index)); },
+      list_time, bytes_time);
+  report("p2wpkh  ", list_time, bytes_time);
+
+  // P2WSH: hand-rolled operation::list as in the witness examples.
+  equal &= time_script_builders(iterations,
+      [&](size_t index) {
+        operation::list p2wsh_operations;
+        p2wsh_operations.push_back(operation(opcode::push_size_0));
+        p2wsh_operations.push_back(operation(to_chunk(script_hash_of(index))));
+        return script(p2wsh_operations).to_data(false);
+      },
+      [&](size_t index) { return to_p2wsh_script(script_hash_of(index)); },
+      list_time, bytes_time);
+  report("p2wsh   ", list_time, bytes_time);
+
+  // 2-of-3 multisig.
+  equal &= time_script_builders(iterations,
+      [&](size_t) {
+        return script(script::to_pay_multisig_pattern(2u, point_list_copy))
+            .to_data(false);
+      },
+      [&](size_t) { return to_multisig_script<2, 3>(points); },
+      list_time, bytes_time);
+  report("multisig", list_time, bytes_time);
+
+  // Both paths produced identical scripts.
+  std::cout << equal << std::endl;
+
+}
+
+
+int main() {
+
+  build_standard_scripts();
+
+  benchmark_script_builders(1000000);
+
+  return 0;
+
+}
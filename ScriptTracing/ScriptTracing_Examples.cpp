@@ -0,0 +1,833 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Normal" wallets.
+auto my_secret0 = base16_literal(
+    "b7423c94ab99d3295c1af7e7bbea47c75d298f7190ca2077b53bae61299b70a5");
+ec_private my_private0(my_secret0, ec_private::testnet, true);
+auto pubkey0 = my_private0.to_public().point();
+
+auto my_secret1 = base16_literal(
+    "d977e2ce0f744dc3432cde9813a99360a3f79f7c8035ef82310d54c57332b2cc");
+ec_private my_private1(my_secret1, ec_private::testnet, true);
+auto pubkey1 = my_private1.to_public().point();
+
+
+transaction create_transaction_template() {
+
+  // Function creates tx object as a tx template for all subsequent examples.
+  //---------------------------------------------------------------------------
+
+  // Destination output, a p2pkh script for example.
+  std::string btc_amount = "0.998";
+  uint64_t output_amount;
+  decode_base10(output_amount, btc_amount, btc_decimal_places);
+  auto p2pkh_script = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey1));
+  output p2pkh_output(output_amount, p2pkh_script);
+
+  // Build example input.
+  input example_input;
+  std::string prev_tx =
+      "44101b50393d01de1e113b17eb07e8a09fbf6334e2012575bc97da227958a7a5";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+  uint32_t index = 0;
+  output_point uxto_to_spend(prev_tx_hash, index);
+  example_input.set_previous_output(uxto_to_spend);
+  example_input.set_sequence(max_input_sequence);
+
+  // Build Transaction
+  transaction tx;
+  tx.set_version(1u);
+  tx.inputs().push_back(example_input);
+  tx.outputs().push_back(p2pkh_output);
+  tx.set_locktime(0u);
+
+  return tx;
+
+}
+
+
+// Tracers.
+//-----------------------------------------------------------------------------
+
+// One executed operation.
+struct trace_entry {
+  static constexpr size_t top_bytes = 32;
+
+  uint32_t sequence;          // Position in the trace, across all scripts.
+  uint16_t operation_index;   // Position in the script.
+  opcode code;
+  uint16_t stack_before;
+  uint16_t stack_after;
+  int error;                  // Error value of the operation, 0 on success.
+  uint8_t top_size;           // Up to top_bytes of the stack top.
+  uint8_t top[top_bytes];
+};
+
+
+// Tracing disabled: all calls are removed by the compiler.
+struct null_tracer {
+  static constexpr bool enabled = false;
+
+  void begin_script() {}
+  void begin_operation() {}
+  void record(size_t, const operation&, size_t, program&, const code&) {}
+};
+
+
+// Records the most recent operations into a buffer allocated once.
+// Older entries are overwritten, so a tracer can stay enabled indefinitely,
+// and be dumped when a transaction is rejected.
+class ring_tracer {
+
+public:
+  static constexpr bool enabled = true;
+
+  // Capacity is rounded up to a power of two.
+  explicit ring_tracer(size_t capacity)
+    : mask_(ceiling_power_of_two(capacity) - 1u), entries_(mask_ + 1u),
+      count_(0), scripts_(0) {
+  }
+
+  void begin_script() {
+    scripts_++;
+  }
+
+  void begin_operation() {}
+
+  void record(size_t operation_index, const operation& op,
+      size_t stack_before, program& current_program, const code& ec) {
+
+    auto& entry = entries_[count_ & mask_];
+    entry.sequence = static_cast<uint32_t>(count_);
+    entry.operation_index = static_cast<uint16_t>(operation_index);
+    entry.code = op.code();
+    entry.stack_before = static_cast<uint16_t>(stack_before);
+    entry.stack_after = static_cast<uint16_t>(current_program.size());
+    entry.error = ec.value();
+    entry.top_size = 0;
+
+    if (!current_program.empty()) {
+      const auto& top = current_program.item(0);
+      entry.top_size = static_cast<uint8_t>(
+          std::min(top.size(), trace_entry::top_bytes));
+      std::copy_n(top.begin(), entry.top_size, entry.top);
+    }
+
+    count_++;
+  }
+
+  // Number of operations recorded since the last reset.
+  size_t recorded() const {
+    return count_;
+  }
+
+  void reset() {
+    count_ = 0;
+    scripts_ = 0;
+  }
+
+  // Prints the retained entries, oldest first.
+  void dump(std::ostream& stream, uint32_t forks) const {
+    const auto retained = std::min(count_, entries_.size());
+    stream << scripts_ << " script(s), " << count_ << " operation(s), last "
+           << retained << ":" << std::endl;
+
+    for (auto index = count_ - retained; index < count_; index++) {
+      const auto& entry = entries_[index & mask_];
+      stream << "#" << entry.sequence << " [" << entry.operation_index
+             << "] " << opcode_to_string(entry.code, forks) << " stack "
+             << entry.stack_before << " -> " << entry.stack_after;
+
+      if (entry.top_size != 0)
+        stream << " top [" << encode_base16(data_slice(entry.top,
+            entry.top + entry.top_size)) << "]";
+
+      if (entry.error != 0)
+        stream << " error " << entry.error;
+
+      stream << std::endl;
+    }
+  }
+
+private:
+  static size_t ceiling_power_of_two(size_t value) {
+    size_t power = 1;
+    while (power < value)
+      power <<= 1;
+
+    return power;
+  }
+
+  const size_t mask_;
+  std::vector<trace_entry> entries_;
+  size_t count_;
+  size_t scripts_;
+};
+
+
+// Opcode profiler.
+//-----------------------------------------------------------------------------
+
+// Time stamp counter where available, otherwise steady clock nanoseconds.
+inline uint64_t cycle_count() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+// Template of a previous output script.
+const char* template_name(const script& prevout_script) {
+
+  if (script::is_witness_program_pattern(prevout_script.operations())) {
+    const auto program_size = prevout_script[1].data().size();
+    return program_size == short_hash_size ? "p2wpkh" :
+        program_size == hash_size ? "p2wsh" : "witness_unknown";
+  }
+
+  switch (prevout_script.output_pattern()) {
+    case script_pattern::pay_key_hash:
+      return "p2pkh";
+    case script_pattern::pay_script_hash:
+      return "p2sh";
+    case script_pattern::pay_public_key:
+      return "p2pk";
+    case script_pattern::pay_multisig:
+      return "multisig";
+    case script_pattern::null_data:
+      return "null_data";
+    default:
+      return "non_standard";
+  }
+
+}
+
+
+struct opcode_statistics {
+  uint64_t executions;
+  uint64_t cycles;
+};
+
+
+struct template_statistics {
+  uint64_t inputs;
+  uint64_t executions;
+  uint64_t cycles;
+};
+
+
+struct input_profile {
+  hash_digest transaction_hash;
+  uint32_t input_index;
+  const char* template_name;
+  uint64_t executions;
+  uint64_t cycles;
+  int error;
+};
+
+
+// Counts executions and cycles of evaluated operations per opcode, per
+// previous output template and per input. The cycles of an operation are
+// measured around program::evaluate(), so the checks of the operation loop
+// are not attributed to any opcode.
+class opcode_profiler {
+
+public:
+  static constexpr bool enabled = true;
+
+  opcode_profiler()
+    : opcodes_(), current_template_(nullptr), start_(0) {
+  }
+
+  void begin_input(const transaction& tx, uint32_t input_index,
+      const script& prevout_script) {
+    const auto name = template_name(prevout_script);
+    current_template_ = &templates_[name];
+    current_template_->inputs++;
+    inputs_.push_back({ tx.hash(), input_index, name, 0, 0, 0 });
+  }
+
+  void end_input(const code& ec) {
+    inputs_.back().error = ec.value();
+  }
+
+  void begin_script() {}
+
+  void begin_operation() {
+    start_ = cycle_count();
+  }
+
+  void record(size_t, const operation& op, size_t, program&, const code&) {
+    const auto cycles = cycle_count() - start_;
+
+    auto& statistics = opcodes_[static_cast<uint8_t>(op.code())];
+    statistics.executions++;
+    statistics.cycles += cycles;
+
+    current_template_->executions++;
+    current_template_->cycles += cycles;
+
+    inputs_.back().executions++;
+    inputs_.back().cycles += cycles;
+  }
+
+  const opcode_statistics& statistics(opcode code) const {
+    return opcodes_[static_cast<uint8_t>(code)];
+  }
+
+  uint64_t total_cycles() const {
+    uint64_t total = 0;
+    for (const auto& entry: templates_)
+      total += entry.second.cycles;
+
+    return total;
+  }
+
+  // Executed opcodes, most cycles first.
+  std::vector<opcode> hottest() const {
+    std::vector<opcode> codes;
+    for (size_t code = 0; code < opcodes_.size(); code++)
+      if (opcodes_[code].executions != 0)
+        codes.push_back(static_cast<opcode>(code));
+
+    std::sort(codes.begin(), codes.end(), [this](opcode left, opcode right) {
+      return statistics(left).cycles > statistics(right).cycles;
+    });
+
+    return codes;
+  }
+
+  // Opcode and template names contain no characters which require escaping.
+  void write_json(std::ostream& stream, uint32_t forks) const {
+    stream << "{\"opcodes\":[";
+    auto first = true;
+    for (const auto code: hottest()) {
+      const auto& entry = statistics(code);
+      stream << (first ? "" : ",") << "{\"opcode\":\""
+             << opcode_to_string(code, forks) << "\",\"executions\":"
+             << entry.executions << ",\"cycles\":" << entry.cycles << "}";
+      first = false;
+    }
+
+    stream << "],\"templates\":[";
+    first = true;
+    for (const auto& entry: templates_) {
+      stream << (first ? "" : ",") << "{\"template\":\"" << entry.first
+             << "\",\"inputs\":" << entry.second.inputs
+             << ",\"executions\":" << entry.second.executions
+             << ",\"cycles\":" << entry.second.cycles << "}";
+      first = false;
+    }
+
+    stream << "],\"inputs\":[";
+    first = true;
+    for (const auto& entry: inputs_) {
+      stream << (first ? "" : ",") << "{\"transaction\":\""
+             << encode_hash(entry.transaction_hash) << "\",\"index\":"
+             << entry.input_index << ",\"template\":\""
+             << entry.template_name << "\",\"executions\":"
+             << entry.executions << ",\"cycles\":" << entry.cycles
+             << ",\"error\":" << entry.error << "}";
+      first = false;
+    }
+
+    stream << "]}" << std::endl;
+  }
+
+  // Prometheus text exposition format. Inputs are not exported, since a
+  // label per input would create a new time series for every input.
+  void write_prometheus(std::ostream& stream, uint32_t forks) const {
+    const auto codes = hottest();
+
+    stream << "# HELP script_opcode_executions_total Evaluated operations."
+           << std::endl << "# TYPE script_opcode_executions_total counter"
+           << std::endl;
+    for (const auto code: codes)
+      stream << "script_opcode_executions_total{opcode=\""
+             << opcode_to_string(code, forks) << "\"} "
+             << statistics(code).executions << std::endl;
+
+    stream << "# HELP script_opcode_cycles_total Cycles of evaluation."
+           << std::endl << "# TYPE script_opcode_cycles_total counter"
+           << std::endl;
+    for (const auto code: codes)
+      stream << "script_opcode_cycles_total{opcode=\""
+             << opcode_to_string(code, forks) << "\"} "
+             << statistics(code).cycles << std::endl;
+
+    stream << "# HELP script_template_inputs_total Profiled inputs."
+           << std::endl << "# TYPE script_template_inputs_total counter"
+           << std::endl;
+    for (const auto& entry: templates_)
+      stream << "script_template_inputs_total{template=\"" << entry.first
+             << "\"} " << entry.second.inputs << std::endl;
+
+    stream << "# HELP script_template_cycles_total Cycles of evaluation."
+           << std::endl << "# TYPE script_template_cycles_total counter"
+           << std::endl;
+    for (const auto& entry: templates_)
+      stream << "script_template_cycles_total{template=\"" << entry.first
+             << "\"} " << entry.second.cycles << std::endl;
+  }
+
+private:
+  std::array<opcode_statistics, 256> opcodes_;
+  std::map<std::string, template_statistics> templates_;
+  std::vector<input_profile> inputs_;
+  template_statistics* current_template_;
+  uint64_t start_;
+};
+
+
+// Traced script run.
+//-----------------------------------------------------------------------------
+
+// The operation loop of debug_program() of the script machine examples,
+// with each evaluated operation passed to the tracer instead of copying the
+// program to print its stack.
+template <typename Tracer>
+code run_program(program& current_program, Tracer& tracer) {
+
+  if (!current_program.is_valid())
+    return error::invalid_script;
+
+  if (Tracer::enabled)
+    tracer.begin_script();
+
+  size_t operation_index = 0;
+  for (const auto& op: current_program) {
+    if (op.is_oversized())
+      return error::invalid_push_data_size;
+
+    if (op.is_disabled())
+      return error::op_disabled;
+
+    if (!current_program.increment_operation_count(op))
+      return error::invalid_operation_count;
+
+    if (current_program.if_(op)) {
+      if (current_program.is_stack_overflow())
+        return error::invalid_stack_size;
+
+      const auto stack_before = Tracer::enabled ? current_program.size() : 0;
+      if (Tracer::enabled)
+        tracer.begin_operation();
+
+      const auto ec = current_program.evaluate(op);
+
+      if (Tracer::enabled)
+        tracer.record(operation_index, op, stack_before, current_program, ec);
+
+      if (ec)
+        return ec;
+    }
+
+    operation_index++;
+  }
+
+  return current_program.closed() ? error::success :
+      error::invalid_stack_scope;
+
+}
+
+
+// Version 0 witness program, native or embedded in P2SH.
+template <typename Tracer>
+code run_witness_program(const transaction& tx, uint32_t input_index,
+    uint32_t forks, const script& program_script, uint64_t value,
+    Tracer& tracer) {
+
+  const auto version = program_script.version();
+
+  // Unknown versions are not evaluated.
+  if (version != script_version::zero)
+    return error::success;
+
+  script witness_script;
+  data_stack stack;
+  if (!tx.inputs()[input_index].witness().extract_embedded_script(
+      witness_script, stack, program_script))
+    return error::invalid_witness;
+
+  program witness_program(witness_script, tx, input_index, forks,
+      std::move(stack), value, version);
+
+  const auto ec = run_program(witness_program, tracer);
+  if (ec)
+    return ec;
+
+  return witness_program.stack_result(true) ? error::success :
+      error::stack_false;
+
+}
+
+
+// Input script, output script, and P2SH or witness scripts of one input, as
+// in run_p2sh_p2wpkh() of the script machine examples.
+template <typename Tracer>
+code run_input(const transaction& tx, uint32_t input_index, uint32_t forks,
+    const script& prevout_script, uint64_t value, Tracer& tracer) {
+
+  const auto& input_script = tx.inputs()[input_index].script();
+  const auto& input_witness = tx.inputs()[input_index].witness();
+  code ec;
+
+  program input_program(input_script, tx, input_index, forks);
+  if ((ec = run_program(input_program, tracer)))
+    return ec;
+
+  program output_program(prevout_script, input_program);
+  if ((ec = run_program(output_program, tracer)))
+    return ec;
+
+  if (!output_program.stack_result(false))
+    return error::stack_false;
+
+  // Native witness program.
+  if ((forks & rule_fork::bip141_rule) != 0 &&
+      script::is_witness_program_pattern(prevout_script.operations()))
+    return input_script.empty() ? run_witness_program(tx, input_index, forks,
+        prevout_script, value, tracer) : error::dirty_witness;
+
+  if ((forks & rule_fork::bip16_rule) == 0 ||
+      prevout_script.output_pattern() != script_pattern::pay_script_hash)
+    return input_witness.empty() ? error::success :
+        error::unexpected_witness;
+
+  // P2SH.
+  if (!script::is_relaxed_push(input_script.operations()))
+    return error::invalid_script_embed;
+
+  script embedded_script(input_program.pop(), false);
+  program embedded_program(embedded_script, std::move(input_program), true);
+  if ((ec = run_program(embedded_program, tracer)))
+    return ec;
+
+  if (!embedded_program.stack_result(false))
+    return error::stack_false;
+
+  // Witness program embedded in P2SH.
+  if ((forks & rule_fork::bip141_rule) != 0 &&
+      script::is_witness_program_pattern(embedded_script.operations()))
+    return input_script.size() == 1u ? run_witness_program(tx, input_index,
+        forks, embedded_script, value, tracer) : error::dirty_witness;
+
+  // The witness must be empty if no witness program was run.
+  return input_witness.empty() ? error::success : error::unexpected_witness;
+
+}
+
+
+// The program copy of debug_program(), without printing.
+size_t copy_stack_per_operation(program& current_program,
+    const script& current_script) {
+
+  size_t checksum = 0;
+  for (const auto& op: current_program) {
+    if (!current_program.increment_operation_count(op))
+      return checksum;
+
+    if (current_program.if_(op)) {
+      if (current_program.evaluate(op))
+        return checksum;
+
+      program program_copy(current_script, current_program);
+      while (!program_copy.empty())
+        checksum += program_copy.pop().size();
+    }
+  }
+
+  return checksum;
+
+}
+
+
+void trace_rejected_spend(const transaction& template_transaction) {
+
+  auto tx = template_transaction;
+  const script prevout_script(script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey0)));
+
+  // Signed with the wrong key.
+  endorsement sig;
+  script::create_endorsement(sig, my_secret1, prevout_script, tx, 0u,
+      sighash_algorithm::all);
+  tx.inputs()[0].set_script(script(operation::list {
+      operation(sig),
+      operation(to_chunk(pubkey0))
+  }));
+
+  // The tracer stays enabled for all inputs, and is only read on rejection.
+  ring_tracer tracer(64u);
+  const auto ec = run_input(tx, 0u, rule_fork::all_rules, prevout_script,
+      0u, tracer);
+
+  // Prints stack false, then the 7 operations of both scripts.
+  std::cout << ec.message() << std::endl;
+  if (ec)
+    tracer.dump(std::cout, rule_fork::all_rules);
+
+  // A signature of the right key.
+  script::create_endorsement(sig, my_secret0, prevout_script, tx, 0u,
+      sighash_algorithm::all);
+  tx.inputs()[0].set_script(script(operation::list {
+      operation(sig),
+      operation(to_chunk(pubkey0))
+  }));
+
+  // Prints success
+  tracer.reset();
+  std::cout << run_input(tx, 0u, rule_fork::all_rules, prevout_script, 0u,
+      tracer).message() << std::endl;
+
+}
+
+
+// Script of 32-byte pushes followed by 2drop operations.
+script create_large_script(size_t pushes, size_t drops) {
+
+  operation::list operations;
+  data_chunk element(32, 0x51);
+  for (size_t index = 0; index < pushes; index++) {
+    element[0] = static_cast<uint8_t>(index);
+    operations.push_back(operation(element));
+  }
+
+  for (size_t index = 0; index < drops; index++)
+    operations.push_back(operation(opcode::drop2));
+
+  return script(operations);
+
+}
+
+
+void benchmark_tracing(const transaction& template_transaction,
+    size_t iterations) {
+
+  // 280 pushes and 140 counted operations, within the 10000 byte and the
+  // 201 operation script limits.
+  const auto large_script = create_large_script(280u, 140u);
+  ring_tracer tracer(1024u);
+  null_tracer no_tracer;
+  size_t checksum = 0;
+
+  const auto run = [&](const std::function<void()>& handler) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t count = 0; count < iterations; count++)
+      handler();
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count() /
+        static_cast<double>(iterations);
+  };
+
+  const auto untraced = run([&]() {
+    program current_program(large_script, template_transaction, 0u,
+        rule_fork::all_rules);
+    checksum += run_program(current_program, no_tracer).value();
+  });
+
+  const auto traced = run([&]() {
+    program current_program(large_script, template_transaction, 0u,
+        rule_fork::all_rules);
+    checksum += run_program(current_program, tracer).value();
+  });
+
+  const auto copied = run([&]() {
+    program current_program(large_script, template_transaction, 0u,
+        rule_fork::all_rules);
+    checksum += copy_stack_per_operation(current_program, large_script);
+  });
+
+  std::cout << "operations per run: " << large_script.size() << std::endl;
+  std::cout << "untraced:           " << untraced << " us" << std::endl;
+  std::cout << "ring_tracer:        " << traced << " us ("
+            << (traced / untraced - 1.0) * 100.0 << "% overhead)"
+            << std::endl;
+  std::cout << "program copy:       " << copied << " us" << std::endl;
+  std::cout << "checksum:           " << checksum << std::endl;
+
+}
+
+
+// Signed spend of one input, with its previous output.
+struct profiled_spend {
+  transaction tx;
+  script prevout_script;
+  uint64_t value;
+};
+
+
+std::vector<profiled_spend> create_profiled_spends(
+    const transaction& template_transaction) {
+
+  std::vector<profiled_spend> spends;
+  const uint64_t value = 100000000u;
+  const auto key_hash = bitcoin_short_hash(pubkey0);
+  const script multisig_script(script::to_pay_multisig_pattern(2u,
+      point_list { pubkey0, pubkey1 }));
+  endorsement sig0;
+  endorsement sig1;
+
+  // P2PKH.
+  {
+    profiled_spend spend { template_transaction,
+        script(script::to_pay_key_hash_pattern(key_hash)), value };
+    script::create_endorsement(sig0, my_secret0, spend.prevout_script,
+        spend.tx, 0u, sighash_algorithm::all);
+    spend.tx.inputs()[0].set_script(script(operation::list {
+        operation(sig0),
+        operation(to_chunk(pubkey0))
+    }));
+    spends.push_back(spend);
+  }
+
+  // P2PK.
+  {
+    profiled_spend spend { template_transaction,
+        script(script::to_pay_public_key_pattern(to_chunk(pubkey0))),
+        value };
+    script::create_endorsement(sig0, my_secret0, spend.prevout_script,
+        spend.tx, 0u, sighash_algorithm::all);
+    spend.tx.inputs()[0].set_script(script(operation::list {
+        operation(sig0)
+    }));
+    spends.push_back(spend);
+  }
+
+  // P2SH(2-of-2 multisig).
+  {
+    profiled_spend spend { template_transaction,
+        script(script::to_pay_script_hash_pattern(bitcoin_short_hash(
+            multisig_script.to_data(false)))), value };
+    script::create_endorsement(sig0, my_secret0, multisig_script, spend.tx,
+        0u, sighash_algorithm::all);
+    script::create_endorsement(sig1, my_secret1, multisig_script, spend.tx,
+        0u, sighash_algorithm::all);
+    spend.tx.inputs()[0].set_script(script(operation::list {
+        operation(opcode::push_size_0),
+        operation(sig0),
+        operation(sig1),
+        operation(multisig_script.to_data(false))
+    }));
+    spends.push_back(spend);
+  }
+
+  // P2WPKH.
+  {
+    profiled_spend spend { template_transaction, script(operation::list {
+        operation(opcode::push_size_0),
+        operation(to_chunk(key_hash))
+    }), value };
+    const script script_code(script::to_pay_key_hash_pattern(key_hash));
+    script::create_endorsement(sig0, my_secret0, script_code, spend.tx, 0u,
+        sighash_algorithm::all, script_version::zero, value);
+    spend.tx.inputs()[0].set_witness(witness(data_stack {
+        sig0,
+        to_chunk(pubkey0)
+    }));
+    spends.push_back(spend);
+  }
+
+  // P2WSH(2-of-2 multisig).
+  {
+    profiled_spend spend { template_transaction, script(operation::list {
+        operation(opcode::push_size_0),
+        operation(to_chunk(sha256_hash(multisig_script.to_data(false))))
+    }), value };
+    script::create_endorsement(sig0, my_secret0, multisig_script, spend.tx,
+        0u, sighash_algorithm::all, script_version::zero, value);
+    script::create_endorsement(sig1, my_secret1, multisig_script, spend.tx,
+        0u, sighash_algorithm::all, script_version::zero, value);
+    spend.tx.inputs()[0].set_witness(witness(data_stack {
+        data_chunk(),
+        sig0,
+        sig1,
+        multisig_script.to_data(false)
+    }));
+    spends.push_back(spend);
+  }
+
+  return spends;
+
+}
+
+
+code profile_input(opcode_profiler& profiler, const transaction& tx,
+    uint32_t input_index, uint32_t forks, const script& prevout_script,
+    uint64_t value) {
+
+  profiler.begin_input(tx, input_index, prevout_script);
+  const auto ec = run_input(tx, input_index, forks, prevout_script, value,
+      profiler);
+  profiler.end_input(ec);
+  return ec;
+
+}
+
+
+void profile_spends(const transaction& template_transaction,
+    size_t repetitions) {
+
+  const auto spends = create_profiled_spends(template_transaction);
+  const auto forks = rule_fork::all_rules;
+  opcode_profiler profiler;
+  size_t failures = 0;
+
+  // Each template appears repetitions times, as in a block.
+  for (size_t count = 0; count < repetitions; count++)
+    for (const auto& spend: spends)
+      failures += bool(profile_input(profiler, spend.tx, 0u, forks,
+          spend.prevout_script, spend.value));
+
+  // Prints 0
+  std::cout << "failures: " << failures << std::endl;
+
+  // Share of the cycles of all evaluated operations, e.g. checksig and
+  // checkmultisig first.
+  const auto total = static_cast<double>(profiler.total_cycles());
+  for (const auto code: profiler.hottest())
+    std::cout << opcode_to_string(code, forks) << ": "
+              << profiler.statistics(code).executions << " executions, "
+              << profiler.statistics(code).cycles * 100.0 / total << "%"
+              << std::endl;
+
+  profiler.write_prometheus(std::cout, forks);
+  profiler.write_json(std::cout, forks);
+
+}
+
+
+int main() {
+
+  auto template_transaction = create_transaction_template();
+
+  trace_rejected_spend(template_transaction);
+
+  benchmark_tracing(template_transaction, 100);
+
+  profile_spends(template_transaction, 20);
+
+  return 0;
+
+}
@@ -1,6 +1,9 @@
 #include <bitcoin/bitcoin.hpp>
 #include <string.h>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <map>
 
 using namespace bc;
 using namespace wallet;
@@ -124,6 +127,569 @@ void create_and_verify_p2pkh(const transaction& example_transaction)
 
 }
 
+// Libbitcoin version4: Previous outputs from transaction metadata.
+//-----------------------------------------------------------------------------
+
+// Source of previous outputs, such as a UTXO database or a block cache.
+// Implementations set previous_output().metadata.cache of each point, which
+// is mutable, so the transaction itself is passed as const.
+class utxo_provider {
+
+public:
+  virtual ~utxo_provider() {}
+
+  // Populates the metadata cache of all points in one batch.
+  // Returns the number of points not found, whose cache is left invalid.
+  virtual size_t populate(const std::vector<const output_point*>& points) = 0;
+};
+
+
+// Previous outputs held in memory, e.g. outputs of earlier transactions of
+// the same block. Each output is spent by a single batch, so it is moved,
+// with its script, into the metadata of the input spending it and removed
+// from the provider. A point populated a second time is not found.
+class memory_utxo_provider
+  : public utxo_provider {
+
+public:
+  void add(const output_point& point, output&& prevout) {
+    outputs_[point] = std::move(prevout);
+  }
+
+  size_t size() const {
+    return outputs_.size();
+  }
+
+  size_t populate(const std::vector<const output_point*>& points) override {
+    size_t missing = 0;
+    for (const auto prevout_point: points) {
+      const auto it = outputs_.find(*prevout_point);
+      if (it == outputs_.end()) {
+        prevout_point->metadata.cache = output();
+        missing++;
+        continue;
+      }
+
+      prevout_point->metadata.cache = std::move(it->second);
+      outputs_.erase(it);
+    }
+
+    return missing;
+  }
+
+private:
+  std::map<point, output> outputs_;
+};
+
+
+// Alternative to memory_utxo_provider for outputs verified by several
+// batches. Outputs are kept, so each is copied, with its script, into the
+// metadata of the input spending it, once per input and batch.
+class copying_utxo_provider
+  : public utxo_provider {
+
+public:
+  void add(const output_point& point, const output& prevout) {
+    outputs_[point] = prevout;
+  }
+
+  size_t populate(const std::vector<const output_point*>& points) override {
+    size_t missing = 0;
+    for (const auto prevout_point: points) {
+      const auto it = outputs_.find(*prevout_point);
+      if (it == outputs_.end()) {
+        prevout_point->metadata.cache = output();
+        missing++;
+        continue;
+      }
+
+      prevout_point->metadata.cache = it->second;
+    }
+
+    return missing;
+  }
+
+private:
+  std::map<point, output> outputs_;
+};
+
+
+// Populates the previous outputs of all inputs of the transactions with a
+// single call to the provider. Returns the number of points not found.
+size_t populate_prevouts(utxo_provider& provider,
+    const transaction::list& transactions) {
+
+  std::vector<const output_point*> points;
+  for (const auto& tx: transactions)
+    for (const auto& input: tx.inputs())
+      points.push_back(&input.previous_output());
+
+  return provider.populate(points);
+
+}
+
+
+// Verifies all inputs of a transaction against the previous outputs in its
+// metadata. script::verify() reads the prevout script and amount by
+// reference from the metadata cache, so neither is copied.
+// On failure, failed_input is set to the index of the failing input.
+code verify_transaction(const transaction& tx, uint32_t forks,
+    uint32_t& failed_input) {
+
+  for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+    failed_input = index;
+    if (!tx.inputs()[index].previous_output().metadata.cache.is_valid())
+      return error::missing_previous_output;
+
+    const auto ec = script::verify(tx, index, forks);
+    if (ec)
+      return ec;
+  }
+
+  return error::success;
+
+}
+
+
+void verify_with_utxo_provider(const transaction& example_transaction) {
+
+  // Two P2PKH inputs, spending outputs of two different keys.
+  auto tx = example_transaction;
+  auto second_input = tx.inputs()[0];
+  auto second_point = second_input.previous_output();
+  second_point.set_index(1u);
+  second_input.set_previous_output(second_point);
+  tx.inputs().push_back(second_input);
+
+  std::string previous_btc_amount = "0.5";
+  uint64_t previous_output_amount;
+  decode_base10(previous_output_amount, previous_btc_amount, btc_decimal_places);
+
+  const script prevout_script_0 = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey0));
+  const script prevout_script_1 = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey1));
+
+  // The provider holds the previous outputs until a batch spends them.
+  memory_utxo_provider provider;
+  provider.add(tx.inputs()[0].previous_output(),
+      output(previous_output_amount, prevout_script_0));
+  provider.add(tx.inputs()[1].previous_output(),
+      output(previous_output_amount, prevout_script_1));
+
+  // Sign both inputs.
+  const std::pair<ec_secret, ec_compressed> keys[] = {
+      { my_secret0, pubkey0 },
+      { my_secret1, pubkey1 }
+  };
+  const script* prevout_scripts[] = { &prevout_script_0, &prevout_script_1 };
+  for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+    endorsement sig;
+    script::create_endorsement(sig, keys[index].first,
+        *prevout_scripts[index], tx, index, sighash_algorithm::all);
+    operation::list input_operations {
+        operation(sig),
+        operation(to_chunk(keys[index].second))
+    };
+    tx.inputs()[index].set_script(script(input_operations));
+  }
+
+  // Populate all prevouts of the batch, then verify without passing them.
+  const transaction::list batch { tx };
+  std::cout << populate_prevouts(provider, batch) << std::endl; // Prints 0.
+
+  uint32_t failed_input;
+  auto ec = verify_transaction(batch[0], rule_fork::all_rules, failed_input);
+
+  // Prints success
+  std::cout << ec.message() << std::endl;
+
+  // The previous outputs were moved into the batch.
+  std::cout << provider.size() << std::endl; // Prints 0.
+
+  // Unknown previous output, with a provider keeping its outputs.
+  copying_utxo_provider copying_provider;
+  copying_provider.add(tx.inputs()[0].previous_output(),
+      output(previous_output_amount, prevout_script_0));
+  copying_provider.add(tx.inputs()[1].previous_output(),
+      output(previous_output_amount, prevout_script_1));
+
+  auto unknown_tx = tx;
+  auto unknown_point = unknown_tx.inputs()[1].previous_output();
+  unknown_point.set_index(2u);
+  unknown_tx.inputs()[1].set_previous_output(unknown_point);
+
+  const transaction::list unknown_batch { unknown_tx };
+  std::cout << populate_prevouts(copying_provider, unknown_batch)
+            << std::endl; // Prints 1.
+  ec = verify_transaction(unknown_batch[0], rule_fork::all_rules,
+      failed_input);
+  std::cout << ec.message() << ", input " << failed_input << std::endl;
+
+}
+
+// Standard template fast path.
+//-----------------------------------------------------------------------------
+
+// True if the operation pushes data within the push size limit.
+bool is_data_push(const operation& op) {
+  return op.is_valid() && op.code() <= opcode::push_four_size &&
+      op.data().size() <= max_push_data_size;
+}
+
+
+// 0 [20-byte public key hash]
+bool is_p2wpkh_program(const operation::list& ops) {
+  return script::is_witness_program_pattern(ops) &&
+      ops[0].code() == opcode::push_size_0 &&
+      ops[1].data().size() == short_hash_size;
+}
+
+
+// Checks an endorsement as the checksig opcode does.
+bool check_endorsement(const data_chunk& endorsement_bytes,
+    const data_chunk& public_key, const transaction& tx, uint32_t index,
+    const script& script_code, uint64_t value, script_version version,
+    uint32_t forks) {
+
+  if (endorsement_bytes.empty())
+    return false;
+
+  uint8_t sighash_type;
+  der_signature distinguished;
+  ec_signature signature;
+  auto endorsement_copy = endorsement_bytes;
+  const auto strict = (forks & rule_fork::bip66_rule) != 0;
+  if (!parse_endorsement(sighash_type, distinguished,
+      std::move(endorsement_copy)) ||
+      !parse_signature(signature, distinguished, strict))
+    return false;
+
+  const auto sighash = script::generate_signature_hash(tx, index,
+      script_code, sighash_type, version, value);
+  return verify_signature(public_key, sighash, signature);
+
+}
+
+
+// Verifies P2PKH, P2WPKH and P2SH-P2WPKH spends without the interpreter:
+// one hash comparison and one signature check.
+// Returns false if the input does not exactly match one of the templates,
+// in which case out is not set and the input must be verified by
+// script::verify(). Templates are only recognised under the fork rules
+// which define them.
+bool verify_standard(code& out, const transaction& tx, uint32_t input_index,
+    uint32_t forks, const script& prevout_script, uint64_t value) {
+
+  const auto& input = tx.inputs()[input_index];
+  const auto& input_ops = input.script().operations();
+  const auto& stack = input.witness().stack();
+  const auto& prevout_ops = prevout_script.operations();
+  const auto witness_rules = (forks & rule_fork::bip141_rule) != 0 &&
+      (forks & rule_fork::bip143_rule) != 0;
+  const auto p2sh_rules = (forks & rule_fork::bip16_rule) != 0;
+
+  const data_chunk* sig;
+  const data_chunk* public_key;
+  short_hash key_hash;
+  auto legacy = false;
+
+  if (script::is_pay_key_hash_pattern(prevout_ops)) {
+
+    // P2PKH: [signature] [public key], without witness.
+    if (input_ops.size() != 2u || !is_data_push(input_ops[0]) ||
+        !is_data_push(input_ops[1]) || !stack.empty())
+      return false;
+
+    sig = &input_ops[0].data();
+    public_key = &input_ops[1].data();
+    key_hash = to_array<short_hash_size>(prevout_ops[2].data());
+    legacy = true;
+
+  } else if (witness_rules && is_p2wpkh_program(prevout_ops)) {
+
+    // P2WPKH: empty input script, witness [signature] [public key].
+    if (!input_ops.empty() || stack.size() != 2u)
+      return false;
+
+    sig = &stack[0];
+    public_key = &stack[1];
+    key_hash = to_array<short_hash_size>(prevout_ops[1].data());
+
+  } else if (witness_rules && p2sh_rules &&
+      script::is_pay_script_hash_pattern(prevout_ops)) {
+
+    // P2SH-P2WPKH: input script [0 [20-byte public key hash]],
+    // witness [signature] [public key].
+    if (input_ops.size() != 1u ||
+        input_ops[0].code() != opcode::push_size_22 || stack.size() != 2u)
+      return false;
+
+    const auto& redeem = input_ops[0].data();
+    if (redeem[0] != 0x00 || redeem[1] != short_hash_size)
+      return false;
+
+    if (bitcoin_short_hash(redeem) !=
+        to_array<short_hash_size>(prevout_ops[1].data())) {
+      out = error::stack_false;
+      return true;
+    }
+
+    sig = &stack[0];
+    public_key = &stack[1];
+    key_hash = to_array<short_hash_size>(
+        data_slice(redeem.begin() + 2, redeem.end()));
+
+  } else {
+    return false;
+  }
+
+  if (bitcoin_short_hash(*public_key) != key_hash) {
+    out = error::stack_false;
+    return true;
+  }
+
+  // Legacy: the previous output script, BIP143: P2PKH(public key hash).
+  const auto valid = legacy ?
+      check_endorsement(*sig, *public_key, tx, input_index, prevout_script,
+          value, script_version::unversioned, forks) :
+      check_endorsement(*sig, *public_key, tx, input_index,
+          script(script::to_pay_key_hash_pattern(key_hash)), value,
+          script_version::zero, forks);
+
+  out = valid ? error::success : error::stack_false;
+  return true;
+
+}
+
+
+// Fast path with fallback to the interpreter.
+code verify_input(const transaction& tx, uint32_t input_index,
+    uint32_t forks, const script& prevout_script, uint64_t value) {
+
+  code ec;
+  const auto& input = tx.inputs()[input_index];
+  return verify_standard(ec, tx, input_index, forks, prevout_script, value) ?
+      ec : script::verify(tx, input_index, forks, input.script(),
+          input.witness(), prevout_script, value);
+
+}
+
+
+// Single input spend of one of the standard templates, signed by pubkey0.
+struct template_spend {
+  transaction tx;
+  script prevout_script;
+  uint64_t value;
+};
+
+enum class spend_template { p2pkh, p2wpkh, p2sh_p2wpkh, p2pk };
+
+
+template_spend create_template_spend(const transaction& example_transaction,
+    spend_template kind, uint8_t sighash_type) {
+
+  template_spend spend { example_transaction, script(), 100000000u };
+  auto& input = spend.tx.inputs()[0];
+  const auto key_hash = bitcoin_short_hash(pubkey0);
+  const script p2pkh_script(script::to_pay_key_hash_pattern(key_hash));
+  const script p2wpkh_script(operation::list {
+      operation(opcode::push_size_0),
+      operation(to_chunk(key_hash))
+  });
+
+  endorsement sig;
+  switch (kind) {
+    case spend_template::p2pkh:
+      spend.prevout_script = p2pkh_script;
+      script::create_endorsement(sig, my_secret0, p2pkh_script, spend.tx,
+          0u, sighash_type);
+      input.set_script(script(operation::list {
+          operation(sig),
+          operation(to_chunk(pubkey0))
+      }));
+      break;
+
+    case spend_template::p2wpkh:
+    case spend_template::p2sh_p2wpkh:
+      if (kind == spend_template::p2wpkh) {
+        spend.prevout_script = p2wpkh_script;
+      } else {
+        spend.prevout_script = script::to_pay_script_hash_pattern(
+            bitcoin_short_hash(p2wpkh_script.to_data(false)));
+        input.set_script(script(operation::list {
+            operation(p2wpkh_script.to_data(false))
+        }));
+      }
+      script::create_endorsement(sig, my_secret0, p2pkh_script, spend.tx,
+          0u, sighash_type, script_version::zero, spend.value);
+      input.set_witness(witness(data_stack { sig, to_chunk(pubkey0) }));
+      break;
+
+    case spend_template::p2pk:
+      spend.prevout_script = script(operation::list {
+          operation(to_chunk(pubkey0)),
+          operation(opcode::checksig)
+      });
+      script::create_endorsement(sig, my_secret0, spend.prevout_script,
+          spend.tx, 0u, sighash_type);
+      input.set_script(script(operation::list { operation(sig) }));
+      break;
+  }
+
+  return spend;
+
+}
+
+
+// Signature and public key of a spend, in its input script or witness.
+void mutate_signature(template_spend& spend,
+    const std::function<void(data_chunk&, data_chunk&)>& mutate) {
+
+  auto& input = spend.tx.inputs()[0];
+  auto stack = input.witness().stack();
+  if (!stack.empty()) {
+    mutate(stack[0], stack[1]);
+    input.set_witness(witness(stack));
+    return;
+  }
+
+  auto ops = input.script().operations();
+  auto sig = ops[0].data();
+  auto public_key = ops.size() > 1u ? ops[1].data() : data_chunk();
+  mutate(sig, public_key);
+  ops[0] = operation(sig);
+  if (ops.size() > 1u)
+    ops[1] = operation(public_key);
+  input.set_script(script(ops));
+
+}
+
+
+void differential_fast_path(const transaction& example_transaction) {
+
+  const spend_template kinds[] = {
+      spend_template::p2pkh,
+      spend_template::p2wpkh,
+      spend_template::p2sh_p2wpkh,
+      spend_template::p2pk
+  };
+  const uint8_t types[] = { 0x01, 0x02, 0x03, 0x81 };
+  const uint32_t fork_sets[] = {
+      rule_fork::all_rules,
+      rule_fork::all_rules ^ rule_fork::bip66_rule,
+      rule_fork::all_rules ^ rule_fork::bip141_rule ^ rule_fork::bip143_rule,
+      rule_fork::all_rules ^ rule_fork::bip16_rule
+  };
+
+  // Mutations of a valid spend.
+  const std::vector<std::function<void(template_spend&)>> mutations {
+      [](template_spend&) {},
+      [](template_spend& spend) { spend.value++; },
+      [](template_spend& spend) {
+        mutate_signature(spend, [](data_chunk& sig, data_chunk&) {
+          sig[10] ^= 0x01; });
+      },
+      [](template_spend& spend) {
+        mutate_signature(spend, [](data_chunk& sig, data_chunk&) {
+          sig.back() = 0x02; });
+      },
+      [](template_spend& spend) {
+        mutate_signature(spend, [](data_chunk& sig, data_chunk&) {
+          sig.clear(); });
+      },
+      [](template_spend& spend) {
+        mutate_signature(spend, [](data_chunk& sig, data_chunk&) {
+          sig.insert(sig.end() - 1, 0x00); });
+      },
+      [](template_spend& spend) {
+        mutate_signature(spend, [](data_chunk&, data_chunk& public_key) {
+          public_key = to_chunk(pubkey1); });
+      },
+      [](template_spend& spend) {
+        auto ops = spend.tx.inputs()[0].script().operations();
+        ops.push_back(operation(opcode::push_positive_1));
+        spend.tx.inputs()[0].set_script(script(ops));
+      }
+  };
+
+  size_t cases = 0;
+  size_t fast = 0;
+  size_t mismatches = 0;
+  for (const auto kind: kinds) {
+    for (const auto type: types) {
+      for (const auto& mutation: mutations) {
+        auto spend = create_template_spend(example_transaction, kind, type);
+        mutation(spend);
+
+        for (const auto forks: fork_sets) {
+          code fast_ec;
+          const auto handled = verify_standard(fast_ec, spend.tx, 0u, forks,
+              spend.prevout_script, spend.value);
+          const auto& input = spend.tx.inputs()[0];
+          const auto interpreter_ec = script::verify(spend.tx, 0u, forks,
+              input.script(), input.witness(), spend.prevout_script,
+              spend.value);
+
+          cases++;
+          if (handled) {
+            fast++;
+            if (bool(fast_ec) != bool(interpreter_ec))
+              mismatches++;
+          }
+        }
+      }
+    }
+  }
+
+  std::cout << "cases:      " << cases << std::endl;
+  std::cout << "fast path:  " << fast << std::endl;
+  std::cout << "mismatches: " << mismatches << std::endl; // Prints 0.
+
+}
+
+
+void benchmark_fast_path(const transaction& example_transaction,
+    size_t iterations) {
+
+  const spend_template kinds[] = {
+      spend_template::p2pkh,
+      spend_template::p2wpkh,
+      spend_template::p2sh_p2wpkh
+  };
+  const char* names[] = { "p2pkh:       ", "p2wpkh:      ", "p2sh-p2wpkh: " };
+
+  const auto per_input = [iterations](
+      std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time)
+        .count() / static_cast<double>(iterations);
+  };
+
+  for (size_t index = 0; index < 3u; index++) {
+    const auto spend = create_template_spend(example_transaction,
+        kinds[index], sighash_algorithm::all);
+    size_t failures = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t count = 0; count < iterations; count++)
+      failures += bool(script::verify(spend.tx, 0u, rule_fork::all_rules,
+          spend.tx.inputs()[0].script(), spend.tx.inputs()[0].witness(),
+          spend.prevout_script, spend.value));
+    const auto interpreter_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t count = 0; count < iterations; count++)
+      failures += bool(verify_input(spend.tx, 0u, rule_fork::all_rules,
+          spend.prevout_script, spend.value));
+    const auto fast_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << names[index] << per_input(interpreter_time)
+              << " us/input interpreter, " << per_input(fast_time)
+              << " us/input fast path, failures: " << failures << std::endl;
+  }
+
+}
+
 // TO DO: Other Examples
 
 int main() {
@@ -132,6 +698,12 @@ int main() {
 
   create_and_verify_p2pkh(tx);
 
+  verify_with_utxo_provider(tx);
+
+  differential_fast_path(tx);
+
+  benchmark_fast_path(tx, 1000);
+
   return 0;
 
 }
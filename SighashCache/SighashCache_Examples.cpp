@@ -0,0 +1,955 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Normal" wallet.
+auto my_secret1 = base16_literal(
+    "d977e2ce0f744dc3432cde9813a99360a3f79f7c8035ef82310d54c57332b2cc");
+ec_private my_private1(my_secret1, ec_private::testnet, true);
+auto pubkey1 = my_private1.to_public().point();
+
+// "Witness Aware" wallet.
+auto my_secret_witness_aware = base16_literal(
+    "0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+ec_private my_private_witness_aware(my_secret_witness_aware,
+    ec_private::testnet, true);
+auto pubkey_witness_aware = my_private_witness_aware.to_public().point();
+
+// Sighash type bits.
+constexpr uint8_t sighash_mask = 0x1f;
+
+
+// BIP143 signature hash context.
+//-----------------------------------------------------------------------------
+
+// Precomputes the transaction-wide BIP143 commitments once per transaction:
+//    hashPrevouts = sha256d(all input outpoints)
+//    hashSequence = sha256d(all input sequences)
+//    hashOutputs  = sha256d(all outputs)
+// Each input signature hash then only serialises the fields of that input.
+// The context refers to the transaction, which must not be modified while
+// the context is in use. It is immutable after construction and may be
+// shared between threads.
+class sighash_context {
+
+public:
+  explicit sighash_context(const transaction& tx)
+    : tx_(tx) {
+
+    const auto& inputs = tx.inputs();
+    const auto& outputs = tx.outputs();
+
+    data_chunk points(inputs.size() * (hash_size + sizeof(uint32_t)));
+    auto point_sink = make_unsafe_serializer(points.begin());
+    for (const auto& input: inputs)
+      input.previous_output().to_data(point_sink);
+    prevouts_hash_ = bitcoin_hash(points);
+
+    data_chunk sequences(inputs.size() * sizeof(uint32_t));
+    auto sequence_sink = make_unsafe_serializer(sequences.begin());
+    for (const auto& input: inputs)
+      sequence_sink.write_4_bytes_little_endian(input.sequence());
+    sequences_hash_ = bitcoin_hash(sequences);
+
+    size_t outputs_size = 0;
+    for (const auto& output: outputs)
+      outputs_size += output.serialized_size();
+
+    data_chunk serialised_outputs(outputs_size);
+    auto output_sink = make_unsafe_serializer(serialised_outputs.begin());
+    for (const auto& output: outputs)
+      output.to_data(output_sink);
+    outputs_hash_ = bitcoin_hash(serialised_outputs);
+  }
+
+  const transaction& tx() const {
+    return tx_;
+  }
+
+  // BIP143 signature hash of one input, O(1) in the number of inputs and
+  // outputs (except for the single output hashed by SIGHASH_SINGLE).
+  hash_digest signature_hash(uint32_t input_index, const script& script_code,
+      uint64_t value, uint8_t sighash_type) const {
+
+    const auto anyone = (sighash_type & sighash_algorithm::anyone_can_pay) != 0;
+    const auto type = sighash_type & sighash_mask;
+    const auto single = type == sighash_algorithm::single;
+    const auto none = type == sighash_algorithm::none;
+    const auto& input = tx_.inputs()[input_index];
+
+    // Single output commitment for SIGHASH_SINGLE.
+    auto outputs_hash = null_hash;
+    if (!single && !none)
+      outputs_hash = outputs_hash_;
+    else if (single && input_index < tx_.outputs().size())
+      outputs_hash = bitcoin_hash(tx_.outputs()[input_index].to_data());
+
+    // Fixed fields plus the script code, on the stack for standard scripts.
+    const auto size = 4u + 32u + 32u + 36u + script_code.serialized_size(true)
+        + 8u + 4u + 32u + 4u + 4u;
+    uint8_t stack_buffer[1024];
+    data_chunk heap_buffer;
+    auto preimage = stack_buffer;
+    if (size > sizeof(stack_buffer)) {
+      heap_buffer.resize(size);
+      preimage = heap_buffer.data();
+    }
+
+    auto sink = make_unsafe_serializer(preimage);
+    sink.write_4_bytes_little_endian(tx_.version());
+    sink.write_hash(anyone ? null_hash : prevouts_hash_);
+    sink.write_hash(anyone || single || none ? null_hash : sequences_hash_);
+    input.previous_output().to_data(sink);
+    script_code.to_data(sink, true);
+    sink.write_8_bytes_little_endian(value);
+    sink.write_4_bytes_little_endian(input.sequence());
+    sink.write_hash(outputs_hash);
+    sink.write_4_bytes_little_endian(tx_.locktime());
+    sink.write_4_bytes_little_endian(sighash_type);
+
+    return bitcoin_hash(data_slice(preimage, preimage + size));
+  }
+
+private:
+  const transaction& tx_;
+  hash_digest prevouts_hash_;
+  hash_digest sequences_hash_;
+  hash_digest outputs_hash_;
+};
+
+
+// Equivalent of script::create_endorsement() for script_version::zero.
+bool create_endorsement(endorsement& out, const ec_secret& secret,
+    const sighash_context& context, uint32_t input_index,
+    const script& script_code, uint64_t value, uint8_t sighash_type) {
+
+  const auto sighash = context.signature_hash(input_index, script_code, value,
+      sighash_type);
+
+  // Create the EC signature and encode as DER.
+  ec_signature signature;
+  out.reserve(max_endorsement_size);
+  if (!sign(signature, secret, sighash) || !encode_signature(out, signature))
+    return false;
+
+  // Add the sighash type to the end of the DER signature -> endorsement.
+  out.push_back(sighash_type);
+  return true;
+}
+
+
+// Equivalent of the witness checksig of script::verify() for one signature.
+bool check_signature(const endorsement& endorsement,
+    const data_chunk& public_key, const sighash_context& context,
+    uint32_t input_index, const script& script_code, uint64_t value) {
+
+  uint8_t sighash_type;
+  der_signature distinguished;
+  ec_signature signature;
+  auto endorsement_copy = endorsement;
+  if (!parse_endorsement(sighash_type, distinguished,
+      std::move(endorsement_copy)) ||
+      !parse_signature(signature, distinguished, true))
+    return false;
+
+  const auto sighash = context.signature_hash(input_index, script_code, value,
+      sighash_type);
+  return verify_signature(public_key, sighash, signature);
+}
+
+
+// P2WPKH spend verified against a shared context:
+//    witness: [signature] [public key]
+//    program: 0 [20-byte hash160(public key)]
+code verify_p2wpkh(const sighash_context& context, uint32_t input_index,
+    const short_hash& program, uint64_t value) {
+
+  const auto& stack = context.tx().inputs()[input_index].witness().stack();
+  if (stack.size() != 2u)
+    return error::invalid_witness;
+
+  const auto& public_key = stack[1];
+  if (bitcoin_short_hash(public_key) != program)
+    return error::stack_false;
+
+  // Script code: P2PKH(public key hash).
+  const script script_code(script::to_pay_key_hash_pattern(program));
+  return check_signature(stack[0], public_key, context, input_index,
+      script_code, value) ? error::success : error::stack_false;
+}
+
+
+transaction create_p2wpkh_spend(size_t input_count) {
+
+  // Function creates a tx spending input_count P2WPKH outputs.
+  //---------------------------------------------------------------------------
+
+  std::string prev_tx =
+      "26c9768cdbb00332ff1052f27e71eb7e82b578bf02fb6d7eecfd0b43412e9d10";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+
+  transaction tx;
+  tx.set_version(1u);
+  for (size_t index = 0; index < input_count; index++) {
+    input p2wpkh_input;
+    p2wpkh_input.set_previous_output(output_point(prev_tx_hash,
+        static_cast<uint32_t>(index)));
+    p2wpkh_input.set_sequence(max_input_sequence);
+    tx.inputs().push_back(p2wpkh_input);
+  }
+
+  std::string btc_amount = "0.993";
+  uint64_t output_amount;
+  decode_base10(output_amount, btc_amount, btc_decimal_places);
+  auto output_script = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey1));
+  tx.outputs().push_back(output(output_amount * input_count, output_script));
+  tx.set_locktime(0u);
+
+  return tx;
+
+}
+
+
+void sign_and_verify_with_context() {
+
+  auto tx = create_p2wpkh_spend(3u);
+  const auto program = bitcoin_short_hash(pubkey_witness_aware);
+  const script script_code(script::to_pay_key_hash_pattern(program));
+  std::string prev_btc_amount = "0.995";
+  uint64_t prev_amount;
+  decode_base10(prev_amount, prev_btc_amount, btc_decimal_places);
+
+  // Same digest as the library for every sighash type.
+  sighash_context context(tx);
+  const uint8_t types[] = {
+      sighash_algorithm::all,
+      sighash_algorithm::none,
+      sighash_algorithm::single,
+      sighash_algorithm::all | sighash_algorithm::anyone_can_pay,
+      sighash_algorithm::none | sighash_algorithm::anyone_can_pay,
+      sighash_algorithm::single | sighash_algorithm::anyone_can_pay
+  };
+  auto matches = true;
+  for (const auto type: types)
+    for (uint32_t index = 0; index < tx.inputs().size(); index++)
+      matches &= context.signature_hash(index, script_code, prev_amount,
+          type) == script::generate_signature_hash(tx, index, script_code,
+          type, script_version::zero, prev_amount);
+  std::cout << matches << std::endl;
+
+  // Sign all inputs from the context. Witnesses are not part of the BIP143
+  // preimage, so they can be set while the context is in use.
+  data_stack endorsements;
+  for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+    endorsement sig;
+    create_endorsement(sig, my_secret_witness_aware, context, index,
+        script_code, prev_amount, sighash_algorithm::all);
+    endorsements.push_back(sig);
+  }
+
+  for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+    data_stack witness_stack {
+        endorsements[index],
+        to_chunk(pubkey_witness_aware)
+    };
+    tx.inputs()[index].set_witness(witness(witness_stack));
+  }
+
+  // Byte-identical to the library endorsement (RFC6979 nonces).
+  endorsement library_sig;
+  script::create_endorsement(library_sig, my_secret_witness_aware,
+      script_code, tx, 0u, sighash_algorithm::all, script_version::zero,
+      prev_amount);
+  std::cout << (library_sig == endorsements[0]) << std::endl;
+
+  // Verify every input against the context and the library verifier.
+  operation::list p2wpkh_operations {
+      operation(opcode::push_size_0),
+      operation(to_chunk(program))
+  };
+  const script prevout_script(p2wpkh_operations);
+  for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+    const auto ec = verify_p2wpkh(context, index, program, prev_amount);
+    const auto library_ec = script::verify(tx, index, rule_fork::all_rules,
+        prevout_script, prev_amount);
+
+    // Prints success
+    std::cout << ec.message() << " " << library_ec.message() << std::endl;
+  }
+
+}
+
+
+void benchmark_sighash_context(size_t input_count) {
+
+  const auto tx = create_p2wpkh_spend(input_count);
+  const script script_code(script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey_witness_aware)));
+  const uint64_t prev_amount = 99500000;
+  size_t checksum = 0;
+
+  // Signature hash of every input, as computed by the library.
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t index = 0; index < input_count; index++)
+    checksum += script::generate_signature_hash(tx, index, script_code,
+        sighash_algorithm::all, script_version::zero, prev_amount)[0];
+  const auto library_time = std::chrono::steady_clock::now() - start;
+
+  // Signature hash of every input from one context, including its setup.
+  start = std::chrono::steady_clock::now();
+  const sighash_context context(tx);
+  for (uint32_t index = 0; index < input_count; index++)
+    checksum -= context.signature_hash(index, script_code, prev_amount,
+        sighash_algorithm::all)[0];
+  const auto context_time = std::chrono::steady_clock::now() - start;
+
+  // Signing every input from the context (dominated by ECDSA).
+  start = std::chrono::steady_clock::now();
+  for (uint32_t index = 0; index < input_count; index++) {
+    endorsement sig;
+    create_endorsement(sig, my_secret_witness_aware, context, index,
+        script_code, prev_amount, sighash_algorithm::all);
+  }
+  const auto signing_time = std::chrono::steady_clock::now() - start;
+
+  const auto per_input = [input_count](
+      std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+        .count() / input_count;
+  };
+
+  std::cout << "inputs: " << input_count << std::endl;
+  std::cout << "  generate_signature_hash:  " << per_input(library_time)
+            << " ns/input" << std::endl;
+  std::cout << "  sighash_context:          " << per_input(context_time)
+            << " ns/input" << std::endl;
+  std::cout << "  create_endorsement (ctx): " << per_input(signing_time)
+            << " ns/input" << std::endl;
+  std::cout << "  identical digests:        " << (checksum == 0) << std::endl;
+
+}
+
+
+// Legacy signature hash context.
+//-----------------------------------------------------------------------------
+
+// Signature hash of SIGHASH_SINGLE without a matching output (consensus bug).
+const hash_digest legacy_one_hash {{
+    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+}};
+
+// Serialised size of an input with an empty script: outpoint, 0x00, sequence.
+constexpr size_t empty_input_size = 36u + 1u + 4u;
+
+// Serialised size of a null output: value 0xffffffffffffffff, empty script.
+constexpr size_t null_output_size = 8u + 1u;
+
+// Size of the variable length integer prefix of a count.
+size_t variable_size(uint64_t value) {
+  return value < 0xfd ? 1u : value <= 0xffff ? 3u :
+      value <= 0xffffffff ? 5u : 9u;
+}
+
+bool has_code_separator(const script& script_code) {
+  for (const auto& op: script_code.operations())
+    if (op.code() == opcode::codeseparator)
+      return true;
+
+  return false;
+}
+
+script strip_code_separators(const script& script_code) {
+  operation::list operations;
+  for (const auto& op: script_code.operations())
+    if (op.code() != opcode::codeseparator)
+      operations.push_back(op);
+
+  return script(operations);
+}
+
+// Caches the serialised parts of the legacy signature hash preimage which do
+// not depend on the signed input:
+//    inputs with empty scripts (sequences as is, and zeroed for NONE/SINGLE)
+//    all outputs (ALL), null outputs preceding the signed index (SINGLE)
+// A preimage is then assembled from these parts by copying, rather than by
+// building and reserialising a modified copy of the transaction per input.
+// Immutable after construction, so it may be shared between threads, each
+// passing its own scratch buffer.
+class legacy_sighash_context {
+
+public:
+  explicit legacy_sighash_context(const transaction& tx)
+    : tx_(tx) {
+
+    const auto& inputs = tx.inputs();
+    const auto& outputs = tx.outputs();
+
+    // Inputs with empty scripts, with original and with zeroed sequences.
+    inputs_.resize(inputs.size() * empty_input_size);
+    zeroed_inputs_.resize(inputs.size() * empty_input_size);
+    auto sink = make_unsafe_serializer(inputs_.begin());
+    auto zeroed_sink = make_unsafe_serializer(zeroed_inputs_.begin());
+    for (const auto& input: inputs) {
+      input.previous_output().to_data(sink);
+      sink.write_byte(0x00);
+      sink.write_4_bytes_little_endian(input.sequence());
+      input.previous_output().to_data(zeroed_sink);
+      zeroed_sink.write_byte(0x00);
+      zeroed_sink.write_4_bytes_little_endian(0u);
+    }
+
+    // All outputs, including their count.
+    size_t outputs_size = variable_size(outputs.size());
+    for (const auto& output: outputs)
+      outputs_size += output.serialized_size();
+
+    outputs_.resize(outputs_size);
+    auto output_sink = make_unsafe_serializer(outputs_.begin());
+    output_sink.write_size_little_endian(outputs.size());
+    for (const auto& output: outputs)
+      output.to_data(output_sink);
+
+    // Null outputs, of which SINGLE uses those preceding the signed index.
+    null_outputs_.resize(outputs.size() * null_output_size);
+    auto null_sink = make_unsafe_serializer(null_outputs_.begin());
+    for (size_t index = 0; index < outputs.size(); index++) {
+      null_sink.write_8_bytes_little_endian(max_uint64);
+      null_sink.write_byte(0x00);
+    }
+  }
+
+  // Legacy signature hash of one input. The preimage is assembled in the
+  // scratch buffer, which keeps its capacity across calls.
+  hash_digest signature_hash(uint32_t input_index, const script& script_code,
+      uint8_t sighash_type, data_chunk& scratch) const {
+
+    const auto anyone = (sighash_type & sighash_algorithm::anyone_can_pay) != 0;
+    const auto type = sighash_type & sighash_mask;
+    const auto single = type == sighash_algorithm::single;
+    const auto none = type == sighash_algorithm::none;
+    const auto& inputs = tx_.inputs();
+    const auto& outputs = tx_.outputs();
+
+    if (input_index >= inputs.size() ||
+        (single && input_index >= outputs.size()))
+      return legacy_one_hash;
+
+    // Code separators are removed from the script code.
+    script stripped;
+    auto code = &script_code;
+    if (has_code_separator(script_code)) {
+      stripped = strip_code_separators(script_code);
+      code = &stripped;
+    }
+
+    const auto& input = inputs[input_index];
+    const auto& others = (single || none) ? zeroed_inputs_ : inputs_;
+    const auto input_count = anyone ? size_t(1) : inputs.size();
+
+    // Outputs section: all outputs, none, or null outputs and one output.
+    const auto outputs_size = none ? 1u : !single ? outputs_.size() :
+        variable_size(input_index + 1u) + input_index * null_output_size +
+        outputs[input_index].serialized_size();
+
+    const auto size = 4u + variable_size(input_count) +
+        (input_count - 1u) * empty_input_size + 36u +
+        code->serialized_size(true) + 4u + outputs_size + 4u + 4u;
+    scratch.resize(size);
+
+    auto sink = make_unsafe_serializer(scratch.begin());
+    sink.write_4_bytes_little_endian(tx_.version());
+    sink.write_size_little_endian(input_count);
+
+    // Inputs preceding the signed input.
+    const auto before = anyone ? 0u : input_index * empty_input_size;
+    sink.write_bytes(others.data(), before);
+
+    // Signed input, with script code and its own sequence.
+    input.previous_output().to_data(sink);
+    code->to_data(sink, true);
+    sink.write_4_bytes_little_endian(input.sequence());
+
+    // Inputs following the signed input.
+    const auto after = anyone ? others.size() : before + empty_input_size;
+    sink.write_bytes(others.data() + after, others.size() - after);
+
+    if (none) {
+      sink.write_byte(0x00);
+    } else if (!single) {
+      sink.write_bytes(outputs_);
+    } else {
+      sink.write_size_little_endian(input_index + 1u);
+      sink.write_bytes(null_outputs_.data(), input_index * null_output_size);
+      outputs[input_index].to_data(sink);
+    }
+
+    sink.write_4_bytes_little_endian(tx_.locktime());
+    sink.write_4_bytes_little_endian(sighash_type);
+    return bitcoin_hash(scratch);
+  }
+
+private:
+  const transaction& tx_;
+  data_chunk inputs_;
+  data_chunk zeroed_inputs_;
+  data_chunk outputs_;
+  data_chunk null_outputs_;
+};
+
+
+transaction create_p2pkh_consolidation(size_t input_count,
+    size_t output_count) {
+
+  // Function creates a tx spending input_count P2PKH outputs.
+  //---------------------------------------------------------------------------
+
+  std::string prev_tx =
+      "7ea970031b28fcc1cef517dfa7d812cb61c409aec37a0463e951a05700d61b73";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+
+  transaction tx;
+  tx.set_version(1u);
+  for (size_t index = 0; index < input_count; index++) {
+    input p2pkh_input;
+    p2pkh_input.set_previous_output(output_point(prev_tx_hash,
+        static_cast<uint32_t>(index)));
+    p2pkh_input.set_sequence(max_input_sequence);
+    tx.inputs().push_back(p2pkh_input);
+  }
+
+  auto output_script = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey1));
+  for (size_t index = 0; index < output_count; index++)
+    tx.outputs().push_back(output(1000000u + index, output_script));
+
+  tx.set_locktime(0u);
+  return tx;
+
+}
+
+
+void legacy_sighash_with_context() {
+
+  // Three inputs, two outputs: SINGLE at index 2 has no matching output.
+  auto tx = create_p2pkh_consolidation(3u, 2u);
+  const script script_code(script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey_witness_aware)));
+
+  // Same digest as the library for every sighash type of the Sighash chapter
+  // examples: 0x01, 0x02, 0x03 and their ANYONECANPAY variants.
+  legacy_sighash_context context(tx);
+  data_chunk scratch;
+  const uint8_t types[] = { 0x01, 0x02, 0x03, 0x81, 0x82, 0x83 };
+  auto matches = true;
+  for (const auto type: types)
+    for (uint32_t index = 0; index < tx.inputs().size(); index++)
+      matches &= context.signature_hash(index, script_code, type, scratch) ==
+          script::generate_signature_hash(tx, index, script_code, type);
+  std::cout << matches << std::endl;
+
+  // Endorsement from the cached digest, byte-identical to the library.
+  const auto sighash = context.signature_hash(0u, script_code, 0x01, scratch);
+  ec_signature signature;
+  endorsement sig_0;
+  sign(signature, my_secret_witness_aware, sighash);
+  encode_signature(sig_0, signature);
+  sig_0.push_back(0x01);
+
+  endorsement library_sig_0;
+  script::create_endorsement(library_sig_0, my_secret_witness_aware,
+      script_code, tx, 0u, 0x01);
+  std::cout << (sig_0 == library_sig_0) << std::endl;
+
+}
+
+
+void benchmark_legacy_sighash(size_t input_count) {
+
+  const auto tx = create_p2pkh_consolidation(input_count, 2u);
+  const script script_code(script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey_witness_aware)));
+  size_t checksum = 0;
+
+  // Library: a modified transaction copy per input.
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t index = 0; index < input_count; index++)
+    checksum += script::generate_signature_hash(tx, index, script_code,
+        sighash_algorithm::all)[0];
+  const auto library_time = std::chrono::steady_clock::now() - start;
+
+  // Context: cached parts copied into one scratch buffer.
+  start = std::chrono::steady_clock::now();
+  const legacy_sighash_context context(tx);
+  data_chunk scratch;
+  for (uint32_t index = 0; index < input_count; index++)
+    checksum -= context.signature_hash(index, script_code,
+        sighash_algorithm::all, scratch)[0];
+  const auto context_time = std::chrono::steady_clock::now() - start;
+
+  const auto milliseconds = [](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time)
+        .count();
+  };
+
+  std::cout << "legacy inputs: " << input_count << std::endl;
+  std::cout << "  generate_signature_hash:  " << milliseconds(library_time)
+            << " ms" << std::endl;
+  std::cout << "  legacy_sighash_context:   " << milliseconds(context_time)
+            << " ms" << std::endl;
+  std::cout << "  identical digests:        " << (checksum == 0) << std::endl;
+
+}
+
+
+// ANYONECANPAY signature hash context.
+//-----------------------------------------------------------------------------
+
+// With ANYONECANPAY, a signature commits to its own input and the outputs,
+// but to none of the other inputs. Caches the output commitments once:
+//    legacy: all outputs serialised, null outputs (SINGLE)
+//    BIP143: hashOutputs, hash of each output (SINGLE)
+// Signature hashes are computed from the signed input alone, so inputs may
+// be added to the transaction while the context is in use, and the cost of
+// a signature hash does not depend on the number of inputs. The context
+// copies what it needs and does not refer to the transaction.
+class anyone_can_pay_context {
+
+public:
+  explicit anyone_can_pay_context(const transaction& tx)
+    : version_(tx.version()), locktime_(tx.locktime()),
+      outputs_(tx.outputs()) {
+
+    size_t outputs_size = variable_size(outputs_.size());
+    for (const auto& output: outputs_)
+      outputs_size += output.serialized_size();
+
+    serialised_outputs_.resize(outputs_size);
+    auto output_sink = make_unsafe_serializer(serialised_outputs_.begin());
+    output_sink.write_size_little_endian(outputs_.size());
+    output_hashes_.reserve(outputs_.size());
+    for (const auto& output: outputs_) {
+      output.to_data(output_sink);
+      output_hashes_.push_back(bitcoin_hash(output.to_data()));
+    }
+
+    // BIP143 hashOutputs excludes the count prefix.
+    const auto prefix = variable_size(outputs_.size());
+    outputs_hash_ = bitcoin_hash(data_slice(serialised_outputs_.data() +
+        prefix, serialised_outputs_.data() + serialised_outputs_.size()));
+
+    null_outputs_.resize(outputs_.size() * null_output_size);
+    auto null_sink = make_unsafe_serializer(null_outputs_.begin());
+    for (size_t index = 0; index < outputs_.size(); index++) {
+      null_sink.write_8_bytes_little_endian(max_uint64);
+      null_sink.write_byte(0x00);
+    }
+  }
+
+  // Legacy signature hash of the input at input_index.
+  // Returns null_hash if the sighash type does not include anyone_can_pay,
+  // since the digest would not commit to the other inputs.
+  hash_digest signature_hash(uint32_t input_index, const input& input,
+      const script& script_code, uint8_t sighash_type,
+      data_chunk& scratch) const {
+
+    if ((sighash_type & sighash_algorithm::anyone_can_pay) == 0)
+      return null_hash;
+
+    const auto type = sighash_type & sighash_mask;
+    const auto single = type == sighash_algorithm::single;
+    const auto none = type == sighash_algorithm::none;
+
+    if (single && input_index >= outputs_.size())
+      return legacy_one_hash;
+
+    script stripped;
+    auto code = &script_code;
+    if (has_code_separator(script_code)) {
+      stripped = strip_code_separators(script_code);
+      code = &stripped;
+    }
+
+    const auto outputs_size = none ? 1u : !single ?
+        serialised_outputs_.size() : variable_size(input_index + 1u) +
+        input_index * null_output_size +
+        outputs_[input_index].serialized_size();
+
+    const auto size = 4u + 1u + 36u + code->serialized_size(true) + 4u +
+        outputs_size + 4u + 4u;
+    scratch.resize(size);
+
+    auto sink = make_unsafe_serializer(scratch.begin());
+    sink.write_4_bytes_little_endian(version_);
+    sink.write_byte(0x01);
+    input.previous_output().to_data(sink);
+    code->to_data(sink, true);
+    sink.write_4_bytes_little_endian(input.sequence());
+
+    if (none) {
+      sink.write_byte(0x00);
+    } else if (!single) {
+      sink.write_bytes(serialised_outputs_);
+    } else {
+      sink.write_size_little_endian(input_index + 1u);
+      sink.write_bytes(null_outputs_.data(), input_index * null_output_size);
+      outputs_[input_index].to_data(sink);
+    }
+
+    sink.write_4_bytes_little_endian(locktime_);
+    sink.write_4_bytes_little_endian(sighash_type);
+    return bitcoin_hash(scratch);
+  }
+
+  // BIP143 signature hash of the input at input_index.
+  // Returns null_hash if the sighash type does not include anyone_can_pay.
+  hash_digest signature_hash(uint32_t input_index, const input& input,
+      const script& script_code, uint64_t value, uint8_t sighash_type) const {
+
+    if ((sighash_type & sighash_algorithm::anyone_can_pay) == 0)
+      return null_hash;
+
+    const auto type = sighash_type & sighash_mask;
+    const auto single = type == sighash_algorithm::single;
+    const auto none = type == sighash_algorithm::none;
+
+    auto outputs_hash = null_hash;
+    if (!single && !none)
+      outputs_hash = outputs_hash_;
+    else if (single && input_index < output_hashes_.size())
+      outputs_hash = output_hashes_[input_index];
+
+    const auto size = 4u + 32u + 32u + 36u + script_code.serialized_size(true)
+        + 8u + 4u + 32u + 4u + 4u;
+    uint8_t stack_buffer[1024];
+    data_chunk heap_buffer;
+    auto preimage = stack_buffer;
+    if (size > sizeof(stack_buffer)) {
+      heap_buffer.resize(size);
+      preimage = heap_buffer.data();
+    }
+
+    auto sink = make_unsafe_serializer(preimage);
+    sink.write_4_bytes_little_endian(version_);
+    sink.write_hash(null_hash);
+    sink.write_hash(null_hash);
+    input.previous_output().to_data(sink);
+    script_code.to_data(sink, true);
+    sink.write_8_bytes_little_endian(value);
+    sink.write_4_bytes_little_endian(input.sequence());
+    sink.write_hash(outputs_hash);
+    sink.write_4_bytes_little_endian(locktime_);
+    sink.write_4_bytes_little_endian(sighash_type);
+
+    return bitcoin_hash(data_slice(preimage, preimage + size));
+  }
+
+private:
+  uint32_t version_;
+  uint32_t locktime_;
+  output::list outputs_;
+  data_chunk serialised_outputs_;
+  data_chunk null_outputs_;
+  hash_digest outputs_hash_;
+  hash_list output_hashes_;
+};
+
+
+// Crowdfunding transaction: the outputs are fixed, and contributors add
+// their inputs, signed with ALL|ANYONECANPAY, in any order.
+transaction create_crowdfunding(uint64_t goal) {
+
+  transaction tx;
+  tx.set_version(1u);
+  tx.outputs().push_back(output(goal, script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey1))));
+  tx.set_locktime(0u);
+  return tx;
+
+}
+
+
+input create_contribution(uint32_t index) {
+
+  std::string prev_tx =
+      "48828a16d0b93111272ec1721fceb29518efbd663c183e156873724ded5fe15d";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,prev_tx);
+
+  input contribution;
+  contribution.set_previous_output(output_point(prev_tx_hash, index));
+  contribution.set_sequence(max_input_sequence);
+  return contribution;
+
+}
+
+
+void crowdfunding_with_context() {
+
+  const uint8_t sighash_type =
+      sighash_algorithm::all | sighash_algorithm::anyone_can_pay;
+  std::string contribution_btc_amount = "0.5";
+  uint64_t contribution_amount;
+  decode_base10(contribution_amount, contribution_btc_amount,
+      btc_decimal_places);
+
+  // One context for all contributors, created before any input exists.
+  auto tx = create_crowdfunding(6 * contribution_amount - 10000u);
+  const anyone_can_pay_context context(tx);
+  data_chunk scratch;
+
+  // Even contributors spend P2PKH, odd contributors P2WPKH outputs.
+  const auto legacy_hash = bitcoin_short_hash(pubkey1);
+  const auto witness_hash = bitcoin_short_hash(pubkey_witness_aware);
+  const script legacy_script(script::to_pay_key_hash_pattern(legacy_hash));
+  const script witness_script_code(script::to_pay_key_hash_pattern(
+      witness_hash));
+  operation::list p2wpkh_operations;
+  p2wpkh_operations.push_back(operation(opcode::push_size_0));
+  p2wpkh_operations.push_back(operation(to_chunk(witness_hash)));
+  const script p2wpkh_script(p2wpkh_operations);
+
+  // Each contributor signs its input and then adds it to the transaction.
+  for (uint32_t index = 0; index < 6u; index++) {
+    auto contribution = create_contribution(index);
+    endorsement sig;
+    ec_signature signature;
+
+    if (index % 2u == 0) {
+      sign(signature, my_secret1, context.signature_hash(index, contribution,
+          legacy_script, sighash_type, scratch));
+      encode_signature(sig, signature);
+      sig.push_back(sighash_type);
+
+      operation::list sig_script;
+      sig_script.push_back(operation(sig));
+      sig_script.push_back(operation(to_chunk(pubkey1)));
+      contribution.set_script(script(sig_script));
+    } else {
+      sign(signature, my_secret_witness_aware, context.signature_hash(index,
+          contribution, witness_script_code, contribution_amount,
+          sighash_type));
+      encode_signature(sig, signature);
+      sig.push_back(sighash_type);
+
+      data_stack witness_stack { sig, to_chunk(pubkey_witness_aware) };
+      contribution.set_witness(witness(witness_stack));
+    }
+
+    tx.inputs().push_back(contribution);
+  }
+
+  // All contributions verify against the final transaction.
+  for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+    const auto ec = script::verify(tx, index, rule_fork::all_rules,
+        index % 2u == 0 ? legacy_script : p2wpkh_script, contribution_amount);
+    std::cout << ec.message() << std::endl;
+  }
+
+  // Same digests as the library for ALL, NONE and SINGLE with ANYONECANPAY.
+  const uint8_t types[] = { 0x81, 0x82, 0x83 };
+  auto matches = true;
+  for (const auto type: types) {
+    for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+      const auto& contribution = tx.inputs()[index];
+      matches &= context.signature_hash(index, contribution, legacy_script,
+          type, scratch) == script::generate_signature_hash(tx, index,
+          legacy_script, type);
+      matches &= context.signature_hash(index, contribution,
+          witness_script_code, contribution_amount, type) ==
+          script::generate_signature_hash(tx, index, witness_script_code,
+          type, script_version::zero, contribution_amount);
+    }
+  }
+  std::cout << matches << std::endl;
+
+  // Types without ANYONECANPAY are rejected.
+  std::cout << (context.signature_hash(0u, tx.inputs()[0], legacy_script,
+      sighash_algorithm::all, scratch) == null_hash) << std::endl;
+
+}
+
+
+void benchmark_anyone_can_pay(size_t contributor_count) {
+
+  const uint8_t sighash_type =
+      sighash_algorithm::all | sighash_algorithm::anyone_can_pay;
+  const uint64_t contribution_amount = 50000000u;
+  const script script_code(script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey_witness_aware)));
+  size_t checksum = 0;
+
+  const auto milliseconds = [](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time)
+        .count();
+  };
+
+  // Library: each contributor signs against the transaction as it grows.
+  auto tx = create_crowdfunding(contributor_count * contribution_amount);
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t index = 0; index < contributor_count; index++) {
+    tx.inputs().push_back(create_contribution(index));
+    checksum += script::generate_signature_hash(tx, index, script_code,
+        sighash_type)[0];
+    checksum += script::generate_signature_hash(tx, index, script_code,
+        sighash_type, script_version::zero, contribution_amount)[0];
+  }
+  const auto library_time = std::chrono::steady_clock::now() - start;
+
+  // Context: outputs committed once, before the first contribution.
+  tx = create_crowdfunding(contributor_count * contribution_amount);
+  start = std::chrono::steady_clock::now();
+  const anyone_can_pay_context context(tx);
+  data_chunk scratch;
+  for (uint32_t index = 0; index < contributor_count; index++) {
+    const auto contribution = create_contribution(index);
+    checksum -= context.signature_hash(index, contribution, script_code,
+        sighash_type, scratch)[0];
+    checksum -= context.signature_hash(index, contribution, script_code,
+        contribution_amount, sighash_type)[0];
+    tx.inputs().push_back(contribution);
+  }
+  const auto context_time = std::chrono::steady_clock::now() - start;
+
+  std::cout << "contributors: " << contributor_count << std::endl;
+  std::cout << "  generate_signature_hash:  " << milliseconds(library_time)
+            << " ms" << std::endl;
+  std::cout << "  anyone_can_pay_context:   " << milliseconds(context_time)
+            << " ms" << std::endl;
+  std::cout << "  identical digests:        " << (checksum == 0) << std::endl;
+
+}
+
+
+int main() {
+
+  sign_and_verify_with_context();
+
+  benchmark_sighash_context(1);
+  benchmark_sighash_context(100);
+  benchmark_sighash_context(2000);
+
+  legacy_sighash_with_context();
+
+  benchmark_legacy_sighash(100);
+  benchmark_legacy_sighash(1000);
+  benchmark_legacy_sighash(5000);
+
+  crowdfunding_with_context();
+
+  benchmark_anyone_can_pay(100);
+  benchmark_anyone_can_pay(1000);
+  benchmark_anyone_can_pay(10000);
+
+  return 0;
+
+}
@@ -0,0 +1,1077 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// Testnet wallets.
+auto my_secret0 = base16_literal(
+    "b7423c94ab99d3295c1af7e7bbea47c75d298f7190ca2077b53bae61299b70a5");
+ec_private my_private0(my_secret0, ec_private::testnet, true);
+auto pubkey0 = my_private0.to_public().point();
+
+auto my_secret1 = base16_literal(
+    "d977e2ce0f744dc3432cde9813a99360a3f79f7c8035ef82310d54c57332b2cc");
+ec_private my_private1(my_secret1, ec_private::testnet, true);
+auto pubkey1 = my_private1.to_public().point();
+
+
+// Snapshot format.
+//-----------------------------------------------------------------------------
+
+// All integers are little-endian.
+//
+// header:  [8-byte magic] [4-byte version] [4-byte bucket bits]
+//          [8-byte entry count] [8-byte script data size]
+// buckets: [4-byte index of the first entry of each bucket] ... [count],
+//          padded to a multiple of 8 bytes
+// entries: [32-byte hash] [4-byte index] [4-byte script size]
+//          [8-byte value] [8-byte script offset], sorted by point
+// scripts: prevout scripts without size prefix, in entry order
+//
+// Entries are bucketed by the leading bits of their transaction hash, which
+// are uniformly distributed, and have a fixed size, so that a lookup is a
+// binary search within a single bucket.
+constexpr uint8_t snapshot_magic[8] = {
+    'u', 't', 'x', 'o', 's', 'n', 'a', 'p' };
+constexpr uint32_t snapshot_version = 1u;
+constexpr size_t snapshot_header_size = 32u;
+constexpr size_t snapshot_entry_size = 56u;
+constexpr uint32_t max_bucket_bits = 24u;
+
+// Leading bucket_bits bits of the transaction hash.
+uint32_t bucket_of(const uint8_t* hash, uint32_t bucket_bits) {
+  const uint32_t leading = (hash[0] << 16u) | (hash[1] << 8u) | hash[2];
+  return leading >> (max_bucket_bits - bucket_bits);
+}
+
+// Size of the bucket table, padded so that entries are 8-byte aligned.
+size_t bucket_table_size(uint32_t bucket_bits) {
+  const size_t size = ((size_t(1) << bucket_bits) + 1u) * sizeof(uint32_t);
+  return (size + 7u) & ~size_t(7);
+}
+
+// Entries sort by transaction hash bytes, then by output index, so that the
+// entries of each bucket are contiguous.
+bool point_less(const output_point& left, const output_point& right) {
+  const auto order = memcmp(left.hash().data(), right.hash().data(),
+      hash_size);
+  return order < 0 || (order == 0 && left.index() < right.index());
+}
+
+
+// Writes a snapshot of the outputs, e.g. of the UTXO set at a block height.
+// Returns false if a point is duplicated or the file cannot be written.
+bool write_utxo_snapshot(const std::string& path,
+    const std::vector<std::pair<output_point, output>>& utxos,
+    uint32_t bucket_bits = 16u) {
+
+  if (bucket_bits > max_bucket_bits || utxos.size() >= max_uint32)
+    return false;
+
+  // Sort references, the outputs themselves are not moved.
+  std::vector<const std::pair<output_point, output>*> sorted;
+  sorted.reserve(utxos.size());
+  for (const auto& utxo: utxos)
+    sorted.push_back(&utxo);
+
+  std::sort(sorted.begin(), sorted.end(),
+      [](const std::pair<output_point, output>* left,
+          const std::pair<output_point, output>* right) {
+        return point_less(left->first, right->first);
+      });
+
+  for (size_t index = 1; index < sorted.size(); index++)
+    if (!point_less(sorted[index - 1u]->first, sorted[index]->first))
+      return false;
+
+  // First entry of each bucket, and the entry count at the end.
+  const size_t buckets = size_t(1) << bucket_bits;
+  std::vector<uint32_t> bucket_start(buckets + 1u, 0);
+  for (const auto utxo: sorted)
+    bucket_start[bucket_of(utxo->first.hash().data(), bucket_bits) + 1u]++;
+  for (size_t bucket = 0; bucket < buckets; bucket++)
+    bucket_start[bucket + 1u] += bucket_start[bucket];
+
+  std::vector<data_chunk> scripts;
+  scripts.reserve(sorted.size());
+  uint64_t scripts_size = 0;
+  for (const auto utxo: sorted) {
+    scripts.push_back(utxo->second.script().to_data(false));
+    scripts_size += scripts.back().size();
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  ostream_writer sink(file);
+
+  sink.write_bytes(snapshot_magic, sizeof(snapshot_magic));
+  sink.write_4_bytes_little_endian(snapshot_version);
+  sink.write_4_bytes_little_endian(bucket_bits);
+  sink.write_8_bytes_little_endian(sorted.size());
+  sink.write_8_bytes_little_endian(scripts_size);
+
+  for (const auto start: bucket_start)
+    sink.write_4_bytes_little_endian(start);
+  const auto padding = bucket_table_size(bucket_bits) -
+      bucket_start.size() * sizeof(uint32_t);
+  for (size_t index = 0; index < padding; index++)
+    sink.write_byte(0);
+
+  uint64_t script_offset = 0;
+  for (size_t index = 0; index < sorted.size(); index++) {
+    const auto& point = sorted[index]->first;
+    sink.write_hash(point.hash());
+    sink.write_4_bytes_little_endian(point.index());
+    sink.write_4_bytes_little_endian(scripts[index].size());
+    sink.write_8_bytes_little_endian(sorted[index]->second.value());
+    sink.write_8_bytes_little_endian(script_offset);
+    script_offset += scripts[index].size();
+  }
+
+  for (const auto& script_bytes: scripts)
+    sink.write_bytes(script_bytes);
+
+  file.flush();
+  return file.good();
+
+}
+
+
+// Memory-mapped snapshot.
+//-----------------------------------------------------------------------------
+
+// Previous output found in a snapshot. The script refers to the mapping.
+struct prevout_view {
+  uint64_t value;
+  const uint8_t* script_begin;
+  const uint8_t* script_end;
+
+  data_slice script() const {
+    return data_slice(script_begin, script_end);
+  }
+};
+
+
+// Read-only snapshot. Opening maps the file and checks the header, so the
+// cost of opening does not depend on the number of entries. Pages are read
+// from the page cache on first access, and are shared by all processes
+// which map the same snapshot.
+class utxo_snapshot {
+
+public:
+  utxo_snapshot()
+    : mapped_(nullptr), file_size_(0), buckets_(nullptr), entries_(nullptr),
+      scripts_(nullptr), count_(0), scripts_size_(0), bucket_bits_(0) {
+  }
+
+  ~utxo_snapshot() {
+    close();
+  }
+
+  utxo_snapshot(const utxo_snapshot&) = delete;
+  utxo_snapshot& operator=(const utxo_snapshot&) = delete;
+
+  // Returns false if the file cannot be mapped or is not a valid snapshot.
+  bool open(const std::string& path) {
+
+    close();
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd < 0 || ::fstat(fd, &status) != 0) {
+      if (fd >= 0)
+        ::close(fd);
+      return false;
+    }
+
+    const size_t file_size = status.st_size;
+    if (file_size < snapshot_header_size) {
+      ::close(fd);
+      return false;
+    }
+
+    const auto mapped = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED,
+        fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+      return false;
+
+    // Lookups touch one bucket entry and a few entries, read-ahead of
+    // neighbouring pages is of no use.
+    ::madvise(mapped, file_size, MADV_RANDOM);
+    mapped_ = mapped;
+    file_size_ = file_size;
+
+    const auto data = static_cast<const uint8_t*>(mapped);
+    const auto version = from_little_endian_unsafe<uint32_t>(data + 8u);
+    bucket_bits_ = from_little_endian_unsafe<uint32_t>(data + 12u);
+    count_ = from_little_endian_unsafe<uint64_t>(data + 16u);
+    scripts_size_ = from_little_endian_unsafe<uint64_t>(data + 24u);
+
+    if (memcmp(data, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+        version != snapshot_version || bucket_bits_ > max_bucket_bits ||
+        count_ >= max_uint32) {
+      close();
+      return false;
+    }
+
+    buckets_ = data + snapshot_header_size;
+    entries_ = buckets_ + bucket_table_size(bucket_bits_);
+    scripts_ = entries_ + count_ * snapshot_entry_size;
+
+    // Sections must exactly fill the file, and buckets end at the count.
+    const auto buckets = size_t(1) << bucket_bits_;
+    if (static_cast<size_t>(scripts_ - data) > file_size_ ||
+        file_size_ - (scripts_ - data) != scripts_size_ ||
+        bucket_start(buckets) != count_) {
+      close();
+      return false;
+    }
+
+    return true;
+
+  }
+
+  void close() {
+    if (mapped_ != nullptr)
+      ::munmap(mapped_, file_size_);
+
+    mapped_ = nullptr;
+    file_size_ = 0;
+    count_ = 0;
+  }
+
+  size_t size() const {
+    return count_;
+  }
+
+  // Returns false if the point is not in the snapshot.
+  bool find(prevout_view& out, const output_point& point) const {
+
+    if (mapped_ == nullptr)
+      return false;
+
+    const auto hash = point.hash().data();
+    const auto bucket = bucket_of(hash, bucket_bits_);
+    auto first = bucket_start(bucket);
+    auto last = bucket_start(bucket + 1u);
+    if (first > last || last > count_)
+      return false;
+
+    // Binary search within the bucket.
+    while (first < last) {
+      const auto middle = first + (last - first) / 2u;
+      const auto entry = entries_ + middle * snapshot_entry_size;
+      auto order = memcmp(entry, hash, hash_size);
+      if (order == 0) {
+        const auto index = from_little_endian_unsafe<uint32_t>(
+            entry + hash_size);
+        order = index < point.index() ? -1 : index > point.index() ? 1 : 0;
+      }
+
+      if (order < 0) {
+        first = middle + 1u;
+      } else if (order > 0) {
+        last = middle;
+      } else {
+        return read_entry(out, entry);
+      }
+    }
+
+    return false;
+
+  }
+
+private:
+  uint32_t bucket_start(size_t bucket) const {
+    return from_little_endian_unsafe<uint32_t>(
+        buckets_ + bucket * sizeof(uint32_t));
+  }
+
+  bool read_entry(prevout_view& out, const uint8_t* entry) const {
+    const auto size = from_little_endian_unsafe<uint32_t>(entry + 36u);
+    const auto offset = from_little_endian_unsafe<uint64_t>(entry + 48u);
+    if (offset > scripts_size_ || size > scripts_size_ - offset)
+      return false;
+
+    out.value = from_little_endian_unsafe<uint64_t>(entry + 40u);
+    out.script_begin = scripts_ + offset;
+    out.script_end = scripts_ + offset + size;
+    return true;
+  }
+
+  void* mapped_;
+  size_t file_size_;
+  const uint8_t* buckets_;
+  const uint8_t* entries_;
+  const uint8_t* scripts_;
+  uint64_t count_;
+  uint64_t scripts_size_;
+  uint32_t bucket_bits_;
+};
+
+
+// Verifies an input against its previous output in the snapshot.
+// Only the prevout script of the input is deserialised.
+code verify_input(const utxo_snapshot& snapshot, const transaction& tx,
+    uint32_t input_index, uint32_t forks) {
+
+  const auto& input = tx.inputs()[input_index];
+  prevout_view prevout;
+  if (!snapshot.find(prevout, input.previous_output()))
+    return error::missing_previous_output;
+
+  const script prevout_script(data_chunk(prevout.script_begin,
+      prevout.script_end), false);
+  return script::verify(tx, input_index, forks, input.script(),
+      input.witness(), prevout_script, prevout.value);
+
+}
+
+
+void verify_with_snapshot(const std::string& path) {
+
+  // Previous outputs: P2PKH of pubkey0 and P2WPKH of pubkey1.
+  std::string prev_tx =
+      "44101b50393d01de1e113b17eb07e8a09fbf6334e2012575bc97da227958a7a5";
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash, prev_tx);
+
+  std::string previous_btc_amount = "0.5";
+  uint64_t previous_output_amount;
+  decode_base10(previous_output_amount, previous_btc_amount,
+      btc_decimal_places);
+
+  const script p2pkh_script = script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey0));
+  operation::list p2wpkh_operations {
+      operation(opcode::push_size_0),
+      operation(to_chunk(bitcoin_short_hash(pubkey1)))
+  };
+  const script p2wpkh_script(p2wpkh_operations);
+
+  // The snapshot, written once, e.g. by the node at a block height.
+  std::vector<std::pair<output_point, output>> utxos {
+      { output_point(prev_tx_hash, 0u),
+          output(previous_output_amount, p2pkh_script) },
+      { output_point(prev_tx_hash, 1u),
+          output(previous_output_amount, p2wpkh_script) }
+  };
+  std::cout << write_utxo_snapshot(path, utxos, 8u) << std::endl;
+
+  // Spending transaction with both inputs.
+  transaction tx;
+  tx.set_version(1u);
+  for (uint32_t index = 0; index < 2u; index++) {
+    input next;
+    next.set_previous_output(output_point(prev_tx_hash, index));
+    next.set_sequence(max_input_sequence);
+    tx.inputs().push_back(next);
+  }
+  tx.outputs().push_back(output(99800000u, script::to_pay_key_hash_pattern(
+      bitcoin_short_hash(pubkey1))));
+
+  endorsement sig_0;
+  script::create_endorsement(sig_0, my_secret0, p2pkh_script, tx, 0u,
+      sighash_algorithm::all);
+  operation::list input_operations {
+      operation(sig_0),
+      operation(to_chunk(pubkey0))
+  };
+  tx.inputs()[0].set_script(script(input_operations));
+
+  endorsement sig_1;
+  script::create_endorsement(sig_1, my_secret1,
+      script::to_pay_key_hash_pattern(bitcoin_short_hash(pubkey1)), tx, 1u,
+      sighash_algorithm::all, script_version::zero, previous_output_amount);
+  data_stack witness_stack { sig_1, to_chunk(pubkey1) };
+  tx.inputs()[1].set_witness(witness(witness_stack));
+
+  // Prevout scripts and amounts come from the mapped snapshot.
+  utxo_snapshot snapshot;
+  std::cout << snapshot.open(path) << std::endl;
+
+  for (uint32_t index = 0; index < tx.inputs().size(); index++) {
+    const auto ec = verify_input(snapshot, tx, index, rule_fork::all_rules);
+
+    // Prints success
+    std::cout << ec.message() << std::endl;
+  }
+
+  // Unknown previous output.
+  prevout_view prevout;
+  std::cout << snapshot.find(prevout, output_point(prev_tx_hash, 2u))
+            << std::endl; // Prints 0.
+
+}
+
+
+// Compressed outputs.
+//-----------------------------------------------------------------------------
+
+// Script tags. Other scripts are stored with a tag of their size plus
+// raw_script_tag, followed by the script.
+enum class script_tag : uint8_t {
+  p2pkh,        // dup hash160 [20-byte hash] equalverify checksig
+  p2sh,         // hash160 [20-byte hash] equal
+  p2wpkh,       // 0 [20-byte hash]
+  p2wsh         // 0 [32-byte hash]
+};
+
+constexpr uint64_t raw_script_tag = 4u;
+
+// Opcode bytes of the templates.
+constexpr uint8_t op_0 = static_cast<uint8_t>(opcode::push_size_0);
+constexpr uint8_t op_push_20 = static_cast<uint8_t>(opcode::push_size_20);
+constexpr uint8_t op_push_32 = static_cast<uint8_t>(opcode::push_size_32);
+constexpr uint8_t op_dup = static_cast<uint8_t>(opcode::dup);
+constexpr uint8_t op_hash160 = static_cast<uint8_t>(opcode::hash160);
+constexpr uint8_t op_equal = static_cast<uint8_t>(opcode::equal);
+constexpr uint8_t op_equalverify = static_cast<uint8_t>(opcode::equalverify);
+constexpr uint8_t op_checksig = static_cast<uint8_t>(opcode::checksig);
+
+
+// Amounts with trailing decimal zeros, such as 0.01 BTC, are common.
+// The number of trailing zeros (up to 9) is moved into the lowest decimal
+// digit, and the last non-zero digit, which cannot be zero, is stored in
+// base 9, as in the chainstate of Bitcoin Core. Amounts must not exceed
+// max_money(), which holds for the value of any valid output.
+uint64_t compress_amount(uint64_t value) {
+
+  if (value == 0)
+    return 0;
+
+  uint64_t exponent = 0;
+  while (value % 10u == 0 && exponent < 9u) {
+    value /= 10u;
+    exponent++;
+  }
+
+  if (exponent < 9u) {
+    const auto digit = value % 10u;
+    value /= 10u;
+    return 1u + (value * 9u + digit - 1u) * 10u + exponent;
+  }
+
+  return 1u + (value - 1u) * 10u + 9u;
+
+}
+
+
+uint64_t decompress_amount(uint64_t value) {
+
+  if (value == 0)
+    return 0;
+
+  value--;
+  auto exponent = value % 10u;
+  value /= 10u;
+
+  uint64_t amount;
+  if (exponent < 9u) {
+    const auto digit = value % 9u + 1u;
+    value /= 9u;
+    amount = value * 10u + digit;
+  } else {
+    amount = value + 1u;
+  }
+
+  while (exponent-- > 0)
+    amount *= 10u;
+
+  return amount;
+
+}
+
+
+// Base-128 varint, most significant group first, in which each continuation
+// also adds one, so that every value has a single encoding. Values below
+// 128 take one byte, and values below 16512 two.
+void write_varint(writer& sink, uint64_t value) {
+
+  uint8_t groups[10];
+  size_t count = 0;
+  while (true) {
+    groups[count] = (value & 0x7f) | (count == 0 ? 0x00 : 0x80);
+    if (value <= 0x7f)
+      break;
+
+    value = (value >> 7u) - 1u;
+    count++;
+  }
+
+  do {
+    sink.write_byte(groups[count]);
+  } while (count-- > 0);
+
+}
+
+
+// Returns false on overflow or if the source is exhausted.
+bool read_varint(reader& source, uint64_t& out) {
+
+  uint64_t value = 0;
+  while (true) {
+    const auto group = source.read_byte();
+    if (!source || value > (max_uint64 >> 7u))
+      return false;
+
+    value = (value << 7u) | (group & 0x7f);
+    if ((group & 0x80) == 0)
+      break;
+
+    if (value == max_uint64)
+      return false;
+
+    value++;
+  }
+
+  out = value;
+  return true;
+
+}
+
+
+// Template of a serialised output script, without the size prefix. Sets
+// hash to the position of the 20 or 32-byte hash within the script.
+bool match_template(script_tag& tag, const uint8_t*& hash,
+    data_slice script_bytes) {
+
+  const auto bytes = script_bytes.data();
+  const auto size = script_bytes.size();
+
+  if (size == 25u && bytes[0] == op_dup && bytes[1] == op_hash160 &&
+      bytes[2] == op_push_20 && bytes[23] == op_equalverify &&
+      bytes[24] == op_checksig) {
+    tag = script_tag::p2pkh;
+    hash = bytes + 3;
+  } else if (size == 23u && bytes[0] == op_hash160 &&
+      bytes[1] == op_push_20 && bytes[22] == op_equal) {
+    tag = script_tag::p2sh;
+    hash = bytes + 2;
+  } else if (size == 22u && bytes[0] == op_0 && bytes[1] == op_push_20) {
+    tag = script_tag::p2wpkh;
+    hash = bytes + 2;
+  } else if (size == 34u && bytes[0] == op_0 && bytes[1] == op_push_32) {
+    tag = script_tag::p2wsh;
+    hash = bytes + 2;
+  } else {
+    return false;
+  }
+
+  return true;
+
+}
+
+
+// [varint compressed amount] [varint tag] [20 or 32-byte hash], or
+// [varint compressed amount] [varint script size + 4] [script].
+// A P2PKH output of 34 bytes is stored in 22 to 29 bytes. Scripts above
+// max_script_size are written in full, and read back as return.
+void write_compressed_output(writer& sink, uint64_t value,
+    data_slice script_bytes) {
+
+  write_varint(sink, compress_amount(value));
+
+  script_tag tag;
+  const uint8_t* hash;
+  if (!match_template(tag, hash, script_bytes)) {
+    write_varint(sink, raw_script_tag + script_bytes.size());
+    sink.write_bytes(script_bytes.data(), script_bytes.size());
+    return;
+  }
+
+  sink.write_byte(static_cast<uint8_t>(tag));
+  sink.write_bytes(hash, tag == script_tag::p2wsh ? hash_size :
+      short_hash_size);
+
+}
+
+
+// Output decoded into reused storage, the script serialised without its
+// size prefix. Template scripts are rebuilt in place, without allocation
+// once the script has reached its largest size.
+struct decoded_output {
+  uint64_t value;
+  data_chunk script;
+};
+
+
+// Returns false if the source is exhausted or the encoding is invalid.
+bool read_compressed_output(reader& source, decoded_output& out) {
+
+  uint64_t amount;
+  uint64_t tag;
+  if (!read_varint(source, amount) || !read_varint(source, tag))
+    return false;
+
+  out.value = decompress_amount(amount);
+  auto& bytes = out.script;
+
+  switch (tag) {
+    case static_cast<uint8_t>(script_tag::p2pkh): {
+      const auto hash = source.read_short_hash();
+      bytes.resize(25u);
+      bytes[0] = op_dup;
+      bytes[1] = op_hash160;
+      bytes[2] = op_push_20;
+      std::copy(hash.begin(), hash.end(), bytes.begin() + 3);
+      bytes[23] = op_equalverify;
+      bytes[24] = op_checksig;
+      break;
+    }
+    case static_cast<uint8_t>(script_tag::p2sh): {
+      const auto hash = source.read_short_hash();
+      bytes.resize(23u);
+      bytes[0] = op_hash160;
+      bytes[1] = op_push_20;
+      std::copy(hash.begin(), hash.end(), bytes.begin() + 2);
+      bytes[22] = op_equal;
+      break;
+    }
+    case static_cast<uint8_t>(script_tag::p2wpkh): {
+      const auto hash = source.read_short_hash();
+      bytes.resize(22u);
+      bytes[0] = op_0;
+      bytes[1] = op_push_20;
+      std::copy(hash.begin(), hash.end(), bytes.begin() + 2);
+      break;
+    }
+    case static_cast<uint8_t>(script_tag::p2wsh): {
+      const auto hash = source.read_hash();
+      bytes.resize(34u);
+      bytes[0] = op_0;
+      bytes[1] = op_push_32;
+      std::copy(hash.begin(), hash.end(), bytes.begin() + 2);
+      break;
+    }
+    default: {
+      const auto size = tag - raw_script_tag;
+
+      // Outputs may carry scripts above max_script_size, which can never be
+      // spent. As in Bitcoin Core, these are skipped and decoded as return.
+      if (size > max_script_size) {
+        source.skip(size);
+        bytes.assign(1u, static_cast<uint8_t>(opcode::return_));
+        break;
+      }
+
+      bytes = source.read_bytes(size);
+      break;
+    }
+  }
+
+  return bool(source);
+
+}
+
+
+// Interoperability with the output type where it is still required.
+output to_output(const decoded_output& decoded) {
+  return output(decoded.value, script(decoded.script, false));
+}
+
+
+void compress_outputs_example() {
+
+  // P2PKH output of the transaction building examples.
+  payment_address my_address1("mmbmNXo7QZWU2WgWwvrtnyQrwffngWScFe");
+  const output p2pkh_output(129500000u,
+      script::to_pay_key_hash_pattern(my_address1.hash()));
+
+  // P2WPKH, P2SH-P2WPKH and P2WSH outputs as in the witness examples.
+  operation::list p2wpkh_operations {
+      operation(opcode::push_size_0),
+      operation(to_chunk(bitcoin_short_hash(pubkey0)))
+  };
+  const script p2wpkh_script(p2wpkh_operations);
+  const output p2wpkh_output(99800000u, p2wpkh_script);
+  const output p2sh_p2wpkh_output(1000000u, script::to_pay_script_hash_pattern(
+      bitcoin_short_hash(p2wpkh_script.to_data(false))));
+
+  const script multisig_script(script::to_pay_multisig_pattern(2u,
+      point_list{ pubkey0, pubkey1 }));
+  operation::list p2wsh_operations {
+      operation(opcode::push_size_0),
+      operation(to_chunk(sha256_hash(multisig_script.to_data(false))))
+  };
+  const output p2wsh_output(250000000u, script(p2wsh_operations));
+
+  // Bare multisig, stored as a raw script.
+  const output multisig_output(546u, multisig_script);
+
+  const output::list outputs { p2pkh_output, p2wpkh_output,
+      p2sh_p2wpkh_output, p2wsh_output, multisig_output };
+
+  std::ostringstream stream;
+  ostream_writer sink(stream);
+  for (const auto& next: outputs) {
+    const auto before = stream.tellp();
+    write_compressed_output(sink, next.value(),
+        next.script().to_data(false));
+    std::cout << next.serialized_size() << " -> "
+              << stream.tellp() - before << " bytes" << std::endl;
+  }
+
+  // Prints da0800, the amount and the P2PKH tag, before the key hash.
+  const auto compressed = to_chunk(stream.str());
+  std::cout << encode_base16(data_chunk(compressed.begin(),
+      compressed.begin() + 3)) << std::endl;
+
+  // Decoded outputs equal the original outputs.
+  auto source = make_safe_deserializer(compressed.begin(), compressed.end());
+  decoded_output decoded;
+  auto equal = true;
+  for (const auto& next: outputs)
+    equal &= read_compressed_output(source, decoded) &&
+        to_output(decoded) == next;
+
+  std::cout << (equal && source.is_exhausted()) << std::endl;
+
+  // An unspendable script above max_script_size is read back as return,
+  // and the following output is still decoded.
+  std::ostringstream oversized_stream;
+  ostream_writer oversized_sink(oversized_stream);
+  write_compressed_output(oversized_sink, 0u,
+      data_chunk(max_script_size + 1u, 0x00));
+  write_compressed_output(oversized_sink, p2pkh_output.value(),
+      p2pkh_output.script().to_data(false));
+
+  const auto oversized = to_chunk(oversized_stream.str());
+  auto oversized_source = make_safe_deserializer(oversized.begin(),
+      oversized.end());
+  const data_chunk return_script { static_cast<uint8_t>(opcode::return_) };
+  auto valid = read_compressed_output(oversized_source, decoded) &&
+      decoded.script == return_script;
+  valid &= read_compressed_output(oversized_source, decoded) &&
+      to_output(decoded) == p2pkh_output;
+  std::cout << valid << std::endl;
+
+}
+
+
+// Benchmark.
+//-----------------------------------------------------------------------------
+
+// Outputs with random points, P2PKH and P2WPKH scripts and values.
+std::vector<std::pair<output_point, output>> create_utxos(size_t count,
+    std::mt19937_64& random) {
+
+  std::vector<std::pair<output_point, output>> utxos;
+  utxos.reserve(count);
+  short_hash key_hash = null_short_hash;
+  hash_digest tx_hash = null_hash;
+
+  for (size_t index = 0; index < count; index++) {
+    for (size_t offset = 0; offset < hash_size; offset += 8u) {
+      const auto bits = random();
+      memcpy(tx_hash.data() + offset, &bits, sizeof(bits));
+    }
+    key_hash[0] = static_cast<uint8_t>(index);
+    key_hash[1] = static_cast<uint8_t>(index >> 8u);
+
+    operation::list p2wpkh_operations {
+        operation(opcode::push_size_0),
+        operation(to_chunk(key_hash))
+    };
+    const auto prevout_script = index % 2u == 0 ?
+        script(script::to_pay_key_hash_pattern(key_hash)) :
+        script(p2wpkh_operations);
+
+    utxos.push_back({ output_point(tx_hash, index % 3u),
+        output(random() % 2100000000000000u, prevout_script) });
+  }
+
+  return utxos;
+
+}
+
+
+// Loads a snapshot by deserialising every entry into a map, as a node
+// without a mapped format does on startup.
+size_t load_into_map(std::map<point, output>& out, const std::string& path) {
+
+  std::ifstream file(path, std::ios::binary);
+  data_chunk bytes((std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+  if (bytes.size() < snapshot_header_size)
+    return 0;
+
+  const auto bucket_bits = from_little_endian_unsafe<uint32_t>(
+      bytes.data() + 12u);
+  const auto count = from_little_endian_unsafe<uint64_t>(bytes.data() + 16u);
+  const auto entries = bytes.data() + snapshot_header_size +
+      bucket_table_size(bucket_bits);
+  const auto scripts = entries + count * snapshot_entry_size;
+
+  for (uint64_t index = 0; index < count; index++) {
+    const auto entry = entries + index * snapshot_entry_size;
+    const auto size = from_little_endian_unsafe<uint32_t>(entry + 36u);
+    const auto offset = from_little_endian_unsafe<uint64_t>(entry + 48u);
+    const auto value = from_little_endian_unsafe<uint64_t>(entry + 40u);
+    const data_chunk script_bytes(scripts + offset, scripts + offset + size);
+    out[output_point(to_array<hash_size>(data_slice(entry, entry +
+        hash_size)), from_little_endian_unsafe<uint32_t>(entry + 32u))] =
+        output(value, script(script_bytes, false));
+  }
+
+  return out.size();
+
+}
+
+
+void benchmark_utxo_snapshot(const std::string& path, size_t count,
+    size_t lookups) {
+
+  std::mt19937_64 random(42u);
+  const auto utxos = create_utxos(count, random);
+
+  auto start = std::chrono::steady_clock::now();
+  write_utxo_snapshot(path, utxos);
+  const auto write_time = std::chrono::steady_clock::now() - start;
+
+  // Cold start: map the snapshot, against deserialising it into a map.
+  start = std::chrono::steady_clock::now();
+  utxo_snapshot snapshot;
+  const auto opened = snapshot.open(path);
+  const auto open_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  std::map<point, output> loaded;
+  const auto loaded_count = load_into_map(loaded, path);
+  const auto load_time = std::chrono::steady_clock::now() - start;
+
+  // Random lookups of existing and of missing points.
+  std::vector<output_point> existing;
+  std::vector<output_point> missing;
+  for (size_t index = 0; index < lookups; index++) {
+    const auto& point = utxos[random() % utxos.size()].first;
+    existing.push_back(point);
+    missing.push_back(output_point(point.hash(), point.index() + 3u));
+  }
+
+  prevout_view prevout;
+  uint64_t value_sum = 0;
+  size_t found = 0;
+  start = std::chrono::steady_clock::now();
+  for (const auto& point: existing) {
+    found += snapshot.find(prevout, point);
+    value_sum += prevout.value;
+  }
+  const auto found_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (const auto& point: missing)
+    found += snapshot.find(prevout, point);
+  const auto missing_time = std::chrono::steady_clock::now() - start;
+
+  uint64_t map_value_sum = 0;
+  for (const auto& point: existing)
+    map_value_sum += loaded.find(point)->second.value();
+
+  const auto milliseconds = [](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time)
+        .count();
+  };
+  const auto per_lookup = [lookups](
+      std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+        .count() / static_cast<double>(lookups);
+  };
+
+  std::cout << "entries:            " << snapshot.size() << std::endl;
+  std::cout << "write snapshot:     " << milliseconds(write_time) << " ms"
+            << std::endl;
+  std::cout << "open snapshot:      "
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                open_time).count() << " us" << std::endl;
+  std::cout << "load into std::map: " << milliseconds(load_time) << " ms"
+            << std::endl;
+  std::cout << "lookup, found:      " << per_lookup(found_time) << " ns"
+            << std::endl;
+  std::cout << "lookup, missing:    " << per_lookup(missing_time) << " ns"
+            << std::endl;
+
+  // All existing points found, with the values of the map.
+  std::cout << (opened && loaded_count == count && found == lookups &&
+      value_sum == map_value_sum) << std::endl;
+
+}
+
+
+// Output set resembling the UTXO set: about half P2PKH, a quarter P2WPKH,
+// then P2SH, P2WSH, and P2PK or bare multisig scripts. Half of the amounts
+// are round, with at most two significant digits.
+std::vector<output> create_output_set(size_t count,
+    std::mt19937_64& random) {
+
+  std::vector<output> outputs;
+  outputs.reserve(count);
+  hash_digest hash = null_hash;
+
+  for (size_t index = 0; index < count; index++) {
+    for (size_t offset = 0; offset < hash_size; offset += 8u) {
+      const auto bits = random();
+      memcpy(hash.data() + offset, &bits, sizeof(bits));
+    }
+
+    uint64_t power = 1;
+    for (auto exponent = 3u + random() % 6u; exponent > 0; exponent--)
+      power *= 10u;
+
+    const auto value = random() % 2u == 0 ? (1u + random() % 99u) * power :
+        1u + random() % (power * 100u);
+
+    const auto short_hash_bytes = to_array<short_hash_size>(
+        data_slice(hash.begin(), hash.begin() + short_hash_size));
+    const auto kind = random() % 100u;
+    operation::list operations;
+
+    if (kind < 45u) {
+      operations = script::to_pay_key_hash_pattern(short_hash_bytes);
+    } else if (kind < 75u) {
+      operations = { operation(opcode::push_size_0),
+          operation(to_chunk(short_hash_bytes)) };
+    } else if (kind < 88u) {
+      operations = script::to_pay_script_hash_pattern(short_hash_bytes);
+    } else if (kind < 93u) {
+      operations = { operation(opcode::push_size_0),
+          operation(to_chunk(hash)) };
+    } else if (kind < 97u) {
+      operations = script::to_pay_public_key_pattern(to_chunk(pubkey0));
+    } else {
+      operations = script::to_pay_multisig_pattern(1u,
+          point_list{ pubkey0, pubkey1 });
+    }
+
+    outputs.push_back(output(value, script(operations)));
+  }
+
+  return outputs;
+
+}
+
+
+void benchmark_output_compression(size_t count) {
+
+  std::mt19937_64 random(42u);
+  const auto outputs = create_output_set(count, random);
+
+  // Serialised scripts, as read from storage.
+  std::vector<data_chunk> scripts;
+  scripts.reserve(count);
+  size_t full_size = 0;
+  for (const auto& next: outputs) {
+    scripts.push_back(next.script().to_data(false));
+    full_size += next.serialized_size();
+  }
+
+  // Buffer mode. A raw script output of up to max_money() is at most one
+  // byte larger than the serialised output.
+  data_chunk buffer(full_size + count);
+  auto start = std::chrono::steady_clock::now();
+  auto sink = make_unsafe_serializer(buffer.data());
+  for (size_t index = 0; index < count; index++)
+    write_compressed_output(sink, outputs[index].value(), scripts[index]);
+  const auto encode_time = std::chrono::steady_clock::now() - start;
+
+  // Stream mode, e.g. to a storage file.
+  std::ostringstream output_stream;
+  ostream_writer stream_sink(output_stream);
+  for (size_t index = 0; index < count; index++)
+    write_compressed_output(stream_sink, outputs[index].value(),
+        scripts[index]);
+
+  const auto compressed = output_stream.str();
+  const auto compressed_size = compressed.size();
+  const auto same_bytes = std::equal(compressed.begin(), compressed.end(),
+      buffer.begin(), [](char left, uint8_t right) {
+        return static_cast<uint8_t>(left) == right;
+      });
+
+  decoded_output decoded;
+  uint64_t checksum = 0;
+  size_t decoded_count = 0;
+
+  start = std::chrono::steady_clock::now();
+  auto source = make_safe_deserializer(buffer.data(),
+      buffer.data() + compressed_size);
+  while (read_compressed_output(source, decoded)) {
+    checksum += decoded.value + decoded.script.size();
+    decoded_count++;
+  }
+  const auto buffer_decode_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  std::istringstream input_stream(compressed);
+  istream_reader stream_source(input_stream);
+  for (size_t index = 0; index < count &&
+      read_compressed_output(stream_source, decoded); index++)
+    checksum -= decoded.value + decoded.script.size();
+  const auto stream_decode_time = std::chrono::steady_clock::now() - start;
+
+  // Decoding into output objects parses each script.
+  start = std::chrono::steady_clock::now();
+  auto output_source = make_safe_deserializer(buffer.data(),
+      buffer.data() + compressed_size);
+  size_t equal = 0;
+  for (size_t index = 0; index < count &&
+      read_compressed_output(output_source, decoded); index++)
+    equal += to_output(decoded) == outputs[index];
+  const auto output_decode_time = std::chrono::steady_clock::now() - start;
+
+  const auto per_output = [count](std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+        .count() / static_cast<double>(count);
+  };
+
+  std::cout << "serialised outputs:     " << full_size << " bytes"
+            << std::endl;
+  std::cout << "compressed outputs:     " << compressed_size << " bytes, "
+            << 100u - compressed_size * 100u / full_size << "% saved"
+            << std::endl;
+  std::cout << "encode:                 " << per_output(encode_time)
+            << " ns/output" << std::endl;
+  std::cout << "decode, buffer:         " << per_output(buffer_decode_time)
+            << " ns/output" << std::endl;
+  std::cout << "decode, stream:         " << per_output(stream_decode_time)
+            << " ns/output" << std::endl;
+  std::cout << "decode, chain::output:  " << per_output(output_decode_time)
+            << " ns/output" << std::endl;
+
+  // Both modes wrote and read the same outputs, equal to the originals.
+  std::cout << (same_bytes && decoded_count == count && checksum == 0 &&
+      equal == count) << std::endl;
+
+}
+
+
+int main(int argc, char* argv[]) {
+
+  // Snapshot path, in the working directory by default.
+  const std::string path = argc > 1 ? argv[1] : "utxo_snapshot.dat";
+
+  verify_with_snapshot(path);
+
+  compress_outputs_example();
+
+  benchmark_utxo_snapshot(path, 1000000, 1000000);
+
+  benchmark_output_compression(1000000);
+
+  return 0;
+
+}
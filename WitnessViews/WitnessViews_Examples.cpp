@@ -0,0 +1,678 @@
+#include <bitcoin/bitcoin.hpp>
+#include <string.h>
+#include <array>
+#include <chrono>
+#include <iostream>
+
+using namespace bc;
+using namespace wallet;
+using namespace chain;
+using namespace machine;
+
+// "Witness Aware" wallet.
+auto my_secret_witness_aware = base16_literal(
+    "0a44957babaa5fd46c0d921b236c50b1369519c7032df7906a18a31bb905cfdf");
+ec_private my_private_witness_aware(my_secret_witness_aware,
+    ec_private::testnet, true);
+auto pubkey_witness_aware = my_private_witness_aware.to_public().point();
+
+// Sighash type bits.
+constexpr uint8_t sighash_mask = 0x1f;
+
+
+// BIP143 signature hash context.
+//-----------------------------------------------------------------------------
+
+// Precomputes the transaction-wide BIP143 commitments once per transaction,
+// as in the sighash caching examples. The script code is passed as a view,
+// so that a witness script is hashed where it is stored.
+class sighash_context {
+
+public:
+  explicit sighash_context(const transaction& tx)
+    : tx_(tx) {
+
+    const auto& inputs = tx.inputs();
+    const auto& outputs = tx.outputs();
+
+    data_chunk points(inputs.size() * (hash_size + sizeof(uint32_t)));
+    auto point_sink = make_unsafe_serializer(points.begin());
+    for (const auto& input: inputs)
+      input.previous_output().to_data(point_sink);
+    prevouts_hash_ = bitcoin_hash(points);
+
+    data_chunk sequences(inputs.size() * sizeof(uint32_t));
+    auto sequence_sink = make_unsafe_serializer(sequences.begin());
+    for (const auto& input: inputs)
+      sequence_sink.write_4_bytes_little_endian(input.sequence());
+    sequences_hash_ = bitcoin_hash(sequences);
+
+    size_t outputs_size = 0;
+    for (const auto& output: outputs)
+      outputs_size += output.serialized_size();
+
+    data_chunk serialised_outputs(outputs_size);
+    auto output_sink = make_unsafe_serializer(serialised_outputs.begin());
+    for (const auto& output: outputs)
+      output.to_data(output_sink);
+    outputs_hash_ = bitcoin_hash(serialised_outputs);
+  }
+
+  const transaction& tx() const {
+    return tx_;
+  }
+
+  // BIP143 signature hash of one input.
+  hash_digest signature_hash(uint32_t input_index, data_slice script_code,
+      uint64_t value, uint8_t sighash_type) const {
+
+    const auto anyone = (sighash_type & sighash_algorithm::anyone_can_pay) != 0;
+    const auto type = sighash_type & sighash_mask;
+    const auto single = type == sighash_algorithm::single;
+    const auto none = type == sighash_algorithm::none;
+    const auto& input = tx_.inputs()[input_index];
+
+    // Single output commitment for SIGHASH_SINGLE.
+    auto outputs_hash = null_hash;
+    if (!single && !none)
+      outputs_hash = outputs_hash_;
+    else if (single && input_index < tx_.outputs().size())
+      outputs_hash = bitcoin_hash(tx_.outputs()[input_index].to_data());
+
+    // Fixed fields plus the script code, on the stack for standard scripts.
+    const auto size = 4u + 32u + 32u + 36u +
+        variable_uint_size(script_code.size()) + script_code.size() +
+        8u + 4u + 32u + 4u + 4u;
+    uint8_t stack_buffer[2048];
+    data_chunk heap_buffer;
+    auto preimage = stack_buffer;
+    if (size > sizeof(stack_buffer)) {
+      heap_buffer.resize(size);
+      preimage = heap_buffer.data();
+    }
+
+    auto sink = make_unsafe_serializer(preimage);
+    sink.write_4_bytes_little_endian(tx_.version());
+    sink.write_hash(anyone ? null_hash : prevouts_hash_);
+    sink.write_hash(anyone || single || none ? null_hash : sequences_hash_);
+    input.previous_output().to_data(sink);
+    sink.write_variable_little_endian(script_code.size());
+    sink.write_bytes(script_code.data(), script_code.size());
+    sink.write_8_bytes_little_endian(value);
+    sink.write_4_bytes_little_endian(input.sequence());
+    sink.write_hash(outputs_hash);
+    sink.write_4_bytes_little_endian(tx_.locktime());
+    sink.write_4_bytes_little_endian(sighash_type);
+
+    return bitcoin_hash(data_slice(preimage, preimage + size));
+  }
+
+private:
+  const transaction& tx_;
+  hash_digest prevouts_hash_;
+  hash_digest sequences_hash_;
+  hash_digest outputs_hash_;
+};
+
+
+// Witness views.
+//-----------------------------------------------------------------------------
+
+// Templates verified on views, others are passed to the interpreter.
+enum class witness_template {
+  p2wpkh,
+  p2wsh_multisig,
+  p2wsh
+};
+
+
+// Views of a version 0 witness program and of the witness of its input, as
+// witness::extract_embedded_script() extracts them. Refers to the witness
+// stack of the input, which must outlive the view.
+class witness_program_view {
+
+public:
+  witness_program_view(const data_stack& stack, const data_chunk& program)
+    : stack_(stack), program_(program), kind_(witness_template::p2wsh) {
+  }
+
+  witness_template kind() const {
+    return kind_;
+  }
+
+  // All elements of the witness.
+  size_t elements() const {
+    return stack_.size();
+  }
+
+  // Elements passed to the witness script, without the script itself.
+  size_t size() const {
+    return kind_ == witness_template::p2wpkh ? stack_.size() :
+        stack_.size() - 1u;
+  }
+
+  data_slice operator[](size_t index) const {
+    return stack_[index];
+  }
+
+  data_slice program() const {
+    return program_;
+  }
+
+  // The last witness element of a P2WSH input.
+  data_slice witness_script() const {
+    return stack_.back();
+  }
+
+  void set_kind(witness_template kind) {
+    kind_ = kind;
+  }
+
+private:
+  const data_stack& stack_;
+  const data_chunk& program_;
+  witness_template kind_;
+};
+
+
+// Key positions of a multisig script view:
+//    m [key 1] ... [key n] n checkmultisig
+class multisig_view {
+
+public:
+  explicit multisig_view(data_slice script_bytes)
+    : script_(script_bytes), signatures_(0), keys_(0) {
+
+    const auto push_1 = static_cast<uint8_t>(opcode::push_positive_1);
+    const auto push_16 = static_cast<uint8_t>(opcode::push_positive_16);
+    const auto bytes = script_.data();
+    const auto size = script_.size();
+    if (size < 3u || bytes[0] < push_1 || bytes[0] > push_16 ||
+        bytes[size - 1u] != static_cast<uint8_t>(opcode::checkmultisig))
+      return;
+
+    size_t position = 1;
+    while (position < size - 2u && keys_ < offsets_.size()) {
+      const size_t key_size = bytes[position];
+      if ((key_size != ec_compressed_size &&
+          key_size != ec_uncompressed_size) ||
+          position + 1u + key_size > size - 2u)
+        return;
+
+      offsets_[keys_++] = position + 1u;
+      position += 1u + key_size;
+    }
+
+    const size_t signatures = bytes[0] - push_1 + 1u;
+    const size_t keys = bytes[size - 2u] - push_1 + 1u;
+    if (position == size - 2u && keys == keys_ && signatures <= keys)
+      signatures_ = signatures;
+  }
+
+  bool valid() const {
+    return signatures_ != 0;
+  }
+
+  size_t signatures() const {
+    return signatures_;
+  }
+
+  size_t keys() const {
+    return keys_;
+  }
+
+  data_slice key(size_t index) const {
+    const auto begin = script_.data() + offsets_[index];
+    return data_slice(begin, begin + begin[-1]);
+  }
+
+private:
+  data_slice script_;
+  size_t signatures_;
+  size_t keys_;
+  std::array<size_t, max_script_public_keys> offsets_;
+};
+
+
+// Views of the witness of a version 0 program. Returns false where
+// extract_embedded_script() fails, including a witness script which does not
+// hash to the program. The witness script is hashed in place.
+bool extract_program_view(witness_program_view& out,
+    const script& program_script) {
+
+  if (program_script.version() != script_version::zero)
+    return false;
+
+  const auto program = out.program();
+  if (program.size() == short_hash_size) {
+    out.set_kind(witness_template::p2wpkh);
+    return out.elements() == 2u;
+  }
+
+  if (program.size() != hash_size || out.elements() == 0u)
+    return false;
+
+  const auto script_hash = sha256_hash(out.witness_script());
+  if (!std::equal(script_hash.begin(), script_hash.end(), program.begin()))
+    return false;
+
+  out.set_kind(multisig_view(out.witness_script()).valid() ?
+      witness_template::p2wsh_multisig : witness_template::p2wsh);
+  return true;
+
+}
+
+
+// Verification.
+//-----------------------------------------------------------------------------
+
+// Checks an endorsement view against a public key view. The DER parser of
+// the library takes a der_signature, so the signature is decoded from a
+// buffer which is reused for all signatures of a verifier.
+bool check_signature(const sighash_context& context, uint32_t input_index,
+    data_slice script_code, uint64_t value, data_slice endorsement_view,
+    data_slice point, der_signature& scratch) {
+
+  if (endorsement_view.empty())
+    return false;
+
+  const auto sighash_type = endorsement_view.data()[
+      endorsement_view.size() - 1u];
+  scratch.assign(endorsement_view.begin(), endorsement_view.end() - 1);
+
+  ec_signature signature;
+  if (!parse_signature(signature, scratch, true))
+    return false;
+
+  return verify_signature(point, context.signature_hash(input_index,
+      script_code, value, sighash_type), signature);
+
+}
+
+
+// Runs all operations of a program, as debug_program() of the script machine
+// examples without printing.
+code run_program(program& current_program) {
+
+  if (!current_program.is_valid())
+    return error::invalid_script;
+
+  for (const auto& op: current_program) {
+    if (op.is_oversized())
+      return error::invalid_push_data_size;
+
+    if (op.is_disabled())
+      return error::op_disabled;
+
+    if (!current_program.increment_operation_count(op))
+      return error::invalid_operation_count;
+
+    if (current_program.if_(op)) {
+      if (current_program.is_stack_overflow())
+        return error::invalid_stack_size;
+
+      const auto ec = current_program.evaluate(op);
+      if (ec)
+        return ec;
+    }
+  }
+
+  return current_program.closed() ? error::success :
+      error::invalid_stack_scope;
+
+}
+
+
+// The witness program evaluation of run_p2sh_p2wpkh() in the script machine
+// examples: the witness stack and script are copied out of the witness.
+code verify_witness_copy(const transaction& tx, uint32_t input_index,
+    uint32_t forks, const script& program_script, uint64_t value) {
+
+  script witness_script;
+  data_stack stack;
+  if (!tx.inputs()[input_index].witness().extract_embedded_script(
+      witness_script, stack, program_script))
+    return error::invalid_witness;
+
+  program witness_program(witness_script, tx, input_index, forks,
+      std::move(stack), value, program_script.version());
+
+  const auto ec = run_program(witness_program);
+  if (ec)
+    return ec;
+
+  return witness_program.stack_result(true) ? error::success :
+      error::stack_false;
+
+}
+
+
+// Native version 0 witness spend verified on views of its witness. P2WPKH
+// and P2WSH multisig inputs are verified without copying witness elements.
+// Other witness scripts, and inputs which do not exactly match these
+// templates, are passed to the interpreter. Without bip141 and bip143 the
+// input is not verified as a witness input, so it is passed to
+// script::verify().
+code verify_witness_view(const sighash_context& context,
+    uint32_t input_index, uint32_t forks, const script& program_script,
+    uint64_t value, der_signature& scratch) {
+
+  const auto& tx = context.tx();
+  const auto& input = tx.inputs()[input_index];
+  if (!(forks & rule_fork::bip141_rule) || !(forks & rule_fork::bip143_rule))
+    return script::verify(tx, input_index, forks, input.script(),
+        input.witness(), program_script, value);
+
+  if (!input.script().empty())
+    return error::dirty_witness;
+
+  if (!script::is_witness_program_pattern(program_script.operations()))
+    return error::invalid_witness;
+
+  witness_program_view view(input.witness().stack(),
+      program_script[1].data());
+  if (!extract_program_view(view, program_script))
+    return error::invalid_witness;
+
+  switch (view.kind()) {
+    case witness_template::p2wpkh: {
+
+      // [signature] [public key], script code is the P2PKH script:
+      //    dup hash160 [20-byte program] equalverify checksig
+      const auto point = view[1];
+      const auto key_hash = bitcoin_short_hash(point);
+      if (!std::equal(key_hash.begin(), key_hash.end(),
+          view.program().begin()))
+        break;
+
+      uint8_t code_bytes[25];
+      code_bytes[0] = static_cast<uint8_t>(opcode::dup);
+      code_bytes[1] = static_cast<uint8_t>(opcode::hash160);
+      code_bytes[2] = static_cast<uint8_t>(opcode::push_size_20);
+      std::copy(key_hash.begin(), key_hash.end(), code_bytes + 3);
+      code_bytes[23] = static_cast<uint8_t>(opcode::equalverify);
+      code_bytes[24] = static_cast<uint8_t>(opcode::checksig);
+
+      return check_signature(context, input_index, data_slice(code_bytes,
+          code_bytes + sizeof(code_bytes)), value, view[0], point, scratch) ?
+          error::success : error::stack_false;
+    }
+
+    case witness_template::p2wsh_multisig: {
+
+      // [empty] [signature 1] ... [signature m], script code is the
+      // witness script.
+      const multisig_view multisig(view.witness_script());
+      if (view.size() != multisig.signatures() + 1u || !view[0].empty())
+        break;
+
+      size_t key_index = 0;
+      for (size_t index = 1; index < view.size(); index++) {
+        auto matched = false;
+        while (!matched && key_index < multisig.keys())
+          matched = check_signature(context, input_index,
+              view.witness_script(), value, view[index],
+              multisig.key(key_index++), scratch);
+
+        if (!matched)
+          return error::stack_false;
+      }
+
+      return error::success;
+    }
+
+    default:
+      break;
+  }
+
+  return verify_witness_copy(tx, input_index, forks, program_script, value);
+
+}
+
+
+// Witness spends.
+//-----------------------------------------------------------------------------
+
+// Signed witness spend of one input, with its previous output.
+struct witness_spend {
+  transaction tx;
+  script prevout_script;
+  uint64_t value;
+};
+
+
+witness_spend create_spend_template() {
+
+  hash_digest prev_tx_hash;
+  decode_hash(prev_tx_hash,
+      "44101b50393d01de1e113b17eb07e8a09fbf6334e2012575bc97da227958a7a5");
+  input witness_input;
+  witness_input.set_previous_output(output_point(prev_tx_hash, 0u));
+  witness_input.set_sequence(max_input_sequence);
+
+  witness_spend spend;
+  spend.value = 100000000u;
+  spend.tx.set_version(1u);
+  spend.tx.inputs().push_back(witness_input);
+  spend.tx.outputs().push_back(output(spend.value - 100000u,
+      script::to_pay_key_hash_pattern(bitcoin_short_hash(
+          pubkey_witness_aware))));
+  spend.tx.set_locktime(0u);
+  return spend;
+
+}
+
+
+witness_spend create_p2wpkh_spend() {
+
+  auto spend = create_spend_template();
+  const auto key_hash = bitcoin_short_hash(pubkey_witness_aware);
+  spend.prevout_script = script(operation::list {
+      operation(opcode::push_size_0),
+      operation(to_chunk(key_hash))
+  });
+
+  endorsement sig;
+  script::create_endorsement(sig, my_secret_witness_aware,
+      script::to_pay_key_hash_pattern(key_hash), spend.tx, 0u,
+      sighash_algorithm::all, script_version::zero, spend.value);
+  spend.tx.inputs()[0].set_witness(witness(data_stack {
+      sig,
+      to_chunk(pubkey_witness_aware)
+  }));
+  return spend;
+
+}
+
+
+// P2WSH spend of the witness script, signed by the given secrets. Multisig
+// witnesses start with the dummy element of checkmultisig.
+witness_spend create_p2wsh_spend(const script& witness_script,
+    const std::vector<ec_secret>& secrets, bool multisig) {
+
+  auto spend = create_spend_template();
+  const auto witness_script_data = witness_script.to_data(false);
+  spend.prevout_script = script(operation::list {
+      operation(opcode::push_size_0),
+      operation(to_chunk(sha256_hash(witness_script_data)))
+  });
+
+  data_stack witness_stack;
+  if (multisig)
+    witness_stack.push_back(data_chunk());
+
+  for (const auto& secret: secrets) {
+    endorsement sig;
+    script::create_endorsement(sig, secret, witness_script, spend.tx, 0u,
+        sighash_algorithm::all, script_version::zero, spend.value);
+    witness_stack.push_back(sig);
+  }
+
+  witness_stack.push_back(witness_script_data);
+  spend.tx.inputs()[0].set_witness(witness(witness_stack));
+  return spend;
+
+}
+
+
+// 15-of-15 multisig with uncompressed keys: a witness script of 993 bytes.
+witness_spend create_large_multisig_spend() {
+
+  std::vector<ec_secret> secrets;
+  operation::list operations {
+      operation(operation::opcode_from_positive(15u))
+  };
+
+  for (size_t index = 0; index < 15u; index++) {
+    ec_uncompressed point;
+    secrets.push_back(sha256_hash(data_chunk{
+        static_cast<uint8_t>(index) }));
+    secret_to_public(point, secrets.back());
+    operations.push_back(operation(to_chunk(point)));
+  }
+
+  operations.push_back(operation(operation::opcode_from_positive(15u)));
+  operations.push_back(operation(opcode::checkmultisig));
+  return create_p2wsh_spend(script(operations), secrets, true);
+
+}
+
+
+// [public key] checksig: not a multisig script, verified by the interpreter.
+witness_spend create_p2wsh_checksig_spend() {
+
+  const script witness_script(operation::list {
+      operation(to_chunk(pubkey_witness_aware)),
+      operation(opcode::checksig)
+  });
+  return create_p2wsh_spend(witness_script,
+      std::vector<ec_secret> { my_secret_witness_aware }, false);
+
+}
+
+
+void verify_with_views() {
+
+  const witness_spend spends[] = {
+      create_p2wpkh_spend(),
+      create_large_multisig_spend(),
+      create_p2wsh_checksig_spend()
+  };
+  der_signature scratch;
+
+  for (const auto& spend: spends) {
+    const auto& input = spend.tx.inputs()[0];
+    const auto expected = script::verify(spend.tx, 0u, rule_fork::all_rules,
+        input.script(), input.witness(), spend.prevout_script, spend.value);
+
+    const sighash_context context(spend.tx);
+    const auto ec = verify_witness_view(context, 0u, rule_fork::all_rules,
+        spend.prevout_script, spend.value, scratch);
+
+    // Prints success 1
+    std::cout << ec.message() << " " << (bool(ec) == bool(expected))
+              << std::endl;
+  }
+
+  // Last signature of the multisig spend no longer matches its key.
+  auto tampered = spends[1];
+  auto stack = tampered.tx.inputs()[0].witness().stack();
+  auto& signature = stack[stack.size() - 2u];
+  signature[signature.size() - 3u] ^= 0x01;
+  tampered.tx.inputs()[0].set_witness(witness(stack));
+
+  const auto& input = tampered.tx.inputs()[0];
+  const auto expected = script::verify(tampered.tx, 0u, rule_fork::all_rules,
+      input.script(), input.witness(), tampered.prevout_script,
+      tampered.value);
+  const sighash_context context(tampered.tx);
+  const auto ec = verify_witness_view(context, 0u, rule_fork::all_rules,
+      tampered.prevout_script, tampered.value, scratch);
+
+  // Prints 1 1
+  std::cout << bool(ec) << " " << bool(expected) << std::endl;
+
+}
+
+
+void benchmark_witness_views(size_t iterations) {
+
+  const auto spend = create_large_multisig_spend();
+  const auto& input = spend.tx.inputs()[0];
+  const auto forks = rule_fork::all_rules;
+  der_signature scratch;
+  size_t checksum = 0;
+
+  const auto per_iteration = [iterations](
+      std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+        .count() / static_cast<double>(iterations);
+  };
+
+  // Extraction: copies of the stack and a parse of the witness script.
+  auto start = std::chrono::steady_clock::now();
+  for (size_t count = 0; count < iterations; count++) {
+    script witness_script;
+    data_stack stack;
+    checksum += input.witness().extract_embedded_script(witness_script,
+        stack, spend.prevout_script) ? stack.size() : 0u;
+  }
+  const auto copy_time = std::chrono::steady_clock::now() - start;
+
+  // Extraction: views into the witness.
+  start = std::chrono::steady_clock::now();
+  for (size_t count = 0; count < iterations; count++) {
+    witness_program_view view(input.witness().stack(),
+        spend.prevout_script[1].data());
+    checksum -= extract_program_view(view, spend.prevout_script) ?
+        view.size() : 0u;
+  }
+  const auto view_time = std::chrono::steady_clock::now() - start;
+
+  std::cout << "extract_embedded_script(): " << per_iteration(copy_time)
+            << " ns" << std::endl;
+  std::cout << "extract_program_view():    " << per_iteration(view_time)
+            << " ns" << std::endl;
+
+  // Verification, dominated by the 15 signature checks.
+  const auto verifications = iterations / 100u;
+  size_t failures = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t count = 0; count < verifications; count++)
+    failures += bool(verify_witness_copy(spend.tx, 0u, forks,
+        spend.prevout_script, spend.value));
+  const auto copy_verify_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (size_t count = 0; count < verifications; count++) {
+    const sighash_context context(spend.tx);
+    failures += bool(verify_witness_view(context, 0u, forks,
+        spend.prevout_script, spend.value, scratch));
+  }
+  const auto view_verify_time = std::chrono::steady_clock::now() - start;
+
+  const auto per_verification = [verifications](
+      std::chrono::steady_clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time)
+        .count() / static_cast<double>(verifications);
+  };
+
+  std::cout << "verify_witness_copy():     "
+            << per_verification(copy_verify_time) << " us" << std::endl;
+  std::cout << "verify_witness_view():     "
+            << per_verification(view_verify_time) << " us" << std::endl;
+  std::cout << "checksum: " << checksum << ", failures: " << failures
+            << std::endl;
+
+}
+
+
+int main() {
+
+  verify_with_views();
+
+  benchmark_witness_views(100000);
+
+  return 0;
+
+}